@@ -0,0 +1,149 @@
+#include "auralizer.h"
+#include "rayverb.h"
+#include "sndfile_writer.h"
+
+#include "sndfile.hh"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+/// The number of samples convolved at once, as an audio callback would.
+const unsigned long BLOCK_SIZE = 512;
+
+/// The length of the fade when the impulse response is switched.
+const unsigned long CROSSFADE_LENGTH = 4096;
+
+/// Read every channel of a sound file.
+vector <vector <float>> readChannels (const string & fname, float & sr)
+{
+    SndfileHandle file (fname);
+    if (file.error())
+        throw runtime_error ("failed to open " + fname + ": " + file.strError());
+
+    vector <float> interleaved (file.frames() * file.channels());
+    file.readf (interleaved.data(), file.frames());
+
+    vector <vector <float>> ret
+    (   file.channels()
+    ,   vector <float> (file.frames())
+    );
+    for (auto i = 0u; i != ret.size(); ++i)
+        for (auto j = 0u; j != ret [i].size(); ++j)
+            ret [i] [j] = interleaved [j * ret.size() + i];
+
+    sr = file.samplerate();
+    return ret;
+}
+
+/// Streams a dry sound file through a rendered impulse response, a block at a
+/// time, as a live auralization would, and reports how much faster than real
+/// time it ran.
+/// Optionally switches to a second impulse response partway through, to hear
+/// the crossfade between traces.
+int main (int argc, const char * argv[])
+{
+    if (argc != 4 && argc != 6)
+    {
+        cerr << "Command-line parameters are <impulse response> <input file> <output file>" << endl;
+        cerr << "or, to switch responses partway through, <impulse response> <input file> <output file> <second impulse response> <switch time (seconds)>" << endl;
+        exit (1);
+    }
+
+    map <string, unsigned long> ftypeTable
+    {   {"aif", SF_FORMAT_AIFF}
+    ,   {"aiff", SF_FORMAT_AIFF}
+    ,   {"wav", SF_FORMAT_WAV}
+    ,   {"caf", SF_FORMAT_CAF}
+    };
+
+    const string output_filename (argv [3]);
+    auto extension = output_filename.substr (output_filename.find_last_of (".") + 1);
+    auto ftypeIt = ftypeTable.find (extension);
+    if (ftypeIt == ftypeTable.end())
+    {
+        cerr << "Invalid output file extension - valid extensions are: ";
+        for (const auto & i : ftypeTable)
+            cerr << i.first << " ";
+        cerr << endl;
+        exit (1);
+    }
+
+    try
+    {
+        float irRate = 0;
+        const auto irs = readChannels (argv [1], irRate);
+
+        float sampleRate = 0;
+        const auto input = readChannels (argv [2], sampleRate);
+        if (sampleRate != irRate)
+            cerr << "WARNING: input and impulse response sample rates differ" << endl;
+
+        vector <vector <float>> switched;
+        unsigned long switchFrame = 0;
+        if (argc == 6)
+        {
+            float switchedRate = 0;
+            switched = readChannels (argv [4], switchedRate);
+            if (switched.size() != irs.size())
+                throw runtime_error ("both impulse responses must have the same number of channels");
+            switchFrame = atof (argv [5]) * sampleRate;
+        }
+
+        //  Mix the input down to mono.
+        vector <float> mono (input.empty() ? 0 : input.front().size(), 0);
+        for (const auto & i : input)
+            for (auto j = 0u; j != mono.size(); ++j)
+                mono [j] += i [j] / input.size();
+
+        //  Keep going until the longest tail has rung out.
+        auto tail = irs.front().size();
+        if (! switched.empty())
+            tail = max (tail, switched.front().size());
+        const auto blocks = (mono.size() + tail + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        mono.resize (blocks * BLOCK_SIZE, 0);
+
+        vector <vector <float>> output
+        (   irs.size()
+        ,   vector <float> (blocks * BLOCK_SIZE, 0)
+        );
+
+        Auralizer auralizer (irs.size(), BLOCK_SIZE, CROSSFADE_LENGTH);
+        auralizer.setImpulseResponses (irs);
+
+        vector <float *> outputs (output.size());
+        const auto start = chrono::steady_clock::now();
+
+        for (auto i = 0u; i != blocks; ++i)
+        {
+            const auto frame = i * BLOCK_SIZE;
+            if (! switched.empty() && frame <= switchFrame && switchFrame < frame + BLOCK_SIZE)
+                auralizer.setImpulseResponses (switched);
+
+            for (auto j = 0u; j != output.size(); ++j)
+                outputs [j] = output [j].data() + frame;
+            auralizer.process (mono.data() + frame, outputs);
+        }
+
+        const chrono::duration <double> elapsed = chrono::steady_clock::now() - start;
+        const auto duration = blocks * BLOCK_SIZE / sampleRate;
+        cerr << "convolved " << duration << " s of audio in " << elapsed.count()
+             << " s (" << duration / elapsed.count() << "x real time)" << endl;
+
+        postprocess (output, true, false, 1);
+        write_sndfile (output_filename, output, sampleRate, SF_FORMAT_FLOAT, ftypeIt->second);
+    }
+    catch (runtime_error error)
+    {
+        cerr << "encountered runtime error:" << endl;
+        cerr << error.what() << endl;
+        exit (1);
+    }
+
+    exit (0);
+}
@@ -0,0 +1,628 @@
+#include "rayverb.h"
+#include "helpers.h"
+#include "scene_cache.h"
+#include "sndfile_writer.h"
+#include "late_tail.h"
+
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace rapidjson;
+
+#ifndef DEMO_ROOT
+#define DEMO_ROOT "demo"
+#endif
+
+/// A demo model, with a source and mic position taken from its demo config.
+struct BenchScene
+{
+    string name;
+    string model;
+    string material;
+    cl_float3 source;
+    cl_float3 mic;
+};
+
+/// Timings of a single benchmark case, in milliseconds.
+struct BenchResult
+{
+    string name;
+    map <string, string> params;
+    vector <double> times;
+};
+
+/// A scene cache directory that only lasts as long as the bench, so that
+/// loads can be timed with and without a cache, and no caches are left
+/// behind.
+class TemporarySceneCache
+{
+public:
+    TemporarySceneCache()
+    {
+        const auto tmp = getenv ("TMPDIR");
+        auto pattern = string (tmp && *tmp ? tmp : "/tmp") + "/rayverb_bench_XXXXXX";
+        if (! mkdtemp (&pattern [0]))
+            throw runtime_error ("failed to make a temporary scene cache directory");
+        dir = pattern;
+        SceneCache::setDirectory (dir);
+    }
+
+    virtual ~TemporarySceneCache()
+    {
+        SceneCache::setDirectory ("");
+
+        if (auto d = opendir (dir.c_str()))
+        {
+            while (auto entry = readdir (d))
+            {
+                const string name (entry->d_name);
+                if (name != "." && name != "..")
+                    remove ((dir + "/" + name).c_str());
+            }
+            closedir (d);
+        }
+        rmdir (dir.c_str());
+    }
+
+    TemporarySceneCache (const TemporarySceneCache &) = delete;
+    TemporarySceneCache & operator= (const TemporarySceneCache &) = delete;
+
+    /// Remove the cache of a scene, so that it is imported when it is next
+    /// loaded.
+    void clear (const string & objpath, const string & materialFileName)
+    {
+        remove (SceneCache::path (objpath, materialFileName).c_str());
+    }
+
+private:
+    string dir;
+};
+
+/// Directions from a fixed seed, so that every run traces the same rays.
+vector <cl_float3> getSeededDirections (unsigned long num)
+{
+    vector <cl_float3> ret (num);
+    uniform_real_distribution <float> zDist (-1, 1);
+    uniform_real_distribution <float> thetaDist (-M_PI, M_PI);
+    default_random_engine engine (0);
+
+    for (auto && i : ret)
+        i = spherePoint (zDist (engine), thetaDist (engine));
+
+    return ret;
+}
+
+/// Time `repeats` calls of run, calling prepare (untimed) before each one.
+BenchResult measure
+(   const string & name
+,   const map <string, string> & params
+,   unsigned long repeats
+,   const function <void()> & prepare
+,   const function <void()> & run
+)
+{
+    cerr << name;
+    for (const auto & i : params)
+        cerr << " " << i.first << "=" << i.second;
+    cerr << endl;
+
+    BenchResult ret {name, params, {}};
+    for (auto i = 0u; i != repeats; ++i)
+    {
+        prepare();
+        const auto start = chrono::steady_clock::now();
+        run();
+        const auto stop = chrono::steady_clock::now();
+        ret.times.push_back
+        (   chrono::duration <double, milli> (stop - start).count()
+        );
+    }
+    return ret;
+}
+
+BenchResult measure
+(   const string & name
+,   const map <string, string> & params
+,   unsigned long repeats
+,   const function <void()> & run
+)
+{
+    return measure (name, params, repeats, [] {}, run);
+}
+
+void writeJson (ostream & os, const vector <BenchResult> & results, unsigned long repeats)
+{
+    StringBuffer stringBuffer;
+    PrettyWriter <StringBuffer> writer (stringBuffer);
+
+    writer.StartObject();
+    writer.String ("bands");
+    writer.Uint (NUM_BANDS);
+    writer.String ("repeats");
+    writer.Uint (repeats);
+
+    writer.String ("results");
+    writer.StartArray();
+    for (const auto & i : results)
+    {
+        auto sorted = i.times;
+        sort (sorted.begin(), sorted.end());
+
+        writer.StartObject();
+        writer.String ("name");
+        writer.String (i.name.c_str());
+
+        writer.String ("params");
+        writer.StartObject();
+        for (const auto & j : i.params)
+        {
+            writer.String (j.first.c_str());
+            writer.String (j.second.c_str());
+        }
+        writer.EndObject();
+
+        writer.String ("min_ms");
+        writer.Double (sorted.front());
+        writer.String ("median_ms");
+        writer.Double (sorted [sorted.size() / 2]);
+        writer.String ("mean_ms");
+        writer.Double
+        (   accumulate (sorted.begin(), sorted.end(), 0.0) / sorted.size()
+        );
+        writer.String ("max_ms");
+        writer.Double (sorted.back());
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    os << stringBuffer.GetString() << endl;
+}
+
+int main (int argc, const char * argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "Command-line parameters are [output file (.json)] [repeats]" << endl;
+        exit (1);
+    }
+
+    const string output_filename = argc > 1 ? argv [1] : "";
+    const unsigned long repeats = argc > 2 ? stoul (argv [2]) : 5;
+
+    const string models = string (DEMO_ROOT) + "/assets/test_models/";
+    const string materials = string (DEMO_ROOT) + "/assets/materials/";
+
+    const vector <BenchScene> scenes
+    {   {"small_square", "small_square.obj", "mat.json", {{0, 1, 0}}, {{0, 1, 2}}}
+    ,   {"large_square", "large_square.obj", "mat.json", {{0, 2, 6}}, {{0, 2, -6}}}
+    ,   {"bedroom", "bedroom.obj", "mat.json", {{0, 0, 0}}, {{0, 0, 2}}}
+    ,   {"echo_tunnel", "echo_tunnel.obj", "mat.json", {{0, 1, 0}}, {{0, 1, 2}}}
+    ,   {"vault", "vault.obj", "vault.json", {{0, 1.75, 0}}, {{0, 1.75, 6}}}
+    ,   {"stonehenge", "stonehenge.obj", "mat.json", {{0, 2, 0}}, {{0, 2, 10}}}
+    };
+
+    const vector <unsigned long> rayCounts {1 << 13, 1 << 15, 1 << 17};
+    const vector <unsigned long> reflectionCounts {32, 128};
+
+    const auto sampleRate = 44100.0f;
+    const auto hipass = 45.0f;
+
+    vector <BenchResult> results;
+
+    //  Results from the largest vault trace are kept for the later stages.
+    RaytracerResults traced;
+
+    try
+    {
+        TemporarySceneCache cache;
+
+        for (const auto & scene : scenes)
+        {
+            const auto objpath = models + scene.model;
+            const auto materialFileName = materials + scene.material;
+
+            for (const auto reflections : reflectionCounts)
+            {
+                unique_ptr <Raytracer> raytracer;
+                const auto load = [&]
+                {
+                    raytracer = unique_ptr <Raytracer>
+                    (   new Raytracer
+                        (   reflections
+                        ,   objpath
+                        ,   materialFileName
+                        ,   false
+                        )
+                    );
+                };
+
+                const map <string, string> loadParams
+                {   {"model", scene.name}
+                ,   {"reflections", to_string (reflections)}
+                };
+
+                //  Cold loads import the model and write its cache, which
+                //  the cached loads then read.
+                results.push_back
+                (   measure
+                    (   "load_scene_cold"
+                    ,   loadParams
+                    ,   repeats
+                    ,   [&]
+                        {
+                            raytracer = nullptr;
+                            cache.clear (objpath, materialFileName);
+                        }
+                    ,   load
+                    )
+                );
+                results.push_back
+                (   measure
+                    (   "load_scene_cached"
+                    ,   loadParams
+                    ,   repeats
+                    ,   [&] {raytracer = nullptr;}
+                    ,   load
+                    )
+                );
+
+                for (const auto rays : rayCounts)
+                {
+                    const auto directions = getSeededDirections (rays);
+                    results.push_back
+                    (   measure
+                        (   "raytrace"
+                        ,   {   {"model", scene.name}
+                            ,   {"rays", to_string (rays)}
+                            ,   {"reflections", to_string (reflections)}
+                            }
+                        ,   repeats
+                        ,   [&]
+                            {
+                                raytracer->raytrace
+                                (   scene.mic
+                                ,   scene.source
+                                ,   directions
+                                ,   false
+                                );
+                            }
+                        )
+                    );
+
+                    if
+                    (   scene.name == "vault"
+                    &&  rays == rayCounts.back()
+                    &&  reflections == reflectionCounts.back()
+                    )
+                        traced = raytracer->getAllRaw (false);
+
+                    if (rays == rayCounts.back())
+                    {
+                        //  Scrub the mic back and forth by a centimetre,
+                        //  which reuses the cached paths exactly.
+                        raytracer->setPathCaching (true);
+                        raytracer->raytrace
+                        (   scene.mic
+                        ,   scene.source
+                        ,   directions
+                        ,   false
+                        );
+
+                        auto movedMic = scene.mic;
+                        auto step = 0u;
+                        results.push_back
+                        (   measure
+                            (   "retrace_moved_mic"
+                            ,   {   {"model", scene.name}
+                                ,   {"rays", to_string (rays)}
+                                ,   {"reflections", to_string (reflections)}
+                                }
+                            ,   repeats
+                            ,   [&]
+                                {
+                                    movedMic.s [0] =
+                                        scene.mic.s [0] + 0.01 * (++step % 2);
+                                    raytracer->raytrace
+                                    (   movedMic
+                                    ,   scene.source
+                                    ,   directions
+                                    ,   false
+                                    );
+                                }
+                            )
+                        );
+
+                        //  Scrub the source, revalidating only the first two
+                        //  bounces of each path, which is approximate.
+                        const auto revalidate = 2ul;
+                        raytracer->setPathCaching (true, revalidate);
+                        auto movedSource = scene.source;
+                        results.push_back
+                        (   measure
+                            (   "retrace_moved_source"
+                            ,   {   {"model", scene.name}
+                                ,   {"rays", to_string (rays)}
+                                ,   {"reflections", to_string (reflections)}
+                                ,   {"revalidate", to_string (revalidate)}
+                                }
+                            ,   repeats
+                            ,   [&]
+                                {
+                                    movedSource.s [0] =
+                                        scene.source.s [0] + 0.01 * (++step % 2);
+                                    raytracer->raytrace
+                                    (   scene.mic
+                                    ,   movedSource
+                                    ,   directions
+                                    ,   false
+                                    );
+                                }
+                            )
+                        );
+
+                        raytracer->setPathCaching (false);
+                    }
+                }
+
+                if (reflections == reflectionCounts.back())
+                {
+                    //  Exhaustive image sources alone, without any rays.
+                    const auto order = 3u;
+                    const auto maxTime = 0.1f;
+                    raytracer->setImageSourceOrder (order, maxTime);
+                    results.push_back
+                    (   measure
+                        (   "image_sources"
+                        ,   {   {"model", scene.name}
+                            ,   {"order", to_string (order)}
+                            ,   {"max_time", to_string (maxTime)}
+                            }
+                        ,   repeats
+                        ,   [&]
+                            {
+                                raytracer->raytrace
+                                (   scene.mic
+                                ,   scene.source
+                                ,   {}
+                                ,   false
+                                );
+                            }
+                        )
+                    );
+                    raytracer->setImageSourceOrder (0);
+                }
+            }
+        }
+
+        const map <string, string> tracedParams
+        {   {"model", "vault"}
+        ,   {"impulses", to_string (traced.impulses.size())}
+        };
+
+        const vector <Speaker> speakers
+        {   {{{-1, 0, -1}}, 0.5}
+        ,   {{{ 1, 0, -1}}, 0.5}
+        };
+
+        SpeakerAttenuator speakerAttenuator;
+        vector <vector <AttenuatedImpulse>> attenuated;
+        results.push_back
+        (   measure
+            (   "speaker_attenuator"
+            ,   tracedParams
+            ,   repeats
+            ,   [&]
+                {
+                    attenuated = speakerAttenuator.attenuate (traced, speakers);
+                }
+            )
+        );
+
+        HrtfAttenuator hrtfAttenuator;
+        results.push_back
+        (   measure
+            (   "hrtf_attenuator"
+            ,   tracedParams
+            ,   repeats
+            ,   [&]
+                {
+                    hrtfAttenuator.attenuate
+                    (   traced
+                    ,   (cl_float3) {{0, 0, 1}}
+                    ,   (cl_float3) {{0, 1, 0}}
+                    );
+                }
+            )
+        );
+
+        vector <vector <vector <float>>> flattened;
+        results.push_back
+        (   measure
+            (   "flatten_impulses"
+            ,   tracedParams
+            ,   repeats
+            ,   [&]
+                {
+                    flattened = flattenImpulses (attenuated, sampleRate);
+                }
+            )
+        );
+
+        vector <vector <float>> interleaved;
+        results.push_back
+        (   measure
+            (   "flatten_impulses_interleaved"
+            ,   tracedParams
+            ,   repeats
+            ,   [&]
+                {
+                    interleaved =
+                        flattenImpulsesInterleaved (attenuated, sampleRate);
+                }
+            )
+        );
+
+        const auto decimation =
+            RayverbFiltering::bandDecimation (sampleRate, hipass);
+        results.push_back
+        (   measure
+            (   "flatten_impulses_multirate"
+            ,   tracedParams
+            ,   repeats
+            ,   [&]
+                {
+                    flattenImpulsesMultirate
+                    (   attenuated
+                    ,   sampleRate
+                    ,   decimation
+                    );
+                }
+            )
+        );
+
+        vector <vector <float>> withTail;
+        results.push_back
+        (   measure
+            (   "late_tail"
+            ,   tracedParams
+            ,   repeats
+            ,   [&] {withTail = interleaved;}
+            ,   [&] {synthesizeLateTail (withTail, sampleRate, 0.08);}
+            )
+        );
+
+        const map <string, RayverbFiltering::FilterType> filterTypes
+        {   {"sinc", RayverbFiltering::FILTER_TYPE_WINDOWED_SINC}
+        ,   {"onepass", RayverbFiltering::FILTER_TYPE_BIQUAD_ONEPASS}
+        ,   {"twopass", RayverbFiltering::FILTER_TYPE_BIQUAD_TWOPASS}
+        ,   {"linkwitz_riley", RayverbFiltering::FILTER_TYPE_LINKWITZ_RILEY}
+        };
+
+        const auto samples = flattened.front().front().size();
+        vector <vector <vector <float>>> filterInput;
+        vector <vector <float>> processed;
+        for (const auto & i : filterTypes)
+        {
+            const map <string, string> params
+            {   {"filter", i.first}
+            ,   {"samples", to_string (samples)}
+            };
+
+            results.push_back
+            (   measure
+                (   "filter"
+                ,   params
+                ,   repeats
+                ,   [&] {filterInput = flattened;}
+                ,   [&]
+                    {
+                        RayverbFiltering::filter
+                        (   i.second
+                        ,   filterInput
+                        ,   sampleRate
+                        ,   hipass
+                        );
+                    }
+                )
+            );
+
+            results.push_back
+            (   measure
+                (   "filter_and_mix"
+                ,   params
+                ,   repeats
+                ,   [&] {filterInput = flattened;}
+                ,   [&]
+                    {
+                        processed = RayverbFiltering::filterAndMix
+                        (   i.second
+                        ,   filterInput
+                        ,   sampleRate
+                        ,   hipass
+                        );
+                    }
+                )
+            );
+        }
+
+        postprocess (processed, true, true, 1);
+
+        const string soundfile = "rayverb_bench_output.wav";
+        const map <unsigned long, int> depths
+        {   {16, SF_FORMAT_PCM_16}
+        ,   {24, SF_FORMAT_PCM_24}
+        ,   {32, SF_FORMAT_FLOAT}
+        };
+        for (const auto & i : depths)
+        {
+            results.push_back
+            (   measure
+                (   "write_sndfile"
+                ,   {   {"bit_depth", to_string (i.first)}
+                    ,   {"samples", to_string (processed.front().size())}
+                    }
+                ,   repeats
+                ,   [&]
+                    {
+                        write_sndfile
+                        (   soundfile
+                        ,   processed
+                        ,   sampleRate
+                        ,   i.second
+                        ,   SF_FORMAT_WAV
+                        );
+                    }
+                )
+            );
+        }
+        remove (soundfile.c_str());
+    }
+    catch (cl::Error error)
+    {
+        cerr << "encountered opencl error:" << endl;
+        cerr << error.what() << endl;
+        cerr << error.err() << endl;
+        exit (1);
+    }
+    catch (runtime_error error)
+    {
+        cerr << "encountered runtime error:" << endl;
+        cerr << error.what() << endl;
+        exit (1);
+    }
+
+    if (output_filename.empty())
+    {
+        writeJson (cout, results, repeats);
+    }
+    else
+    {
+        ofstream out (output_filename);
+        writeJson (out, results, repeats);
+        if (! out)
+        {
+            cerr << "failed to write " << output_filename << endl;
+            exit (1);
+        }
+    }
+
+    exit (0);
+}
@@ -1,6 +1,10 @@
 #include "rayverb.h"
 #include "helpers.h"
 #include "config.h"
+#include "profiler.h"
+#include "late_tail.h"
+#include "scene_cache.h"
+#include "sndfile_writer.h"
 
 #include "rapidjson/rapidjson.h"
 #include "rapidjson/error/en.h"
@@ -23,30 +27,6 @@
 using namespace std;
 using namespace rapidjson;
 
-void write_sndfile
-(   const string & fname
-,   const vector <vector <float>> & outdata
-,   float sr
-,   unsigned long bd
-,   unsigned long ftype
-)
-{
-    vector <float> interleaved (outdata.size() * outdata [0].size());
-
-    for (auto i = 0; i != outdata.size(); ++i)
-        for (auto j = 0; j != outdata [i].size(); ++j)
-            interleaved [j * outdata.size() + i] = outdata [i] [j];
-
-    SndfileHandle outfile
-    (   fname
-    ,   SFM_WRITE
-    ,   ftype | bd
-    ,   outdata.size()
-    ,   sr
-    );
-    outfile.write (interleaved.data(), interleaved.size());
-}
-
 void write_aiff
 (   const string & fname
 ,   const vector <vector <float>> & outdata
@@ -101,23 +81,128 @@ bool file_is_writable (const string & i)
     return ret;
 }
 
+/// Does the file start like an impulse spill file?
+bool file_is_spill (const string & i)
+{
+    char magic [sizeof (ImpulseSpillWriter::MAGIC)] = {};
+    ifstream is (i, ios::binary);
+    is.read (magic, sizeof (magic));
+    return is && equal (begin (magic), end (magic), ImpulseSpillWriter::MAGIC);
+}
+
+/// Build the attenuator described by an AttenuationModel once, so that it can
+/// be reused for every chunk of a spilled trace.
+AttenuationFunction makeAttenuation
+(   const AttenuationModel & model
+,   bool verbose
+)
+{
+    switch (model.mode)
+    {
+    case AttenuationModel::SPEAKER:
+    {
+        auto attenuator = make_shared <SpeakerAttenuator>();
+        return [attenuator, model] (const RaytracerResults & results)
+        {
+            return attenuator->attenuate (results, model.speakers);
+        };
+    }
+    case AttenuationModel::HRTF:
+    {
+        auto attenuator =
+            make_shared <HrtfAttenuator> (model.hrtf.file, verbose);
+        return [attenuator, model] (const RaytracerResults & results)
+        {
+            return attenuator->attenuate
+            (   results
+            ,   model.hrtf.facing
+            ,   model.hrtf.up
+            );
+        };
+    }
+    case AttenuationModel::AMBISONIC:
+    {
+        auto attenuator = make_shared <AmbisonicAttenuator>();
+        return [attenuator, model] (const RaytracerResults & results)
+        {
+            return attenuator->attenuate (results, model.ambisonic);
+        };
+    }
+    }
+    throw runtime_error ("unknown attenuation model");
+}
+
+/// Get the impulses selected by an OutputMode from a Raytracer or a
+/// RaytracerResultsFile.
+template <typename T>
+RaytracerResults collectResults
+(   T & source
+,   OutputMode output_mode
+,   bool remove_direct
+)
+{
+    switch (output_mode)
+    {
+    case ALL:
+        return source.getAllRaw (remove_direct);
+    case IMAGE_ONLY:
+        return source.getRawImages (remove_direct);
+    case DIFFUSE_ONLY:
+        return source.getRawDiffuse();
+    }
+    throw runtime_error ("unknown output mode");
+}
+
+/// Warn about bands which were too quiet to be given a late tail, and
+/// optionally print the reverb time of the others.
+void reportDecay (const vector <BandDecay> & decay, bool verbose)
+{
+    for (auto i = 0u; i != decay.size(); ++i)
+    {
+        if (decay [i].slope >= 0)
+            cerr << "WARNING: no late tail for band " << i << " - not enough energy before the transition time" << endl;
+        else if (verbose)
+            cerr << "band " << i << " RT60: " << decay [i].rt60() << " s" << endl;
+    }
+}
+
 int main(int argc, const char * argv[])
 {
     argc -= 1;
 
-    if (argc != 4)
+    if (argc != 4 && argc != 3)
     {
         cerr << "Command-line parameters are <config file (.json)> <model file> <material file (.json)> <output file (.aif)>" << endl;
+        cerr << "or, to render saved results again, <config file (.json)> <results or spill file> <output file (.aif)>" << endl;
         exit (1);
     }
 
+    //  With three parameters, a saved raytrace is rendered again instead of
+    //  tracing a model.
+    const auto rerender = argc == 3;
+
     string config_filename (argv [1]);
-    string model_filename (argv [2]);
-    string material_filename (argv [3]);
-    string output_filename (argv [4]);
+    string model_filename;
+    string material_filename;
+    string results_filename;
+    string output_filename (argv [argc]);
+
+    vector <string> input_filenames {config_filename};
+    if (rerender)
+    {
+        results_filename = argv [2];
+        input_filenames.push_back (results_filename);
+    }
+    else
+    {
+        model_filename = argv [2];
+        material_filename = argv [3];
+        input_filenames.push_back (model_filename);
+        input_filenames.push_back (material_filename);
+    }
 
     //  check input files exist
-    for (const auto & i : {config_filename, model_filename, material_filename})
+    for (const auto & i : input_filenames)
     {
         if (! file_is_readable (i))
         {
@@ -153,6 +238,17 @@ int main(int argc, const char * argv[])
     auto remove_direct = false;
     auto trim_tail = true;
     auto output_mode = ALL;
+    string fftw_wisdom;
+    string scene_cache;
+    auto multirate = false;
+    string profile_file;
+    string profile_trace_file;
+    string spill_file;
+    string save_results;
+    auto transition_time = 0.0;
+    string decay_analysis;
+    auto image_source_order = 0;
+    auto image_source_max_time = 0.0;
 
     auto show_diagnostics = false;
 
@@ -193,6 +289,17 @@ int main(int argc, const char * argv[])
     cv.addOptionalValidator ("remove_direct", remove_direct);
     cv.addOptionalValidator ("trim_tail", trim_tail);
     cv.addOptionalValidator ("output_mode", output_mode);
+    cv.addOptionalValidator ("fftw_wisdom", fftw_wisdom);
+    cv.addOptionalValidator ("scene_cache", scene_cache);
+    cv.addOptionalValidator ("multirate", multirate);
+    cv.addOptionalValidator ("profile", profile_file);
+    cv.addOptionalValidator ("profile_trace", profile_trace_file);
+    cv.addOptionalValidator ("spill_file", spill_file);
+    cv.addOptionalValidator ("save_results", save_results);
+    cv.addOptionalValidator ("transition_time", transition_time);
+    cv.addOptionalValidator ("decay_analysis", decay_analysis);
+    cv.addOptionalValidator ("image_source_order", image_source_order);
+    cv.addOptionalValidator ("image_source_max_time", image_source_max_time);
     cv.addOptionalValidator ("verbose", show_diagnostics);
 
     try
@@ -206,9 +313,42 @@ int main(int argc, const char * argv[])
         exit (1);
     }
 
+    //  An empty directory is meaningful (it disables the cache), so only
+    //  override the default if the key is present.
+    if (document.HasMember ("scene_cache"))
+        SceneCache::setDirectory (scene_cache);
+
+    if (rerender && ! (spill_file.empty() && save_results.empty()))
+    {
+        cerr << "WARNING: spill_file and save_results are ignored when rendering saved results" << endl;
+        spill_file.clear();
+        save_results.clear();
+    }
+
+    //  A spill file left by an earlier trace can be rendered again in place
+    //  of saved results, streaming its impulses just as the trace did.
+    const auto rerenderSpill = rerender && file_is_spill (results_filename);
+    if (rerenderSpill)
+    {
+        spill_file = results_filename;
+        if (output_mode != DIFFUSE_ONLY)
+            cerr << "WARNING: spill files only hold the diffuse impulses, so image sources are left out" << endl;
+    }
+
+    //  Spilled and saved impulses are attenuated and flattened a chunk at a
+    //  time straight from their files, rather than being read into memory.
+    const auto streamed = rerender || ! spill_file.empty();
+
+    if (multirate && streamed)
+    {
+        cerr << "WARNING: multirate is ignored when streaming impulses from disk" << endl;
+        multirate = false;
+    }
+
     map <unsigned long, unsigned long> depthTable
     {   {16, SF_FORMAT_PCM_16}
     ,   {24, SF_FORMAT_PCM_24}
+    ,   {32, SF_FORMAT_FLOAT}
     };
 
     auto depthIt = depthTable.find (bitDepth);
@@ -225,6 +365,7 @@ int main(int argc, const char * argv[])
     {   {"aif", SF_FORMAT_AIFF}
     ,   {"aiff", SF_FORMAT_AIFF}
     ,   {"wav", SF_FORMAT_WAV}
+    ,   {"caf", SF_FORMAT_CAF}
     };
 
     auto extension = output_filename.substr (output_filename.find_last_of (".") + 1);
@@ -238,62 +379,154 @@ int main(int argc, const char * argv[])
         exit (1);
     }
 
-    auto directions = getRandomDirections (numRays);
+    //  Must happen before any OpenCL queues are created.
+    Profiler::setEnabled
+    (   show_diagnostics
+    ||  ! profile_file.empty()
+    ||  ! profile_trace_file.empty()
+    );
+
     vector <vector <AttenuatedImpulse>> attenuated;
+
+    //  When streaming, impulses are attenuated and flattened a chunk at a
+    //  time, so only the flattened output is kept.
+    vector <vector <float>> streamedFlattened;
     try
     {
-        Raytracer raytracer
-        (   numImpulses
-        ,   model_filename
-        ,   material_filename
-        ,   show_diagnostics
-        );
+        unique_ptr <Raytracer> raytracer;
+        unique_ptr <RaytracerResultsFile> saved;
+        if (rerender && ! rerenderSpill)
+        {
+            ScopedStage stage ("load_results");
+            saved = unique_ptr <RaytracerResultsFile>
+                (new RaytracerResultsFile (results_filename));
+        }
+        else if (! rerender)
+        {
+            raytracer = unique_ptr <Raytracer>
+            (   new Raytracer
+                (   numImpulses
+                ,   model_filename
+                ,   material_filename
+                ,   show_diagnostics
+                )
+            );
 
-        raytracer.raytrace (mic, source, directions, show_diagnostics);
+            raytracer->setSpillFile (spill_file);
+            //  Higher orders can't be searched without a time limit, so they
+            //  get a default one.
+            const auto DEFAULT_IMAGE_SOURCE_MAX_TIME = 0.1;
+            const auto bounded =
+                image_source_order
+            >   int (Raytracer::MAX_UNBOUNDED_IMAGE_SOURCE_ORDER);
+            raytracer->setImageSourceOrder
+            (   image_source_order
+            ,   image_source_max_time > 0
+            ?   image_source_max_time
+            :   bounded
+            ?   DEFAULT_IMAGE_SOURCE_MAX_TIME
+            :   numeric_limits <float>::infinity()
+            );
 
-        RaytracerResults results;
-        switch (output_mode)
-        {
-        case ALL:
-            results = raytracer.getAllRaw (remove_direct);
-            break;
-        case IMAGE_ONLY:
-            results = raytracer.getRawImages (remove_direct);
-            break;
-        case DIFFUSE_ONLY:
-            results = raytracer.getRawDiffuse();
-            break;
-        default:
-            cerr << "This point should never be reached. Aborting" << endl;
-            exit (1);
+            //  Everything traced after the crossfade into a synthesized tail
+            //  is discarded, so rays needn't be traced any further.
+            //  With the predelay trimmed, the transition is measured from the
+            //  first contribution, which isn't known until after the trace.
+            if (transition_time > 0 && ! trim_predelay)
+            {
+                raytracer->setRayMaxTime
+                    (transition_time + LATE_TAIL_FADE_SECONDS);
+            }
+
+            {
+                ScopedStage stage ("raytrace");
+                const auto directions = getRandomDirections (numRays);
+                raytracer->raytrace (mic, source, directions, show_diagnostics);
+            }
+
+            if (! save_results.empty())
+            {
+                ScopedStage stage ("save_results");
+                raytracer->writeResults (save_results);
+            }
         }
 
+        const auto attenuate =
+            makeAttenuation (attenuationModel, show_diagnostics);
+
+        if (! streamed)
+        {
+            RaytracerResults results;
+            {
+                ScopedStage stage ("collect_results");
+                results =
+                    collectResults (*raytracer, output_mode, remove_direct);
+            }
+
 #ifdef DIAGNOSTIC
-        print_diagnostic
-        (   numRays
-        ,   numImpulses
-        ,   raytracer.getRawDiffuse().impulses
-        ,   "impulse.dump"
-        );
+            if (raytracer)
+            {
+                print_diagnostic
+                (   numRays
+                ,   numImpulses
+                ,   raytracer->getRawDiffuse().impulses
+                ,   "impulse.dump"
+                );
+            }
 #endif
-        switch (attenuationModel.mode)
+            ScopedStage attenuateStage ("attenuate");
+            attenuated = attenuate (results);
+        }
+        else
         {
-        case AttenuationModel::SPEAKER:
-            attenuated = SpeakerAttenuator().attenuate
-            (   results
-            ,   attenuationModel.speakers
-            );
-            break;
-        case AttenuationModel::HRTF:
-            attenuated = HrtfAttenuator().attenuate
-            (   results
-            ,   attenuationModel.hrtf.facing
-            ,   attenuationModel.hrtf.up
-            );
-            break;
-        default:
-            cerr << "This point should never be reached. Aborting" << endl;
-            exit (1);
+            ScopedStage stage ("attenuate_and_flatten");
+            float predelay = 0;
+            auto addImpulses = [&]
+            (   const Impulse * impulses
+            ,   size_t count
+            ,   const cl_float3 & mic
+            )
+            {
+                const auto found = attenuateAndFlattenInterleaved
+                (   impulses
+                ,   count
+                ,   mic
+                ,   attenuate
+                ,   sampleRate
+                ,   streamedFlattened
+                );
+                if (predelay == 0 || (found != 0 && found < predelay))
+                    predelay = found;
+            };
+
+            if (output_mode != DIFFUSE_ONLY && (raytracer || saved))
+            {
+                //  There are few image sources, so they're copied out.
+                const auto images = saved
+                ?   saved->getRawImages (remove_direct)
+                :   raytracer->getRawImages (remove_direct);
+                addImpulses
+                (   images.impulses.data()
+                ,   images.impulses.size()
+                ,   images.mic
+                );
+            }
+            if (output_mode != IMAGE_ONLY && saved)
+            {
+                addImpulses
+                (   saved->diffuseData()
+                ,   saved->diffuseSize()
+                ,   saved->mic()
+                );
+            }
+            else if (output_mode != IMAGE_ONLY)
+            {
+                const ImpulseSpill diffuse (spill_file);
+                addImpulses (diffuse.data(), diffuse.size(), diffuse.mic());
+            }
+
+            if (trim_predelay)
+                removePredelayInterleaved (streamedFlattened, predelay, sampleRate);
         }
     }
     catch (cl::Error error)
@@ -315,25 +548,146 @@ int main(int argc, const char * argv[])
         exit (1);
     }
 
-    if (attenuated.empty())
+    if (attenuated.empty() && streamedFlattened.empty())
     {
         cerr << "No raytrace results returned." << endl;
         exit (1);
     }
 
-    if (trim_predelay)
+    if (trim_predelay && ! streamed)
         fixPredelay (attenuated);
 
-    auto flattened = flattenImpulses (attenuated, sampleRate);
-    auto processed = process
-    (   filter
-    ,   flattened
-    ,   sampleRate
-    ,   normalize
-    ,   hipass
-    ,   trim_tail
-    ,   volumme_scale
-    );
-    write_sndfile (output_filename, processed, sampleRate, depthIt->second, ftypeIt->second);
+    if (! fftw_wisdom.empty())
+        RayverbFiltering::FastConvolution::setWisdomFile (fftw_wisdom);
+
+    //  Only analysed if a sidecar file is wanted.
+    vector <vector <DecayParameters>> decay;
+    const auto decayOutput = decay_analysis.empty() ? nullptr : &decay;
+
+    vector <vector <float>> processed;
+    if (streamed)
+    {
+        if (transition_time > 0)
+        {
+            ScopedStage stage ("late_tail");
+            reportDecay
+            (   synthesizeLateTail (streamedFlattened, sampleRate, transition_time)
+            ,   show_diagnostics
+            );
+        }
+        ScopedStage stage ("filter");
+        processed = processInterleaved
+        (   filter
+        ,   streamedFlattened
+        ,   sampleRate
+        ,   normalize
+        ,   hipass
+        ,   trim_tail
+        ,   volumme_scale
+        ,   decayOutput
+        );
+    }
+    else if (multirate)
+    {
+        const auto decimation =
+            RayverbFiltering::bandDecimation (sampleRate, hipass);
+        vector <vector <vector <float>>> flattened;
+        {
+            ScopedStage stage ("flatten");
+            flattened =
+                flattenImpulsesMultirate (attenuated, sampleRate, decimation);
+        }
+        if (transition_time > 0)
+        {
+            ScopedStage stage ("late_tail");
+            reportDecay
+            (   synthesizeLateTailMultirate
+                (   flattened
+                ,   sampleRate
+                ,   decimation
+                ,   transition_time
+                )
+            ,   show_diagnostics
+            );
+        }
+        ScopedStage stage ("filter");
+        processed = processMultirate
+        (   filter
+        ,   flattened
+        ,   decimation
+        ,   sampleRate
+        ,   normalize
+        ,   hipass
+        ,   trim_tail
+        ,   volumme_scale
+        ,   decayOutput
+        );
+    }
+    else
+    {
+        vector <vector <float>> flattened;
+        {
+            ScopedStage stage ("flatten");
+            flattened = flattenImpulsesInterleaved (attenuated, sampleRate);
+        }
+        if (transition_time > 0)
+        {
+            ScopedStage stage ("late_tail");
+            reportDecay
+            (   synthesizeLateTail (flattened, sampleRate, transition_time)
+            ,   show_diagnostics
+            );
+        }
+        ScopedStage stage ("filter");
+        processed = processInterleaved
+        (   filter
+        ,   flattened
+        ,   sampleRate
+        ,   normalize
+        ,   hipass
+        ,   trim_tail
+        ,   volumme_scale
+        ,   decayOutput
+        );
+    }
+
+    {
+        ScopedStage stage ("write");
+        write_sndfile (output_filename, processed, sampleRate, depthIt->second, ftypeIt->second);
+    }
+
+    if (! decay_analysis.empty())
+    {
+        try
+        {
+            writeDecayJson
+            (   decay_analysis
+            ,   decay
+            ,   RayverbFiltering::bandEdges (hipass)
+            );
+        }
+        catch (runtime_error error)
+        {
+            cerr << error.what() << endl;
+            exit (1);
+        }
+    }
+
+    if (show_diagnostics)
+        Profiler::printSummary (cerr);
+
+    try
+    {
+        if (! profile_file.empty())
+            Profiler::writeJson (profile_file);
+        if (! profile_trace_file.empty())
+            Profiler::writeChromeTrace (profile_trace_file);
+    }
+    catch (runtime_error error)
+    {
+        cerr << error.what() << endl;
+        exit (1);
+    }
+
     exit (0);
 }
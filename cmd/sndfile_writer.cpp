@@ -0,0 +1,69 @@
+#include "sndfile_writer.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+const unsigned long SndfileWriter::CHUNK_FRAMES;
+
+SndfileWriter::SndfileWriter
+(   const string & fname
+,   unsigned long channels
+,   float sr
+,   int format
+)
+:   file (fname, SFM_WRITE, format, channels, sr)
+,   channels (channels)
+{
+    if (file.error())
+        throw runtime_error ("failed to open " + fname + ": " + file.strError());
+}
+
+void SndfileWriter::write
+(   const vector <vector <float>> & data
+,   unsigned long begin
+,   unsigned long end
+)
+{
+    for (auto chunk = begin; chunk < end; chunk += CHUNK_FRAMES)
+    {
+        const auto frames = min (CHUNK_FRAMES, end - chunk);
+
+        interleaved.resize (frames * channels);
+        for (auto i = 0u; i != channels; ++i)
+        {
+            const auto & channel = data [i];
+            for (auto j = 0u; j != frames; ++j)
+            {
+                const auto index = chunk + j;
+                interleaved [j * channels + i] =
+                    index < channel.size() ? channel [index] : 0;
+            }
+        }
+
+        const sf_count_t count = frames;
+        if (file.writef (interleaved.data(), count) != count)
+            throw runtime_error ("failed to write sound file");
+    }
+}
+
+void SndfileWriter::write (const vector <vector <float>> & data)
+{
+    unsigned long frames = 0;
+    for (const auto & i : data)
+        frames = max <unsigned long> (frames, i.size());
+    write (data, 0, frames);
+}
+
+void write_sndfile
+(   const string & fname
+,   const vector <vector <float>> & outdata
+,   float sr
+,   unsigned long bd
+,   unsigned long ftype
+)
+{
+    SndfileWriter writer (fname, outdata.size(), sr, ftype | bd);
+    writer.write (outdata);
+}
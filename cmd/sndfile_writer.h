@@ -0,0 +1,53 @@
+#pragma once
+
+#include "sndfile.hh"
+
+#include <string>
+#include <vector>
+
+/// Writes multichannel audio to a sound file a chunk at a time.
+/// Each chunk is interleaved just before it is written, so there's never a
+/// full-size interleaved copy of the data in memory.
+class SndfileWriter
+{
+public:
+    /// The number of frames interleaved and written at once.
+    static const unsigned long CHUNK_FRAMES = 1 << 14;
+
+    SndfileWriter
+    (   const std::string & fname
+    ,   unsigned long channels
+    ,   float sr
+    ,   int format
+    );
+
+    SndfileWriter (const SndfileWriter &) = delete;
+    SndfileWriter & operator= (const SndfileWriter &) = delete;
+
+    /// Write frames [begin, end) of some per-channel data.
+    /// Frames must be written in order.
+    void write
+    (   const std::vector <std::vector <float>> & data
+    ,   unsigned long begin
+    ,   unsigned long end
+    );
+
+    /// Write all of some per-channel data.
+    void write (const std::vector <std::vector <float>> & data);
+
+private:
+    SndfileHandle file;
+    unsigned long channels;
+
+    /// Reused for every chunk.
+    std::vector <float> interleaved;
+};
+
+/// Write some per-channel data to a sound file in one go, a chunk at a time.
+void write_sndfile
+(   const std::string & fname
+,   const std::vector <std::vector <float>> & outdata
+,   float sr
+,   unsigned long bd
+,   unsigned long ftype
+);
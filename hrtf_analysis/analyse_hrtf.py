@@ -1,6 +1,7 @@
 import numpy as np
 import argparse
 import json
+import struct
 import matplotlib.pyplot as plt
 from scikits.audiolab import Sndfile
 
@@ -25,9 +26,7 @@ def decode_filename(fname):
 
     return radius, azimuth, elevation
 
-def write_file(header_string, data, outfile):
-    out = header_string
-
+def interpolate(data):
     l = []
     r = []
 
@@ -85,11 +84,28 @@ def write_file(header_string, data, outfile):
         l.append(l_for_angle)
         r.append(r_for_angle)
 
+    return [l, r]
+
+def write_binary_file(data, outfile):
+    """Write the interpolated table in the external HRTF file format."""
+    dat = interpolate(data)
+    header = struct.pack("<8s6I", b"RVHRTF\0\0", 1, 2, 360, 180, 8, 0)
+    edges = struct.pack("<9f", *FREQUENCY_BOUNDARIES)
+    values = [v for c in dat for a in c for e in a for v in e]
+
+    with open(outfile, "wb") as f:
+        f.write(header)
+        f.write(edges)
+        f.write(struct.pack("<%df" % len(values), *values))
+
+def write_file(header_string, data, outfile):
+    out = header_string
+
     def construct(d):
         out = ""
         if isinstance(d, list):
             if len(d) == 8:
-                out += "(VolumeType)"
+                out += "(cl_float8)"
             out += "{{"
             out += construct(d[0])
             for i in d[1:]:
@@ -100,7 +116,7 @@ def write_file(header_string, data, outfile):
             out += str(d)
         return out
 
-    dat = [l, r]
+    dat = interpolate(data)
 
     out += construct(dat)
     out += ";"
@@ -111,6 +127,7 @@ def write_file(header_string, data, outfile):
 def main():
     parser = argparse.ArgumentParser(description="Analyse HRTF kernels.")
     parser.add_argument("folderpath", type=str, help="folder full of HRTF kernels")
+    parser.add_argument("--binary", type=str, help="write an external HRTF file instead of hrtf.cpp")
     args = parser.parse_args()
 
     filenames = [f for f in listdir(args.folderpath) if isfile(join(args.folderpath, f))]
@@ -167,10 +184,14 @@ def main():
     # with open(args.outfile, 'w') as f:
     #     json.dump(out, f)
 
+    if args.binary:
+        write_binary_file(out, args.binary)
+        return
+
     header_string = """
     #include "rayverb.h"
     //  [channel][azimuth][elevation]
-    const std::array <std::array <std::array <VolumeType, 180>, 360>, 2> HrtfAttenuator::HRTF_DATA =
+    const HrtfTable HrtfAttenuator::HRTF_DATA =
     """
     write_file(header_string, out, join("rayverb", "hrtf.cpp"))
 
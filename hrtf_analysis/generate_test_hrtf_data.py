@@ -10,7 +10,7 @@ def main():
     header_string = """
     #include "hrtf_tests.h"
     //  [channel][azimuth][elevation]
-    const std::array <std::array <std::array <VolumeType, 180>, 360>, 2> TestsNamespace::HrtfTest::HRTF_DATA =
+    const HrtfTable TestsNamespace::HrtfTest::HRTF_DATA =
     """
     write_file(header_string, out, join("tests", "hrtf.cpp"))
 
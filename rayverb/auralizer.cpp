@@ -0,0 +1,307 @@
+#include "auralizer.h"
+
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+/// A fixed set of threads which run jobs in parallel, to avoid starting
+/// threads for every block.
+/// The thread calling run takes part, so a single worker runs everything on
+/// the calling thread.
+class Auralizer::Workers
+{
+public:
+    Workers (unsigned long count)
+    :   batch {nullptr, nullptr, 0, {0}, {0}}
+    ,   generation (0)
+    ,   active (0)
+    ,   stopping (false)
+    {
+        for (auto i = 1u; i < count; ++i)
+            threads.push_back (thread ([this] {loop();}));
+    }
+
+    virtual ~Workers()
+    {
+        {
+            lock_guard <mutex> lock (m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto && i : threads)
+            i.join();
+    }
+
+    /// Call f for each index in [0, count), and wait for all of the calls to
+    /// finish.
+    /// f is called through a plain function pointer, so a run doesn't
+    /// allocate.
+    template <typename F>
+    void run (unsigned long count, F & f)
+    {
+        run
+        (   count
+        ,   [] (void * context, unsigned long i)
+            {
+                (*static_cast <F *> (context)) (i);
+            }
+        ,   &f
+        );
+    }
+
+private:
+    /// The jobs of a single call to run.
+    /// There's only ever one, which is reset for each run.
+    struct Batch
+    {
+        void (*f) (void *, unsigned long);
+        void * context;
+        unsigned long count;
+        atomic <unsigned long> next;
+        atomic <unsigned long> remaining;
+    };
+
+    void run
+    (   unsigned long count
+    ,   void (*f) (void *, unsigned long)
+    ,   void * context
+    )
+    {
+        {
+            //  A worker that woke late for the last run may still be
+            //  claiming (nonexistent) jobs, so wait for it to leave before
+            //  resetting the batch.
+            unique_lock <mutex> lock (m);
+            done.wait (lock, [this] {return active == 0;});
+
+            batch.f = f;
+            batch.context = context;
+            batch.count = count;
+            batch.next = 0;
+            batch.remaining = count;
+            ++generation;
+        }
+        wake.notify_all();
+
+        work();
+
+        unique_lock <mutex> lock (m);
+        done.wait (lock, [this] {return batch.remaining == 0 && active == 0;});
+    }
+
+    void work()
+    {
+        for (auto i = batch.next++; i < batch.count; i = batch.next++)
+        {
+            batch.f (batch.context, i);
+            if (--batch.remaining == 0)
+            {
+                lock_guard <mutex> lock (m);
+                done.notify_all();
+            }
+        }
+    }
+
+    void loop()
+    {
+        unsigned long seen = 0;
+        unique_lock <mutex> lock (m);
+        for (;;)
+        {
+            wake.wait (lock, [&] {return stopping || generation != seen;});
+            if (stopping)
+                return;
+            seen = generation;
+
+            //  Joining under the lock means the batch can't be reset while
+            //  this worker is using it.
+            ++active;
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--active == 0)
+                done.notify_all();
+        }
+    }
+
+    mutex m;
+    condition_variable wake;
+    condition_variable done;
+    Batch batch;
+    unsigned long generation;
+    unsigned long active;
+    bool stopping;
+
+    vector <thread> threads;
+};
+
+Auralizer::Auralizer
+(   unsigned long channels
+,   unsigned long blockSize
+,   unsigned long crossfadeLength
+,   unsigned long threads
+)
+:   CHANNELS (channels)
+,   BLOCK_SIZE (blockSize)
+,   CROSSFADE_LENGTH (crossfadeLength)
+,   fadePosition (crossfadeLength)
+,   ringOut (0)
+,   newInput (blockSize, 0)
+,   oldInput (blockSize, 0)
+,   blockInput (nullptr)
+,   blockOutputs (nullptr)
+,   oldOutput (channels, vector <float> (blockSize, 0))
+,   workers
+    (   new Workers
+        (   threads
+        ?   threads
+        :   min <unsigned long>
+            (   channels
+            ,   max (1u, thread::hardware_concurrency())
+            )
+        )
+    )
+{
+}
+
+Auralizer::~Auralizer()
+{
+}
+
+void Auralizer::setImpulseResponses (const vector <vector <float>> & irs)
+{
+    if (irs.size() != CHANNELS)
+        throw runtime_error ("auralizer needs one impulse response per channel");
+
+    //  Transforming the responses is the expensive part, so it happens
+    //  before taking the lock.
+    unique_ptr <Convolvers> convolvers (new Convolvers);
+    for (const auto & i : irs)
+    {
+        convolvers->push_back
+        (   unique_ptr <RayverbFiltering::PartitionedConvolution>
+            (   new RayverbFiltering::PartitionedConvolution (i, BLOCK_SIZE)
+            )
+        );
+    }
+
+    //  Responses that are no longer needed are freed here, after the lock
+    //  is released, rather than on the audio thread.
+    unique_ptr <Convolvers> replaced;
+    unique_ptr <Convolvers> finished;
+    {
+        lock_guard <mutex> lock (pendingMutex);
+        replaced = move (pending);
+        finished = move (retired);
+        pending = move (convolvers);
+    }
+}
+
+void Auralizer::process (const float * input, const vector <float *> & outputs)
+{
+    if (outputs.size() != CHANNELS)
+        throw runtime_error ("auralizer needs one output per channel");
+
+    //  Responses are only swapped once the last ones have rung out, and
+    //  swapping is skipped for this block if responses are being set right
+    //  now.
+    {
+        unique_lock <mutex> lock (pendingMutex, try_to_lock);
+        if (lock.owns_lock())
+        {
+            //  Hand responses that have rung out back to be freed, unless
+            //  the last ones haven't been collected yet.
+            if (previous && ! isRingingOut() && ! retired)
+                retired = move (previous);
+
+            if (! previous && pending)
+            {
+                //  There's nothing to fade from the first time.
+                if (current)
+                {
+                    fadePosition = 0;
+                    ringOut = 0;
+                    for (const auto & i : *current)
+                        ringOut = max (ringOut, i->getLength());
+                }
+                previous = move (current);
+                current = move (pending);
+            }
+        }
+    }
+
+    //  The input is faded from the old responses to the new ones with a
+    //  raised cosine, whose gains always sum to one.
+    //  After the fade, the old responses are fed silence until their tails
+    //  have decayed.
+    blockInput = input;
+    blockOutputs = &outputs;
+    if (isCrossfading())
+    {
+        for (auto i = 0u; i != BLOCK_SIZE; ++i)
+        {
+            const auto position = fadePosition + i;
+            const float gain =
+                position < CROSSFADE_LENGTH
+            ?   0.5 - 0.5 * cos (M_PI * position / CROSSFADE_LENGTH)
+            :   1;
+            newInput [i] = gain * input [i];
+            oldInput [i] = (1 - gain) * input [i];
+        }
+        blockInput = newInput.data();
+    }
+    else if (previous)
+    {
+        fill (oldInput.begin(), oldInput.end(), 0);
+    }
+
+    auto job = [this] (unsigned long channel) {processChannel (channel);};
+    workers->run (CHANNELS, job);
+
+    if (isCrossfading())
+    {
+        const auto end = fadePosition + BLOCK_SIZE;
+        fadePosition = min (CROSSFADE_LENGTH, end);
+
+        //  Any part of the block after the fade was silent for the old
+        //  responses.
+        const auto silent = end - fadePosition;
+        ringOut -= min (ringOut, silent);
+    }
+    else if (previous)
+    {
+        ringOut -= min (ringOut, BLOCK_SIZE);
+    }
+}
+
+void Auralizer::processChannel (unsigned long channel)
+{
+    const auto out = (*blockOutputs) [channel];
+    if (current)
+        (*current) [channel]->process (blockInput, out);
+    else
+        fill (out, out + BLOCK_SIZE, 0);
+
+    if (! previous)
+        return;
+
+    const auto old = oldOutput [channel].data();
+    (*previous) [channel]->process (oldInput.data(), old);
+    for (auto i = 0u; i != BLOCK_SIZE; ++i)
+        out [i] += old [i];
+}
+
+bool Auralizer::isCrossfading() const
+{
+    return fadePosition < CROSSFADE_LENGTH;
+}
+
+bool Auralizer::isRingingOut() const
+{
+    return previous && (isCrossfading() || ringOut != 0);
+}
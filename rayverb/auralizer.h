@@ -0,0 +1,97 @@
+#pragma once
+
+#include "partitioned_convolution.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+
+/// Streams a dry mono signal through a set of rendered impulse responses, one
+/// per output channel, so that a room can be auditioned live.
+///
+/// Each output channel is convolved on its own thread, with a
+/// PartitionedConvolution.
+/// New impulse responses (from a trace that has just finished, say) can be
+/// set from any thread.
+/// They are prepared on the calling thread, and picked up at the start of a
+/// following block.
+/// The input is then crossfaded from the old responses to the new ones, so
+/// the old responses keep ringing with everything played before the change.
+/// They keep running until their tails have decayed, after which they are
+/// handed back to be freed by the next call to setImpulseResponses, so
+/// process never frees memory.
+/// New responses wait to be picked up until the last ones have rung out.
+class Auralizer
+{
+public:
+    /// threads is the number of threads to convolve with, including the one
+    /// calling process, or zero for one per channel (up to the number of
+    /// hardware threads).
+    Auralizer
+    (   unsigned long channels
+    ,   unsigned long blockSize
+    ,   unsigned long crossfadeLength
+    ,   unsigned long threads = 0
+    );
+    virtual ~Auralizer();
+
+    Auralizer (const Auralizer &) = delete;
+    Auralizer & operator= (const Auralizer &) = delete;
+
+    /// Replace the impulse responses, one per channel.
+    /// Until the first impulse responses are set, the output is silent, and
+    /// the first responses are used straight away, without a fade.
+    /// If responses are set again before the last ones were picked up, only
+    /// the newest are used.
+    /// Also frees any responses that process has finished with.
+    void setImpulseResponses (const std::vector <std::vector <float>> & irs);
+
+    /// Convolve one block of mono input, writing a block to each output.
+    /// Never waits for setImpulseResponses, and doesn't allocate or free
+    /// memory.
+    void process (const float * input, const std::vector <float *> & outputs);
+
+    /// Whether a change of impulse responses is still being faded in.
+    bool isCrossfading() const;
+
+    /// Whether the responses replaced by the last change are still ringing.
+    bool isRingingOut() const;
+
+    unsigned long getChannels() const {return CHANNELS;}
+    unsigned long getBlockSize() const {return BLOCK_SIZE;}
+
+private:
+    typedef std::vector <std::unique_ptr <RayverbFiltering::PartitionedConvolution>>
+        Convolvers;
+
+    class Workers;
+
+    const unsigned long CHANNELS;
+    const unsigned long BLOCK_SIZE;
+    const unsigned long CROSSFADE_LENGTH;
+
+    /// Convolve one channel of the current block.
+    void processChannel (unsigned long channel);
+
+    /// Guards pending and retired.
+    std::mutex pendingMutex;
+    std::unique_ptr <Convolvers> pending;
+    std::unique_ptr <Convolvers> retired;
+
+    std::unique_ptr <Convolvers> current;
+    std::unique_ptr <Convolvers> previous;
+    unsigned long fadePosition;
+
+    /// Samples of silence that previous still needs, once the fade is over,
+    /// for its tail to decay.
+    unsigned long ringOut;
+
+    /// The current block's input, split between the new and old responses.
+    std::vector <float> newInput;
+    std::vector <float> oldInput;
+    const float * blockInput;
+    const std::vector <float *> * blockOutputs;
+
+    std::vector <std::vector <float>> oldOutput;
+    std::unique_ptr <Workers> workers;
+};
@@ -1,16 +1,60 @@
+#pragma once
+
 #define __CL_ENABLE_EXCEPTIONS
 #include "cl.hpp"
 
 #define NUM_IMAGE_SOURCE 10
+#define MAX_IMAGE_SOURCE_ORDER 16
+#define MAX_AMBISONIC_ORDER 7
 #define SPEED_OF_SOUND (340.0f)
 
+/// The number of parallel frequency bands.
+/// 4 bands is good for quick previews, 8 gives octave bands, and 16 gives
+/// half-octave bands.
+/// Set at build time with the RAYVERB_BANDS cmake option.
+#ifndef NUM_BANDS
+#define NUM_BANDS 8
+#endif
+
 //  These definitions MUST be kept up-to-date with the defs in the cl file.
 //  It might make sense to nest them inside the Scene because I don't think
 //  other classes will need the same data formats.
 
 /// Type used for storing multiband volumes.
 /// Higher values of 'x' in cl_floatx = higher numbers of parallel bands.
+#if NUM_BANDS == 4
+typedef cl_float4 VolumeType;
+#elif NUM_BANDS == 8
 typedef cl_float8 VolumeType;
+#elif NUM_BANDS == 16
+typedef cl_float16 VolumeType;
+#else
+#error "NUM_BANDS must be 4, 8, or 16"
+#endif
+
+/// Built-in data such as materials and HRTFs is stored in octave bands.
+/// This converts it to the band layout of a VolumeType, averaging octaves
+/// together when there are fewer bands and sharing them between bands when
+/// there are more.
+inline VolumeType fromOctaveBands (const cl_float8 & octaves)
+{
+    VolumeType ret;
+    for (auto i = 0; i != NUM_BANDS; ++i)
+    {
+        if (NUM_BANDS < 8)
+        {
+            const auto PER_BAND = 8 / NUM_BANDS;
+            ret.s [i] = 0;
+            for (auto j = 0; j != PER_BAND; ++j)
+                ret.s [i] += octaves.s [i * PER_BAND + j] / PER_BAND;
+        }
+        else
+        {
+            ret.s [i] = octaves.s [i * 8 / NUM_BANDS];
+        }
+    }
+    return ret;
+}
 
 /// A Triangle contains an offset into an array of Surface, and three offsets
 /// into an array of cl_float3.
@@ -48,6 +92,20 @@ typedef struct  {
 
 typedef _AttenuatedImpulse_unalign __attribute__ ((aligned(8))) AttenuatedImpulse;
 
+/// Counts of the work done by the raytrace kernel.
+/// Only filled in by builds with RAY_STATISTICS defined.
+typedef struct  {
+    cl_ulong triangle_tests;
+    cl_ulong bounce_rays;
+    cl_ulong shadow_rays;
+    cl_ulong image_source_casts;
+    cl_ulong escaped;
+    cl_ulong bounces;
+    cl_ulong reused_bounces;
+} _RayStatistics_unalign;
+
+typedef _RayStatistics_unalign __attribute__ ((aligned(8))) RayStatistics;
+
 /// Each speaker has a (normalized-unit) direction, and a coefficient in the
 /// range 0-1 which describes its polar pattern from omni to bidirectional.
 typedef struct  {
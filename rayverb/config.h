@@ -24,19 +24,32 @@ enum OutputMode
 
 /// Describes the attenuation model that should be used to attenuate a raytrace.
 /// There's probably a more elegant (runtime-polymorphic) way of doing this that
-/// doesn't require both the HrtfConfig and the vector <Speaker> to be present
-/// in the object at the same time.
+/// doesn't require the HrtfConfig, AmbisonicConfig, and vector <Speaker> to be
+/// present in the object at the same time.
 struct AttenuationModel
 {
     enum Mode
     {   SPEAKER
     ,   HRTF
+    ,   AMBISONIC
     };
     Mode mode;
     HrtfConfig hrtf;
+    AmbisonicConfig ambisonic;
     std::vector <Speaker> speakers;
 };
 
+/// Scale a direction vector to unit length.
+inline void normalizeDirection (cl_float3 & v)
+{
+    cl_float len =
+        1.0 / sqrt (v.s [0] * v.s [0] + v.s [1] * v.s [1] + v.s [2] * v.s [2]);
+    for (auto i = 0u; i != sizeof (cl_float3) / sizeof (float); ++i)
+    {
+        v.s [i] *= len;
+    }
+}
+
 /// A simple interface for a JsonValidator.
 struct JsonValidatorBase
 {
@@ -210,6 +223,25 @@ struct JsonGetter<int>
     int & t;
 };
 
+template<>
+struct JsonGetter<std::string>
+{
+    JsonGetter (std::string & t): t (t) {}
+
+    /// Returns true if value is a string, false otherwise.
+    virtual bool check (const rapidjson::Value & value) const
+    {
+        return value.IsString();
+    }
+
+    /// Gets json value as a string.
+    virtual void get (const rapidjson::Value & value) const
+    {
+        t = value.GetString();
+    }
+    std::string & t;
+};
+
 /// General class for getting numerical json arrays into cl_floatx types
 template <typename T, int LENGTH>
 struct JsonArrayGetter
@@ -270,14 +302,21 @@ struct JsonGetter<Surface>
     }
 
     /// Attempts to run a ConfigValidator on value
+    /// Material coefficients are given in octave bands, and converted to the
+    /// band layout of a VolumeType.
     virtual void get (const rapidjson::Value & value) const
     {
         ConfigValidator cv;
 
-        cv.addRequiredValidator ("specular", t.specular);
-        cv.addRequiredValidator ("diffuse", t.diffuse);
+        cl_float8 specular;
+        cl_float8 diffuse;
+        cv.addRequiredValidator ("specular", specular);
+        cv.addRequiredValidator ("diffuse", diffuse);
 
         cv.run (value);
+
+        t.specular = fromOctaveBands (specular);
+        t.diffuse = fromOctaveBands (diffuse);
     }
     Surface & t;
 };
@@ -389,23 +428,45 @@ struct JsonGetter<HrtfConfig>
 
         cv.addRequiredValidator ("facing", t.facing);
         cv.addRequiredValidator ("up", t.up);
+        cv.addOptionalValidator ("file", t.file);
 
         cv.run (value);
 
-        normalize (t.facing);
-        normalize (t.up);
+        normalizeDirection (t.facing);
+        normalizeDirection (t.up);
     }
     HrtfConfig & t;
-private:
-    static void normalize (cl_float3 & v)
+};
+
+template<>
+struct JsonGetter<AmbisonicConfig>
+{
+    JsonGetter (AmbisonicConfig & t): t (t){}
+
+    /// Returns true if value is a json object.
+    virtual bool check (const rapidjson::Value & value) const
     {
-        cl_float len =
-            1.0 / sqrt (v.s [0] * v.s [0] + v.s [1] * v.s [1] + v.s [2] * v.s [2]);
-        for (auto i = 0; i != sizeof (cl_float3) / sizeof (float); ++i)
-        {
-            v.s [i] *= len;
-        }
+        return value.IsObject();
     }
+
+    /// Attempts to run a ConfigValidator on value.
+    /// The order defaults to 1 (B-format) if it isn't specified.
+    virtual void get (const rapidjson::Value & value) const
+    {
+        ConfigValidator cv;
+
+        t.order = 1;
+
+        cv.addRequiredValidator ("facing", t.facing);
+        cv.addRequiredValidator ("up", t.up);
+        cv.addOptionalValidator ("order", t.order);
+
+        cv.run (value);
+
+        normalizeDirection (t.facing);
+        normalizeDirection (t.up);
+    }
+    AmbisonicConfig & t;
 };
 
 template <typename T>
@@ -437,6 +498,7 @@ struct JsonGetter<AttenuationModel>
     ,   keys
         (   {   {AttenuationModel::SPEAKER, "speakers"}
             ,   {AttenuationModel::HRTF, "hrtf"}
+            ,   {AttenuationModel::AMBISONIC, "ambisonic"}
             }
         )
     {}
@@ -469,6 +531,9 @@ struct JsonGetter<AttenuationModel>
         if (value.HasMember (keys.at (AttenuationModel::HRTF).c_str()))
             cv.addRequiredValidator (keys.at (AttenuationModel::HRTF).c_str(), t.hrtf);
 
+        if (value.HasMember (keys.at (AttenuationModel::AMBISONIC).c_str()))
+            cv.addRequiredValidator (keys.at (AttenuationModel::AMBISONIC).c_str(), t.ambisonic);
+
         cv.run (value);
     }
     AttenuationModel & t;
@@ -0,0 +1,187 @@
+#include "decay_analysis.h"
+
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+using namespace rapidjson;
+
+constexpr float DecayParameters::EDC_INTERVAL;
+
+/// Fit a line to the part of an energy decay curve (in dB) between two
+/// levels, and return the time it would take to decay by 60dB.
+/// Returns NaN if the curve never falls below the lower level.
+static float decayTime
+(   const vector <float> & edc
+,   float samplerate
+,   float upper
+,   float lower
+)
+{
+    const auto begin = find_if
+    (   edc.begin()
+    ,   edc.end()
+    ,   [upper] (auto i) {return i <= upper;}
+    );
+    const auto end = find_if
+    (   begin
+    ,   edc.end()
+    ,   [lower] (auto i) {return i < lower;}
+    );
+    if (end == edc.end())
+        return numeric_limits <float>::quiet_NaN();
+
+    double n = 0, sumT = 0, sumD = 0, sumTT = 0, sumTD = 0;
+    for (auto i = begin; i != end; ++i)
+    {
+        const double t = (i - edc.begin()) / samplerate;
+        n += 1;
+        sumT += t;
+        sumD += *i;
+        sumTT += t * t;
+        sumTD += t * *i;
+    }
+
+    const auto denominator = n * sumTT - sumT * sumT;
+    if (n < 2 || denominator <= 0)
+        return numeric_limits <float>::quiet_NaN();
+
+    const auto slope = (n * sumTD - sumT * sumD) / denominator;
+    return slope < 0 ? -60 / slope : numeric_limits <float>::quiet_NaN();
+}
+
+DecayParameters analyseDecay
+(   const float * data
+,   unsigned long length
+,   unsigned long stride
+,   float samplerate
+)
+{
+    const auto NaN = numeric_limits <float>::quiet_NaN();
+    DecayParameters ret {0, NaN, NaN, NaN, NaN, {}};
+
+    vector <double> energy (length);
+    for (auto i = 0u; i != length; ++i)
+        energy [i] = data [i * stride] * data [i * stride];
+
+    const auto peak = max_element (energy.begin(), energy.end());
+    if (peak == energy.end() || *peak == 0)
+        return ret;
+
+    const unsigned long onset = find_if
+    (   energy.begin()
+    ,   energy.end()
+    ,   [&peak] (auto i) {return i >= *peak * 0.01;}
+    ) - energy.begin();
+    ret.onset = onset / samplerate;
+
+    //  Schroeder backward integration, from the end to the onset.
+    vector <double> integrated (length - onset);
+    double sum = 0;
+    for (auto i = length; i != onset; --i)
+    {
+        sum += energy [i - 1];
+        integrated [i - 1 - onset] = sum;
+    }
+
+    vector <float> edc (integrated.size());
+    for (auto i = 0u; i != edc.size(); ++i)
+        edc [i] = 10 * log10 (integrated [i] / sum);
+
+    ret.edt = decayTime (edc, samplerate, 0, -10);
+    ret.t20 = decayTime (edc, samplerate, -5, -25);
+    ret.t30 = decayTime (edc, samplerate, -5, -35);
+
+    const unsigned long EARLY = round (0.08 * samplerate);
+    if (EARLY < integrated.size() && integrated [EARLY] > 0)
+    {
+        const auto late = integrated [EARLY];
+        ret.c80 = 10 * log10 ((sum - late) / late);
+    }
+
+    const auto INTERVAL = DecayParameters::EDC_INTERVAL * samplerate;
+    for (auto i = 0ul; i * INTERVAL < edc.size(); ++i)
+        ret.edc.push_back (edc [i * INTERVAL]);
+
+    return ret;
+}
+
+/// Write a number, or null if it isn't finite, which JSON can't represent.
+template <typename T>
+static void writeNumber (T & writer, float value)
+{
+    if (isfinite (value))
+        writer.Double (value);
+    else
+        writer.Null();
+}
+
+void writeDecayJson
+(   const string & fname
+,   const vector <vector <DecayParameters>> & decay
+,   const vector <float> & edges
+)
+{
+    StringBuffer stringBuffer;
+    PrettyWriter <StringBuffer> writer (stringBuffer);
+
+    writer.StartObject();
+
+    writer.String ("edc_interval");
+    writer.Double (DecayParameters::EDC_INTERVAL);
+
+    writer.String ("bands");
+    writer.StartArray();
+    for (auto i = 0u; i + 1 < edges.size(); ++i)
+    {
+        writer.StartObject();
+        writer.String ("low");
+        writer.Double (edges [i]);
+        writer.String ("high");
+        writer.Double (edges [i + 1]);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.String ("channels");
+    writer.StartArray();
+    for (const auto & channel : decay)
+    {
+        writer.StartArray();
+        for (const auto & band : channel)
+        {
+            writer.StartObject();
+            writer.String ("onset");
+            writer.Double (band.onset);
+            writer.String ("edt");
+            writeNumber (writer, band.edt);
+            writer.String ("t20");
+            writeNumber (writer, band.t20);
+            writer.String ("t30");
+            writeNumber (writer, band.t30);
+            writer.String ("c80");
+            writeNumber (writer, band.c80);
+            writer.String ("edc");
+            writer.StartArray();
+            for (auto i : band.edc)
+                writeNumber (writer, i);
+            writer.EndArray();
+            writer.EndObject();
+        }
+        writer.EndArray();
+    }
+    writer.EndArray();
+
+    writer.EndObject();
+
+    ofstream out (fname);
+    out << stringBuffer.GetString() << endl;
+    if (! out)
+        throw runtime_error ("failed to write decay analysis " + fname);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+/// Room-acoustic parameters of one band of one channel of an impulse
+/// response, found from its Schroeder energy decay curve.
+/// Decay times and clarity which can't be measured, because the decay
+/// doesn't reach the end of the fitted range or the band is silent, are NaN.
+struct DecayParameters
+{
+    /// The spacing of the points of edc, in seconds.
+    static constexpr float EDC_INTERVAL = 0.01;
+
+    /// The time of the onset (the first sample within 20dB of the loudest),
+    /// in seconds.
+    /// Everything else is measured from the onset.
+    float onset;
+
+    /// Early decay time, fitted from 0 to -10dB, in seconds.
+    float edt;
+
+    /// Reverb time, fitted from -5 to -25dB, in seconds.
+    float t20;
+
+    /// Reverb time, fitted from -5 to -35dB, in seconds.
+    float t30;
+
+    /// Clarity, the ratio of energy in the first 80ms to energy after it, in
+    /// dB.
+    float c80;
+
+    /// The energy decay curve, in dB relative to the total energy.
+    std::vector <float> edc;
+};
+
+/// Find the decay parameters of one band, which has length samples, stride
+/// floats apart.
+DecayParameters analyseDecay
+(   const float * data
+,   unsigned long length
+,   unsigned long stride
+,   float samplerate
+);
+
+/// Write the decay parameters of every band of every channel ([channel][band])
+/// as JSON, along with the band edges.
+void writeDecayJson
+(   const std::string & fname
+,   const std::vector <std::vector <DecayParameters>> & decay
+,   const std::vector <float> & edges
+);
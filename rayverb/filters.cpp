@@ -3,6 +3,10 @@
 
 #include <numeric>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
 
 using namespace std;
 
@@ -96,14 +100,14 @@ void RayverbFiltering::Bandpass::setParams (float l, float h, float s)
 RayverbFiltering::HipassWindowedSinc::HipassWindowedSinc
 (   unsigned long inputLength
 )
-:   FastConvolution (KERNEL_LENGTH + inputLength - 1)
+:   convolution (KERNEL_LENGTH, inputLength)
 {
 
 }
 
 void RayverbFiltering::HipassWindowedSinc::filter (vector <float> & data)
 {
-    data = convolve (kernel, data);
+    convolution.convolve (data);
 }
 
 void RayverbFiltering::HipassWindowedSinc::setParams
@@ -111,14 +115,14 @@ void RayverbFiltering::HipassWindowedSinc::setParams
 ,   float s
 )
 {
-    auto i = hipassKernel (s, co, KERNEL_LENGTH);
-    copy (i.begin(), i.end(), kernel.begin());
+    Hipass::setParams (co, s);
+    convolution.setKernel (hipassKernel (s, co, KERNEL_LENGTH));
 }
 
 RayverbFiltering::BandpassWindowedSinc::BandpassWindowedSinc
 (   unsigned long inputLength
 )
-:   FastConvolution (KERNEL_LENGTH + inputLength - 1)
+:   convolution (KERNEL_LENGTH, inputLength)
 {
 
 }
@@ -132,15 +136,19 @@ vector <float> RayverbFiltering::BandpassWindowedSinc::bandpassKernel
     auto lop = lopassKernel (sr, hi, 1 + KERNEL_LENGTH / 2);
     auto hip = hipassKernel (sr, lo, 1 + KERNEL_LENGTH / 2);
 
-    FastConvolution fc (KERNEL_LENGTH);
-    return fc.convolve (lop, hip);
+    //  The kernels are tiny, so convolve them directly.
+    vector <float> ret (lop.size() + hip.size() - 1, 0);
+    for (auto i = 0u; i != lop.size(); ++i)
+        for (auto j = 0u; j != hip.size(); ++j)
+            ret [i + j] += lop [i] * hip [j];
+    return ret;
 }
 
 void RayverbFiltering::BandpassWindowedSinc::filter
 (   vector <float> & data
 )
 {
-    data = convolve (kernel, data);
+    convolution.convolve (data);
 }
 
 void RayverbFiltering::BandpassWindowedSinc::setParams
@@ -149,52 +157,15 @@ void RayverbFiltering::BandpassWindowedSinc::setParams
 ,   float s
 )
 {
-    auto i = bandpassKernel (s, l, h);
-    copy (i.begin(), i.end(), kernel.begin());
-}
-
-void RayverbFiltering::Biquad::onepass (vector <float> & data)
-{
-    double z1 = 0;
-    double z2 = 0;
-
-    for (auto && i : data)
-    {
-        double out = i * b0 + z1;
-        z1 = i * b1 + z2 - a1 * out;
-        z2 = i * b2 - a2 * out;
-        i = out;
-    }
+    Bandpass::setParams (l, h, s);
+    convolution.setKernel (bandpassKernel (s, l, h));
 }
 
-void RayverbFiltering::Biquad::setParams
-(   double _b0
-,   double _b1
-,   double _b2
-,   double _a1
-,   double _a2
-)
-{
-    b0 = _b0;
-    b1 = _b1;
-    b2 = _b2;
-    a1 = _a1;
-    a2 = _a2;
-}
+/// Biquad coefficients, in the order b0, b1, b2, a1, a2.
+typedef array <double, 5> BiquadCoefficients;
 
-void RayverbFiltering::Biquad::twopass (vector <float> & data)
-{
-    onepass (data);
-    reverse (begin (data), end (data));
-    onepass (data);
-    reverse (begin (data), end (data));
-}
-
-void RayverbFiltering::OnepassBandpassBiquad::setParams
-(   float lo
-,   float hi
-,   float sr
-)
+/// Coefficients for a bandpass biquad between lo and hi.
+BiquadCoefficients bandpassCoefficients (double lo, double hi, double sr)
 {
     // From www.musicdsp.org/files/Audio-EQ-Cookbook.txt
     const double c = sqrt (lo * hi);
@@ -208,17 +179,81 @@ void RayverbFiltering::OnepassBandpassBiquad::setParams
     const double a0 = 1 + alpha;
     const double nrm = 1 / a0;
 
-    Biquad::setParams
-    (   nrm * alpha
+    return BiquadCoefficients
+    {{  nrm * alpha
     ,   nrm * 0
     ,   nrm * -alpha
     ,   nrm * (-2 * cs)
     ,   nrm * (1 - alpha)
-    );
+    }};
+}
+
+double getC (double co, double sr)
+{
+    const double wcT = M_PI * co / sr;
+    return cos (wcT) / sin (wcT);
+}
+
+/// Coefficients for the lopass section of a linkwitz-riley filter.
+BiquadCoefficients lopassCoefficients (double co, double sr)
+{
+    const double c = getC (co, sr);
+    const double a0 = c * c + c * sqrt (2) + 1;
+    return BiquadCoefficients
+    {{  1 / a0
+    ,   2 / a0
+    ,   1 / a0
+    ,   (-2 * (c * c - 1)) / a0
+    ,   (c * c - c * sqrt (2) + 1) / a0
+    }};
+}
+
+/// Coefficients for the hipass section of a linkwitz-riley filter.
+BiquadCoefficients hipassCoefficients (double co, double sr)
+{
+    const double c = getC (co, sr);
+    const double a0 = c * c + c * sqrt (2) + 1;
+    return BiquadCoefficients
+    {{  (c * c) / a0
+    ,   (-2 * c * c) / a0
+    ,   (c * c) / a0
+    ,   (-2 * (c * c - 1)) / a0
+    ,   (c * c - c * sqrt (2) + 1) / a0
+    }};
+}
+
+/// Set the coefficients of a Biquad from a BiquadCoefficients.
+template <typename T>
+void setCoefficients
+(   RayverbFiltering::Biquad <T> & b
+,   const BiquadCoefficients & c
+)
+{
+    b.setParams (c [0], c [1], c [2], c [3], c [4]);
+}
+
+/// Set the coefficients of one band of a MultibandBiquad.
+void setCoefficients
+(   RayverbFiltering::MultibandBiquad & b
+,   unsigned long band
+,   const BiquadCoefficients & c
+)
+{
+    b.setParams (band, c [0], c [1], c [2], c [3], c [4]);
+}
+
+void RayverbFiltering::OnepassBandpassBiquad::setParams
+(   float lo
+,   float hi
+,   float sr
+)
+{
+    setCoefficients (*this, bandpassCoefficients (lo, hi, sr));
 }
 
 void RayverbFiltering::OnepassBandpassBiquad::filter (vector <float> & data)
 {
+    reset();
     onepass (data);
 }
 
@@ -227,42 +262,257 @@ void RayverbFiltering::TwopassBandpassBiquad::filter (vector <float> & data)
     twopass (data);
 }
 
-double getC (double co, double sr)
+void RayverbFiltering::LinkwitzRiley::setParams (float l, float h, float s)
 {
-    const double wcT = M_PI * co / sr;
-    return cos (wcT) / sin (wcT);
+    setCoefficients (lopass, lopassCoefficients (h, s));
+    setCoefficients (hipass, hipassCoefficients (l, s));
 }
 
-void RayverbFiltering::LinkwitzRiley::setParams (float l, float h, float s)
+void RayverbFiltering::LinkwitzRiley::filter (vector <float> & data)
 {
+    //  The sections are linear and time-invariant, so they can be reordered
+    //  to run both forward passes together, then both backward passes.
+    lopass.reset();
+    hipass.reset();
+    for (auto i = data.begin(); i != data.end(); ++i)
+        *i = hipass.step (lopass.step (*i));
+
+    lopass.reset();
+    hipass.reset();
+    for (auto i = data.rbegin(); i != data.rend(); ++i)
+        *i = hipass.step (lopass.step (*i));
+}
+
+void RayverbFiltering::OnepassMultibandBiquad::setParams
+(   const vector <float> & edges
+,   float sr
+)
+{
+    for (auto i = 0u; i != NUM_BANDS; ++i)
     {
-        const double c = getC (h, s);
-        const double a0 = c * c + c * sqrt (2) + 1;
-        lopass.setParams
-        (   1 / a0
-        ,   2 / a0
-        ,   1 / a0
-        ,   (-2 * (c * c - 1)) / a0
-        ,   (c * c - c * sqrt (2) + 1) / a0
+        setCoefficients
+        (   biquad
+        ,   i
+        ,   bandpassCoefficients (edges [i], edges [i + 1], sr)
         );
     }
+}
+
+void RayverbFiltering::OnepassMultibandBiquad::filterAndMix
+(   vector <float> & data
+,   vector <float> & out
+)
+{
+    const auto samples = data.size() / NUM_BANDS;
+    out.resize (samples);
+    biquad.reset();
+    biquad.forwardAndMix (data.data(), out.data(), samples);
+}
+
+void RayverbFiltering::OnepassMultibandBiquad::filter (vector <float> & data)
+{
+    biquad.reset();
+    biquad.forward (data.data(), data.size() / NUM_BANDS);
+}
+
+void RayverbFiltering::TwopassMultibandBiquad::filterAndMix
+(   vector <float> & data
+,   vector <float> & out
+)
+{
+    const auto samples = data.size() / NUM_BANDS;
+    out.resize (samples);
+    biquad.reset();
+    biquad.forward (data.data(), samples);
+    biquad.reset();
+    biquad.backwardAndMix (data.data(), out.data(), samples);
+}
+
+void RayverbFiltering::TwopassMultibandBiquad::filter (vector <float> & data)
+{
+    const auto samples = data.size() / NUM_BANDS;
+    biquad.reset();
+    biquad.forward (data.data(), samples);
+    biquad.reset();
+    biquad.backward (data.data(), samples);
+}
+
+void RayverbFiltering::MultibandLinkwitzRiley::setParams
+(   const vector <float> & edges
+,   float sr
+)
+{
+    for (auto i = 0u; i != NUM_BANDS; ++i)
     {
-        const double c = getC (l, s);
-        const double a0 = c * c + c * sqrt (2) + 1;
-        hipass.setParams
-        (   (c * c) / a0
-        ,   (-2 * c * c) / a0
-        ,   (c * c) / a0
-        ,   (-2 * (c * c - 1)) / a0
-        ,   (c * c - c * sqrt (2) + 1) / a0
-        );
+        setCoefficients (lopass, i, lopassCoefficients (edges [i + 1], sr));
+        setCoefficients (hipass, i, hipassCoefficients (edges [i], sr));
     }
 }
 
-void RayverbFiltering::LinkwitzRiley::filter (vector <float> & data)
+void RayverbFiltering::MultibandLinkwitzRiley::filterAndMix
+(   vector <float> & data
+,   vector <float> & out
+)
+{
+    const auto samples = data.size() / NUM_BANDS;
+    out.resize (samples);
+
+    //  As in LinkwitzRiley::filter, run both sections forward together,
+    //  then both backward together.
+    lopass.reset();
+    hipass.reset();
+    MultibandBiquad::run <false, false>
+    (   data.data()
+    ,   data.data()
+    ,   samples
+    ,   lopass
+    ,   hipass
+    );
+
+    lopass.reset();
+    hipass.reset();
+    MultibandBiquad::run <true, true>
+    (   data.data()
+    ,   out.data()
+    ,   samples
+    ,   lopass
+    ,   hipass
+    );
+}
+
+void RayverbFiltering::MultibandLinkwitzRiley::filter (vector <float> & data)
 {
-    lopass.twopass (data);
-    hipass.twopass (data);
+    const auto samples = data.size() / NUM_BANDS;
+
+    lopass.reset();
+    hipass.reset();
+    MultibandBiquad::run <false, false>
+    (   data.data()
+    ,   data.data()
+    ,   samples
+    ,   lopass
+    ,   hipass
+    );
+
+    lopass.reset();
+    hipass.reset();
+    MultibandBiquad::run <true, false>
+    (   data.data()
+    ,   data.data()
+    ,   samples
+    ,   lopass
+    ,   hipass
+    );
+}
+
+unique_ptr <RayverbFiltering::Bandpass> RayverbFiltering::makeBandpass
+(   FilterType ft
+,   unsigned long length
+)
+{
+    switch (ft)
+    {
+    case FILTER_TYPE_WINDOWED_SINC:
+        return unique_ptr <Bandpass> (new BandpassWindowedSinc (length));
+    case FILTER_TYPE_BIQUAD_ONEPASS:
+        return unique_ptr <Bandpass> (new OnepassBandpassBiquad());
+    case FILTER_TYPE_BIQUAD_TWOPASS:
+        return unique_ptr <Bandpass> (new TwopassBandpassBiquad());
+    case FILTER_TYPE_LINKWITZ_RILEY:
+        return unique_ptr <Bandpass> (new LinkwitzRiley());
+    }
+    throw runtime_error ("unrecognised filter type");
+}
+
+vector <float> RayverbFiltering::bandEdges (float lo_cutoff)
+{
+    const vector <float> OCTAVES
+    {   lo_cutoff, 175, 350, 700, 1400, 2800, 5600, 11200, 20000
+    };
+
+    if (NUM_BANDS <= 8)
+    {
+        vector <float> ret;
+        for (auto i = 0u; i < OCTAVES.size(); i += 8 / NUM_BANDS)
+            ret.push_back (OCTAVES [i]);
+        return ret;
+    }
+
+    const auto SPLIT = NUM_BANDS / 8;
+    vector <float> ret;
+    for (auto i = 0u; i != 8; ++i)
+    {
+        for (auto j = 0u; j != SPLIT; ++j)
+        {
+            ret.push_back
+            (   OCTAVES [i] *
+                pow (OCTAVES [i + 1] / OCTAVES [i], float (j) / SPLIT)
+            );
+        }
+    }
+    ret.push_back (OCTAVES.back());
+    return ret;
+}
+
+/// Bandpass every band of every channel on a pool of threads.
+/// Band i is sampled at sr / decimation [i].
+/// Each (channel, band) pair is an independent job, and each thread owns its
+/// own filter instance, so no filter state is shared.
+/// The filters are all made on the calling thread before any others start,
+/// because making a windowed-sinc filter plans FFTs, and the FFTW planner
+/// isn't thread-safe.
+/// Once a band has been filtered, callback is called with its channel and
+/// band indices, from the thread that filtered it.
+template <typename T>
+void filterBands
+(   RayverbFiltering::FilterType ft
+,   vector <vector <vector <float>>> & data
+,   const vector <unsigned long> & decimation
+,   float sr
+,   float lo_cutoff
+,   const T & callback
+)
+{
+    const auto EDGES = RayverbFiltering::bandEdges (lo_cutoff);
+
+    //  All filter instances must be able to handle the longest band.
+    unsigned long length = 0;
+    unsigned long jobs = 0;
+    for (const auto & channel : data)
+    {
+        for (const auto & band : channel)
+            length = max (length, band.size());
+        jobs += channel.size();
+    }
+
+    vector <unique_ptr <RayverbFiltering::Bandpass>> filters;
+    for (auto i = 0u; i != threadCount (jobs); ++i)
+        filters.push_back (RayverbFiltering::makeBandpass (ft, length));
+
+    atomic <unsigned long> nextFilter (0);
+    atomic <unsigned long> next (0);
+    auto worker = [&] ()
+    {
+        const auto & bp = filters [nextFilter++];
+        for (auto job = next++; job < jobs; job = next++)
+        {
+            //  Find the channel and band for this job.
+            auto channel = 0u;
+            auto band = job;
+            for (; band >= data [channel].size(); ++channel)
+                band -= data [channel].size();
+
+            bp->setParams
+            (   EDGES [band]
+            ,   EDGES [band + 1]
+            ,   sr / decimation [band]
+            );
+            bp->filter (data [channel] [band]);
+            callback (channel, band, data [channel] [band]);
+        }
+    };
+
+    runOnThreads (jobs, worker);
 }
 
 void RayverbFiltering::filter
@@ -272,75 +522,649 @@ void RayverbFiltering::filter
 ,   float lo_cutoff
 )
 {
-    unique_ptr <Bandpass> bp;
+    filterBands
+    (   ft
+    ,   data
+    ,   vector <unsigned long> (NUM_BANDS, 1)
+    ,   sr
+    ,   lo_cutoff
+    ,   [] (auto, auto, const auto &) {}
+    );
+}
+
+vector <vector <float>> RayverbFiltering::filterAndMix
+(   FilterType ft
+,   vector <vector <vector <float>>> & data
+,   float sr
+,   float lo_cutoff
+,   const BandObserver & observer
+)
+{
+    vector <vector <float>> ret (data.size());
+    vector <mutex> locks (data.size());
+
+    filterBands
+    (   ft
+    ,   data
+    ,   vector <unsigned long> (NUM_BANDS, 1)
+    ,   sr
+    ,   lo_cutoff
+    ,   [&ret, &locks, &observer, sr]
+        (auto channel, auto index, const auto & band)
+        {
+            if (observer)
+                observer (channel, index, band.data(), band.size(), 1, sr);
+
+            lock_guard <mutex> lock (locks [channel]);
+            auto & mixed = ret [channel];
+            if (mixed.size() < band.size())
+                mixed.resize (band.size(), 0);
+            transform
+            (   band.begin()
+            ,   band.end()
+            ,   mixed.begin()
+            ,   mixed.begin()
+            ,   plus <float>()
+            );
+        }
+    );
+
+    return ret;
+}
+
+RayverbFiltering::PolyphaseUpsampler::PolyphaseUpsampler
+(   unsigned long factor
+)
+:   factor (factor)
+,   phases (factor, vector <float> (TAPS))
+{
+    //  A Blackman-windowed sinc with its cutoff at the input Nyquist
+    //  frequency, centred on the middle of the window.
+    const auto LENGTH = TAPS * factor;
+    const auto CENTRE = LENGTH / 2;
+    for (auto i = 0u; i != LENGTH; ++i)
+    {
+        const double t = (double (i) - CENTRE) / factor;
+        const double w =
+            0.42 -
+            0.5 * cos (2 * M_PI * i / LENGTH) +
+            0.08 * cos (4 * M_PI * i / LENGTH);
+        phases [i % factor] [i / factor] = (t == 0 ? 1 : sinc (t)) * w;
+    }
+
+    //  Give every phase unity gain, so there's no ripple at low frequencies.
+    for (auto && phase : phases)
+    {
+        const auto sum = accumulate (phase.begin(), phase.end(), 0.0f);
+        for (auto && i : phase)
+            i /= sum;
+    }
+}
+
+void RayverbFiltering::PolyphaseUpsampler::upsampleAndAdd
+(   const vector <float> & in
+,   float * out
+) const
+{
+    if (factor == 1)
+    {
+        transform (in.begin(), in.end(), out, out, plus <float>());
+        return;
+    }
 
+    //  Output sample (q * factor + p) is centred between input samples q and
+    //  q + 1, and takes input samples q + TAPS / 2 - k for k in [0, TAPS).
+    const long HALF = TAPS / 2;
+    const long SIZE = in.size();
+    for (long q = 0; q != SIZE; ++q)
+    {
+        const auto begin = max (0l, q + HALF - SIZE + 1);
+        const auto end = min <long> (TAPS, q + HALF + 1);
+        for (auto p = 0u; p != factor; ++p)
+        {
+            const auto & phase = phases [p];
+            float sum = 0;
+            for (auto k = begin; k < end; ++k)
+                sum += in [q + HALF - k] * phase [k];
+            out [q * factor + p] += sum;
+        }
+    }
+}
+
+vector <unsigned long> RayverbFiltering::bandDecimation
+(   float sr
+,   float lo_cutoff
+)
+{
+    const auto EDGES = bandEdges (lo_cutoff);
+    const auto MAX_DECIMATION = 64ul;
+
+    vector <unsigned long> ret (NUM_BANDS);
+    for (auto i = 0u; i != NUM_BANDS; ++i)
+    {
+        auto d = 1ul;
+        while (d < MAX_DECIMATION && sr / (d * 2) >= 4 * EDGES [i + 1])
+            d *= 2;
+        ret [i] = d;
+    }
+    return ret;
+}
+
+vector <vector <float>> RayverbFiltering::filterAndMixMultirate
+(   FilterType ft
+,   vector <vector <vector <float>>> & data
+,   const vector <unsigned long> & decimation
+,   float sr
+,   float lo_cutoff
+,   const BandObserver & observer
+)
+{
+    //  Upsamplers are read-only once built, so they can be shared between
+    //  threads.
+    map <unsigned long, PolyphaseUpsampler> upsamplers;
+    for (auto i : decimation)
+        upsamplers.emplace (i, PolyphaseUpsampler (i));
+
+    vector <vector <float>> ret (data.size());
+    vector <mutex> locks (data.size());
+
+    filterBands
+    (   ft
+    ,   data
+    ,   decimation
+    ,   sr
+    ,   lo_cutoff
+    ,   [&ret, &locks, &upsamplers, &decimation, &observer, sr]
+        (auto channel, auto band, const auto & filtered)
+        {
+            if (observer)
+            {
+                observer
+                (   channel
+                ,   band
+                ,   filtered.data()
+                ,   filtered.size()
+                ,   1
+                ,   sr / decimation [band]
+                );
+            }
+
+            const auto & upsampler = upsamplers.at (decimation [band]);
+            vector <float> upsampled
+            (   filtered.size() * upsampler.getFactor()
+            ,   0
+            );
+            upsampler.upsampleAndAdd (filtered, upsampled.data());
+
+            lock_guard <mutex> lock (locks [channel]);
+            auto & mixed = ret [channel];
+            if (mixed.size() < upsampled.size())
+                mixed.resize (upsampled.size(), 0);
+            transform
+            (   upsampled.begin()
+            ,   upsampled.end()
+            ,   mixed.begin()
+            ,   mixed.begin()
+            ,   plus <float>()
+            );
+        }
+    );
+
+    return ret;
+}
+
+/// Whether the given filter type has a multiband implementation.
+static bool hasMultibandFilter (RayverbFiltering::FilterType ft)
+{
+    using namespace RayverbFiltering;
     switch (ft)
     {
-    case FILTER_TYPE_WINDOWED_SINC:
-        bp = unique_ptr <Bandpass>
-        (   new BandpassWindowedSinc (data.front().front().size())
-        );
-        break;
     case FILTER_TYPE_BIQUAD_ONEPASS:
-        bp = unique_ptr <Bandpass> (new OnepassBandpassBiquad());
-        break;
     case FILTER_TYPE_BIQUAD_TWOPASS:
-        bp = unique_ptr <Bandpass> (new TwopassBandpassBiquad());
-        break;
     case FILTER_TYPE_LINKWITZ_RILEY:
-        bp = unique_ptr <Bandpass> (new LinkwitzRiley());
-        break;
+        return true;
+    default:
+        return false;
     }
+}
 
-    for (auto && channel : data)
+/// Create a multiband filter of the given type, or nullptr if the type
+/// doesn't have a multiband implementation.
+static unique_ptr <RayverbFiltering::MultibandFilter> makeMultibandFilter
+(   RayverbFiltering::FilterType ft
+)
+{
+    using namespace RayverbFiltering;
+    switch (ft)
     {
-        const vector <float> EDGES
-            ({lo_cutoff, 175, 350, 700, 1400, 2800, 5600, 11200, 20000});
+    case FILTER_TYPE_BIQUAD_ONEPASS:
+        return unique_ptr <MultibandFilter> (new OnepassMultibandBiquad());
+    case FILTER_TYPE_BIQUAD_TWOPASS:
+        return unique_ptr <MultibandFilter> (new TwopassMultibandBiquad());
+    case FILTER_TYPE_LINKWITZ_RILEY:
+        return unique_ptr <MultibandFilter> (new MultibandLinkwitzRiley());
+    default:
+        return nullptr;
+    }
+}
 
-        for (auto i = 0; i != channel.size(); ++i)
+vector <vector <float>> RayverbFiltering::filterAndMixInterleaved
+(   FilterType ft
+,   vector <vector <float>> & data
+,   float sr
+,   float lo_cutoff
+,   const BandObserver & observer
+)
+{
+    if (! hasMultibandFilter (ft))
+    {
+        //  No multiband implementation, so split the bands and filter them
+        //  separately.
+        vector <vector <vector <float>>> split (data.size());
+        for (auto i = 0u; i != data.size(); ++i)
+        {
+            const auto samples = data [i].size() / NUM_BANDS;
+            split [i].resize (NUM_BANDS, vector <float> (samples));
+            for (auto j = 0u; j != samples; ++j)
+                for (auto k = 0u; k != NUM_BANDS; ++k)
+                    split [i] [k] [j] = data [i] [j * NUM_BANDS + k];
+            data [i] = vector <float>();
+        }
+        return filterAndMix (ft, split, sr, lo_cutoff, observer);
+    }
+
+    //  Channels are independent, so run one per thread.
+    vector <vector <float>> ret (data.size());
+    atomic <unsigned long> next (0);
+    runOnThreads
+    (   data.size()
+    ,   [&] ()
+        {
+            auto mb = makeMultibandFilter (ft);
+            mb->setParams (bandEdges (lo_cutoff), sr);
+            for (auto i = next++; i < data.size(); i = next++)
+            {
+                if (! observer)
+                {
+                    mb->filterAndMix (data [i], ret [i]);
+                    continue;
+                }
+
+                mb->filter (data [i]);
+                const auto samples = data [i].size() / NUM_BANDS;
+                for (auto band = 0u; band != NUM_BANDS; ++band)
+                {
+                    observer
+                    (   i
+                    ,   band
+                    ,   data [i].data() + band
+                    ,   samples
+                    ,   NUM_BANDS
+                    ,   sr
+                    );
+                }
+
+                ret [i].resize (samples);
+                for (auto j = 0u; j != samples; ++j)
+                {
+                    const auto sample = data [i].data() + j * NUM_BANDS;
+                    ret [i] [j] = accumulate (sample, sample + NUM_BANDS, 0.0);
+                }
+            }
+        }
+    );
+    return ret;
+}
+
+/// Shares FFTW plans between all FastConvolutions of the same length.
+/// The FFTW planner isn't thread-safe, so all planning happens under a lock.
+/// Executing plans is thread-safe, so plans can be used from any thread.
+class PlanCache
+{
+public:
+    static PlanCache & get()
+    {
+        static PlanCache cache;
+        return cache;
+    }
+
+    virtual ~PlanCache()
+    {
+        for (const auto & i : cache)
         {
-            bp->setParams (EDGES [i], EDGES [i + 1], sr);
-            bp->filter (channel [i]);
+            fftwf_destroy_plan (i.second.first);
+            fftwf_destroy_plan (i.second.second);
         }
     }
+
+    /// Get a pair of r2c and c2r plans for the given length.
+    pair <fftwf_plan, fftwf_plan> plans (unsigned long length)
+    {
+        lock_guard <mutex> lock (m);
+
+        auto it = cache.find (length);
+        if (it != cache.end())
+            return it->second;
+
+        //  Measuring overwrites the planning arrays, so plan on scratch
+        //  storage.
+        //  fftwf_alloc gives the same alignment as the arrays the plans will
+        //  be executed on, which is all the new-array execute functions need.
+        auto r = fftwf_alloc_real (length);
+        auto c = fftwf_alloc_complex (length / 2 + 1);
+        const auto flags = wisdomFile.empty() ? FFTW_ESTIMATE : FFTW_MEASURE;
+        auto ret = make_pair
+        (   fftwf_plan_dft_r2c_1d (length, r, c, flags)
+        ,   fftwf_plan_dft_c2r_1d (length, c, r, flags)
+        );
+        fftwf_free (r);
+        fftwf_free (c);
+
+        cache [length] = ret;
+
+        if (! wisdomFile.empty())
+            fftwf_export_wisdom_to_filename (wisdomFile.c_str());
+
+        return ret;
+    }
+
+    void setWisdomFile (const string & fname)
+    {
+        lock_guard <mutex> lock (m);
+        wisdomFile = fname;
+
+        //  There won't be any wisdom to import the first time around.
+        fftwf_import_wisdom_from_filename (wisdomFile.c_str());
+    }
+
+private:
+    mutex m;
+    map <unsigned long, pair <fftwf_plan, fftwf_plan>> cache;
+    string wisdomFile;
+};
+
+void RayverbFiltering::FastConvolution::setWisdomFile (const string & fname)
+{
+    PlanCache::get().setWisdomFile (fname);
+}
+
+pair <fftwf_plan, fftwf_plan>
+RayverbFiltering::FastConvolution::sharedPlans (unsigned long length)
+{
+    return PlanCache::get().plans (length);
+}
+
+RayverbFiltering::FastConvolution::Spectrum
+RayverbFiltering::FastConvolution::spectrum (const vector <float> & data)
+{
+    forward_fft (data, acplx);
+    Spectrum ret (CPLX_LENGTH);
+    memcpy (ret.data(), acplx, sizeof (fftwf_complex) * CPLX_LENGTH);
+    return ret;
 }
 
 RayverbFiltering::FastConvolution::FastConvolution (unsigned long FFT_LENGTH)
 :   FFT_LENGTH (FFT_LENGTH)
 ,   r2c_i (fftwf_alloc_real (FFT_LENGTH))
-,   r2c_o (fftwf_alloc_complex (CPLX_LENGTH))
 ,   c2r_i (fftwf_alloc_complex (CPLX_LENGTH))
 ,   c2r_o (fftwf_alloc_real (FFT_LENGTH))
 ,   acplx (fftwf_alloc_complex (CPLX_LENGTH))
 ,   bcplx (fftwf_alloc_complex (CPLX_LENGTH))
-,   r2c
-    (   fftwf_plan_dft_r2c_1d
-        (   FFT_LENGTH
-        ,   r2c_i
-        ,   r2c_o
-        ,   FFTW_ESTIMATE
-        )
-    )
-,   c2r
-    (   fftwf_plan_dft_c2r_1d
-        (   FFT_LENGTH
-        ,   c2r_i
-        ,   c2r_o
-        ,   FFTW_ESTIMATE
-        )
-    )
 {
-
+    tie (r2c, c2r) = PlanCache::get().plans (FFT_LENGTH);
 }
 
 RayverbFiltering::FastConvolution::~FastConvolution()
 {
-    fftwf_destroy_plan (r2c);
-    fftwf_destroy_plan (c2r);
     fftwf_free (r2c_i);
-    fftwf_free (r2c_o);
     fftwf_free (acplx);
     fftwf_free (bcplx);
     fftwf_free (c2r_i);
     fftwf_free (c2r_o);
 }
+
+void RayverbFiltering::FastConvolution::convolve
+(   const Spectrum & a
+,   vector <float> & data
+)
+{
+    forward_fft (data, bcplx);
+    data.resize (FFT_LENGTH);
+    multiply_inverse (reinterpret_cast <const fftwf_complex *> (a.data()), data.data());
+}
+
+void RayverbFiltering::FastConvolution::multiply_inverse
+(   const fftwf_complex * a
+,   float * out
+)
+{
+    const fftwf_complex * x = a;
+    const fftwf_complex * y = bcplx;
+    fftwf_complex * z = c2r_i;
+
+    //  FFTW transforms are unnormalized, so scale here.
+    const float scale = 1.0f / FFT_LENGTH;
+    for (; z != c2r_i + CPLX_LENGTH; ++x, ++y, ++z)
+    {
+        (*z) [0] = ((*x) [0] * (*y) [0] - (*x) [1] * (*y) [1]) * scale;
+        (*z) [1] = ((*x) [0] * (*y) [1] + (*x) [1] * (*y) [0]) * scale;
+    }
+
+    //  Plans may only be run on arrays with the alignment they were made
+    //  for, so go through the aligned buffer if out doesn't match.
+    if (fftwf_alignment_of (out) == fftwf_alignment_of (c2r_o))
+    {
+        fftwf_execute_dft_c2r (c2r, c2r_i, out);
+    }
+    else
+    {
+        fftwf_execute_dft_c2r (c2r, c2r_i, c2r_o);
+        copy (c2r_o, c2r_o + FFT_LENGTH, out);
+    }
+}
+
+unsigned long RayverbFiltering::nextPowerOfTwo (unsigned long i)
+{
+    unsigned long ret = 1;
+    while (ret < i)
+        ret <<= 1;
+    return ret;
+}
+
+RayverbFiltering::OverlapSaveConvolution::OverlapSaveConvolution
+(   unsigned long kernelLength
+)
+:   KERNEL_LENGTH (kernelLength)
+    //  Blocks of about four kernel lengths keep the wasted (overlapping)
+    //  part of each transform small, without making the transforms big.
+,   BLOCK_LENGTH (max (64ul, nextPowerOfTwo (4 * kernelLength)))
+,   time (fftwf_alloc_real (BLOCK_LENGTH))
+,   freq (fftwf_alloc_complex (CPLX_LENGTH))
+,   kernelSpectrum (fftwf_alloc_complex (CPLX_LENGTH))
+{
+    tie (r2c, c2r) = PlanCache::get().plans (BLOCK_LENGTH);
+}
+
+RayverbFiltering::OverlapSaveConvolution::~OverlapSaveConvolution()
+{
+    fftwf_free (time);
+    fftwf_free (freq);
+    fftwf_free (kernelSpectrum);
+}
+
+void RayverbFiltering::OverlapSaveConvolution::setKernel
+(   const vector <float> & kernel
+)
+{
+    fill (time, time + BLOCK_LENGTH, 0);
+    copy (kernel.begin(), kernel.end(), time);
+    fftwf_execute_dft_r2c (r2c, time, kernelSpectrum);
+
+    //  Fold the inverse transform's scaling into the kernel.
+    for (auto i = 0u; i != CPLX_LENGTH; ++i)
+    {
+        kernelSpectrum [i] [0] /= BLOCK_LENGTH;
+        kernelSpectrum [i] [1] /= BLOCK_LENGTH;
+    }
+}
+
+void RayverbFiltering::OverlapSaveConvolution::convolve
+(   float * data
+,   unsigned long inputLength
+)
+{
+    const long OVERLAP = KERNEL_LENGTH - 1;
+    const long OUT_LENGTH = inputLength + OVERLAP;
+
+    //  Each block reads BLOCK_LENGTH input samples starting OVERLAP samples
+    //  before the first output sample it produces (treating samples before
+    //  the input as zero), and produces STEP valid outputs.
+    //  A block only reads samples before the end of its own outputs, so
+    //  working from the last block to the first never reads an output.
+    for (long begin = (OUT_LENGTH - 1) / STEP * STEP; begin >= 0; begin -= STEP)
+    {
+        const long inBegin = begin - OVERLAP;
+        for (long i = 0; i != BLOCK_LENGTH; ++i)
+        {
+            const long j = inBegin + i;
+            time [i] = (0 <= j && j < OUT_LENGTH) ? data [j] : 0;
+        }
+
+        fftwf_execute_dft_r2c (r2c, time, freq);
+
+        for (auto i = 0u; i != CPLX_LENGTH; ++i)
+        {
+            const float re =
+                freq [i] [0] * kernelSpectrum [i] [0] -
+                freq [i] [1] * kernelSpectrum [i] [1];
+            const float im =
+                freq [i] [0] * kernelSpectrum [i] [1] +
+                freq [i] [1] * kernelSpectrum [i] [0];
+            freq [i] [0] = re;
+            freq [i] [1] = im;
+        }
+
+        fftwf_execute_dft_c2r (c2r, freq, time);
+
+        const auto count = min <long> (STEP, OUT_LENGTH - begin);
+        copy (time + OVERLAP, time + OVERLAP + count, data + begin);
+    }
+}
+
+/// Samples of output produced per pass of directConvolve.
+static const unsigned long DIRECT_CHUNK = 4096;
+
+/// Direct-form FIR convolution, in place.
+/// data holds inputLength samples followed by kernel.size() - 1 zeros, and is
+/// overwritten with the full convolution.
+/// Each kernel tap is applied to a whole cache-sized chunk of output in one
+/// contiguous multiply-add loop, which the compiler vectorizes.
+/// A chunk only reads input from before its own end, so chunks are produced
+/// last to first, into scratch (DIRECT_CHUNK samples long).
+void directConvolve
+(   const vector <float> & kernel
+,   float * data
+,   unsigned long inputLength
+,   float * scratch
+)
+{
+    const auto OUT_LENGTH = inputLength + kernel.size() - 1;
+    const auto chunks = (OUT_LENGTH + DIRECT_CHUNK - 1) / DIRECT_CHUNK;
+    for (auto chunk = chunks; chunk-- != 0;)
+    {
+        const auto begin = chunk * DIRECT_CHUNK;
+        const auto end = min (OUT_LENGTH, begin + DIRECT_CHUNK);
+        fill (scratch, scratch + (end - begin), 0);
+        for (auto k = 0ul; k != kernel.size(); ++k)
+        {
+            const auto first = max (begin, k);
+            if (end <= first)
+                continue;
+            const float h = kernel [k];
+            const float * x = data + first - k;
+            float * y = scratch + first - begin;
+            for (auto n = 0ul; n != end - first; ++n)
+                y [n] += h * x [n];
+        }
+        copy (scratch, scratch + (end - begin), data + begin);
+    }
+}
+
+RayverbFiltering::KernelConvolution::KernelConvolution
+(   unsigned long kernelLength
+,   unsigned long inputLength
+)
+:   method (chooseMethod (kernelLength, inputLength))
+{
+    switch (method)
+    {
+    case METHOD_DIRECT:
+        scratch.resize (DIRECT_CHUNK);
+        break;
+    case METHOD_OVERLAP_SAVE:
+        overlapSave = unique_ptr <OverlapSaveConvolution>
+            (new OverlapSaveConvolution (kernelLength));
+        break;
+    case METHOD_FFT:
+        fft = unique_ptr <FastConvolution>
+            (new FastConvolution (kernelLength + inputLength - 1));
+        break;
+    }
+}
+
+RayverbFiltering::KernelConvolution::Method
+RayverbFiltering::KernelConvolution::chooseMethod
+(   unsigned long kernelLength
+,   unsigned long inputLength
+)
+{
+    //  A direct FIR costs kernelLength multiply-adds per sample, which beats
+    //  any transform for kernels this short, whatever the input length.
+    //  This includes the windowed-sinc filters' 29-tap kernels.
+    if (kernelLength <= 64)
+        return METHOD_DIRECT;
+
+    //  Overlap-save needs several blocks before it beats one big transform.
+    const auto block = max (64ul, nextPowerOfTwo (4 * kernelLength));
+    if (inputLength >= 8 * block)
+        return METHOD_OVERLAP_SAVE;
+
+    return METHOD_FFT;
+}
+
+void RayverbFiltering::KernelConvolution::setKernel
+(   const vector <float> & k
+)
+{
+    kernel = k;
+    if (overlapSave)
+        overlapSave->setKernel (kernel);
+    if (fft)
+        spectrum = fft->spectrum (kernel);
+}
+
+void RayverbFiltering::KernelConvolution::convolve (vector <float> & data)
+{
+    if (method == METHOD_FFT)
+    {
+        fft->convolve (spectrum, data);
+        return;
+    }
+
+    //  Both methods work in place, so resizing is the only allocation, and
+    //  it is skipped when data already has room for the tail.
+    const auto inputLength = data.size();
+    data.resize (inputLength + kernel.size() - 1, 0);
+
+    switch (method)
+    {
+    case METHOD_DIRECT:
+        directConvolve (kernel, data.data(), inputLength, scratch.data());
+        break;
+    case METHOD_OVERLAP_SAVE:
+        overlapSave->convolve (data.data(), inputLength);
+        break;
+    case METHOD_FFT:
+        break;
+    }
+}
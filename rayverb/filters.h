@@ -1,5 +1,7 @@
 #pragma once
 
+#include "clstructs.h"
+
 #include "fftw3.h"
 
 #include <array>
@@ -7,6 +9,11 @@
 #include <cmath>
 #include <algorithm>
 #include <iostream>
+#include <memory>
+#include <cstring>
+#include <functional>
+#include <cstdlib>
+#include <new>
 
 /// This namespace houses all of the machinery for multiband crossover
 /// filtering.
@@ -48,9 +55,29 @@ namespace RayverbFiltering
         /// An fftconvolover has a constant length.
         /// This means you can reuse it for lots of different convolutions
         /// without reallocating memory, as long as they're all the same size.
+        /// FFTW plans are shared between all convolvers of the same length.
         FastConvolution (unsigned long FFT_LENGTH);
         virtual ~FastConvolution();
 
+        /// Load FFTW wisdom from (and save new wisdom to) the given file.
+        /// Once a wisdom file is set, plans are made with FFTW_MEASURE, so
+        /// the expensive planning is only paid once per transform length.
+        static void setWisdomFile (const string & fname);
+
+        /// Get the r2c and c2r plans shared by every convolver using the
+        /// given transform length.
+        /// Plans may be executed from any thread, on arrays allocated with
+        /// fftwf_alloc_real and fftwf_alloc_complex.
+        static pair <fftwf_plan, fftwf_plan> sharedPlans (unsigned long length);
+
+        /// The frequency-domain representation of some data, zero-padded to
+        /// the length of the convolver.
+        typedef vector <array <float, 2>> Spectrum;
+
+        /// Get the spectrum of some data, so that other data can be
+        /// convolved with it repeatedly without transforming it each time.
+        Spectrum spectrum (const vector <float> & data);
+
         /// Convolve two data structures stogether.
         template <typename T, typename U>
         vector <float> convolve
@@ -58,48 +85,67 @@ namespace RayverbFiltering
         ,   const U & b
         )
         {
-            forward_fft (r2c, a, r2c_i, r2c_o, acplx);
-            forward_fft (r2c, b, r2c_i, r2c_o, bcplx);
-
-            memset (c2r_i, 0, sizeof (fftwf_complex) * CPLX_LENGTH);
-            memset (c2r_o, 0, sizeof (float) * FFT_LENGTH);
-
-            fftwf_complex * x = acplx;
-            fftwf_complex * y = bcplx;
-            fftwf_complex * z = c2r_i;
-
-            for (; z != c2r_i + CPLX_LENGTH; ++x, ++y, ++z)
-            {
-                (*z) [0] += (*x) [0] * (*y) [0] - (*x) [1] * (*y) [1];
-                (*z) [1] += (*x) [0] * (*y) [1] + (*x) [1] * (*y) [0];
-            }
+            vector <float> ret (FFT_LENGTH);
+            forward_fft (a, acplx);
+            forward_fft (b, bcplx);
+            multiply_inverse (acplx, ret.data());
+            return ret;
+        }
 
-            fftwf_execute (c2r);
+        /// Convolve some data with a precomputed spectrum.
+        template <typename T>
+        vector <float> convolve
+        (   const Spectrum & a
+        ,   const T & b
+        )
+        {
+            vector <float> ret (FFT_LENGTH);
+            convolve (a, b, ret.data());
+            return ret;
+        }
 
-            return vector <float> (c2r_o, c2r_o + FFT_LENGTH);
+        /// Convolve some data with a precomputed spectrum, writing the
+        /// FFT_LENGTH output samples to out, which may alias b.
+        template <typename T>
+        void convolve
+        (   const Spectrum & a
+        ,   const T & b
+        ,   float * out
+        )
+        {
+            forward_fft (b, bcplx);
+            multiply_inverse
+            (   reinterpret_cast <const fftwf_complex *> (a.data())
+            ,   out
+            );
         }
 
+        /// Convolve data with a precomputed spectrum in place.
+        /// data is resized to FFT_LENGTH, so no memory is allocated as long
+        /// as it already has the capacity.
+        void convolve (const Spectrum & a, vector <float> & data);
+
     private:
+        /// Multiply a spectrum by bcplx, and write the inverse transform
+        /// to out.
+        void multiply_inverse (const fftwf_complex * a, float * out);
+
         template <typename T>
         void forward_fft
-        (   fftwf_plan & plan
-        ,   const T & data
-        ,   float * i
-        ,   fftwf_complex * o
+        (   const T & data
         ,   fftwf_complex * results
         )
         {
-            fill (i, i + FFT_LENGTH, 0);
-            copy (data.begin(), data.end(), i);
-            fftwf_execute (plan);
-            memcpy (results, o, sizeof (fftwf_complex) * CPLX_LENGTH);
+            //  Only the padding needs clearing, the rest is overwritten.
+            auto end = copy (data.begin(), data.end(), r2c_i);
+            fill (end, r2c_i + FFT_LENGTH, 0);
+            fftwf_execute_dft_r2c (r2c, r2c_i, results);
         }
 
         const unsigned long FFT_LENGTH;
         const unsigned long CPLX_LENGTH = FFT_LENGTH / 2 + 1;
 
         float * r2c_i;
-        fftwf_complex * r2c_o;
         fftwf_complex * c2r_i;
         float * c2r_o;
         fftwf_complex * acplx;
@@ -109,8 +155,95 @@ namespace RayverbFiltering
         fftwf_plan c2r;
     };
 
+    /// Smallest power of two no less than i.
+    unsigned long nextPowerOfTwo (unsigned long i);
+
+    /// Convolves data with a short kernel using overlap-save: the input is
+    /// processed in small fixed-size FFT blocks, so transforms and buffers
+    /// stay small however long the input is.
+    class OverlapSaveConvolution
+    {
+    public:
+        OverlapSaveConvolution (unsigned long kernelLength);
+        virtual ~OverlapSaveConvolution();
+
+        OverlapSaveConvolution (const OverlapSaveConvolution &) = delete;
+        OverlapSaveConvolution & operator= (const OverlapSaveConvolution &) = delete;
+
+        void setKernel (const vector <float> & kernel);
+
+        /// Replace data with its full linear convolution with the kernel.
+        /// data holds inputLength samples followed by kernel length - 1
+        /// zeros, which the tail of the convolution overwrites.
+        void convolve (float * data, unsigned long inputLength);
+
+    private:
+        const unsigned long KERNEL_LENGTH;
+        const unsigned long BLOCK_LENGTH;
+        const unsigned long CPLX_LENGTH = BLOCK_LENGTH / 2 + 1;
+        const unsigned long STEP = BLOCK_LENGTH - KERNEL_LENGTH + 1;
+
+        float * time;
+        fftwf_complex * freq;
+        fftwf_complex * kernelSpectrum;
+
+        fftwf_plan r2c;
+        fftwf_plan c2r;
+    };
+
+    /// Convolves data with a kernel of fixed length, picking the cheapest
+    /// method for the kernel and input lengths:
+    /// a direct-form FIR for very short kernels, overlap-save for longer
+    /// kernels on long inputs, and a single full-length FFT otherwise.
+    /// The windowed-sinc filters' kernels are short enough that they are
+    /// always convolved directly, so the transform methods only serve longer
+    /// kernels.
+    class KernelConvolution
+    {
+    public:
+        enum Method
+        {   METHOD_DIRECT
+        ,   METHOD_OVERLAP_SAVE
+        ,   METHOD_FFT
+        };
+
+        KernelConvolution (unsigned long kernelLength, unsigned long inputLength);
+
+        static Method chooseMethod
+        (   unsigned long kernelLength
+        ,   unsigned long inputLength
+        );
+
+        Method getMethod() const {return method;}
+
+        void setKernel (const vector <float> & kernel);
+
+        /// Replace data with its convolution with the kernel, which is
+        /// kernel length - 1 samples longer than the input.
+        /// The direct and overlap-save methods work in place, so they don't
+        /// allocate when data has capacity for the tail.
+        void convolve (vector <float> & data);
+
+    private:
+        const Method method;
+        vector <float> kernel;
+        vector <float> scratch;
+
+        unique_ptr <OverlapSaveConvolution> overlapSave;
+        unique_ptr <FastConvolution> fft;
+        FastConvolution::Spectrum spectrum;
+    };
+
+    /// Length of the windowed-sinc filters' kernels.
+    const unsigned long WINDOWED_SINC_LENGTH = 29;
+
+    /// The most samples any filter appends to the signal it filters.
+    /// A signal with this much spare capacity is filtered without being
+    /// reallocated.
+    const unsigned long MAX_FILTER_TAIL = WINDOWED_SINC_LENGTH - 1;
+
     /// An interesting windowed-sinc hipass filter.
-    class HipassWindowedSinc: public Hipass, public FastConvolution
+    class HipassWindowedSinc: public Hipass
     {
     public:
         HipassWindowedSinc (unsigned long inputLength);
@@ -119,12 +252,12 @@ namespace RayverbFiltering
         virtual void filter (vector <float> & data);
         virtual void setParams (float co, float s);
     private:
-        static const auto KERNEL_LENGTH = 29;
-        array <float, KERNEL_LENGTH> kernel;
+        static const auto KERNEL_LENGTH = WINDOWED_SINC_LENGTH;
+        KernelConvolution convolution;
     };
 
     /// An interesting windowed-sinc bandpass filter.
-    class BandpassWindowedSinc: public Bandpass, public FastConvolution
+    class BandpassWindowedSinc: public Bandpass
     {
     public:
         BandpassWindowedSinc (unsigned long inputLength);
@@ -133,7 +266,7 @@ namespace RayverbFiltering
         virtual void filter (vector <float> & data);
         virtual void setParams (float l, float h, float s);
     private:
-        static const auto KERNEL_LENGTH = 29;
+        static const auto KERNEL_LENGTH = WINDOWED_SINC_LENGTH;
 
         /// Fetch a convolution kernel for a bandpass filter with the given
         /// paramters.
@@ -143,32 +276,90 @@ namespace RayverbFiltering
         ,   float hi
         );
 
-        array <float, KERNEL_LENGTH> kernel;
+        KernelConvolution convolution;
     };
 
-    /// A super-simple biquad filter.
+    /// A super-simple biquad filter, in transposed direct form II.
+    /// T is the type used for coefficients and state.
+    /// The filter state is kept between calls to onepass, so long signals can
+    /// be filtered a block at a time.
+    template <typename T>
     class Biquad
     {
     public:
-        /// Run the filter foward over some data.
-        void onepass (vector <float> & data);
+        /// Clear the filter state, ready for an unrelated signal.
+        void reset()
+        {
+            z1 = z2 = 0;
+        }
 
-        /// Run the filter forward then backward over some data.
-        void twopass (vector <float> & data);
+        /// Filter a single sample.
+        T step (T in)
+        {
+            const T out = in * b0 + z1;
+            z1 = in * b1 + z2 - a1 * out;
+            z2 = in * b2 - a2 * out;
+            return out;
+        }
+
+        /// Run the filter foward over a block of data, carrying on from the
+        /// end of the previous block.
+        void onepass (float * data, unsigned long samples)
+        {
+            for (auto i = data; i != data + samples; ++i)
+                *i = step (*i);
+        }
+
+        /// Run the filter backward over a block of data, from the last sample
+        /// to the first, carrying on from the previous block.
+        void backpass (float * data, unsigned long samples)
+        {
+            for (auto i = data + samples; i != data;)
+            {
+                --i;
+                *i = step (*i);
+            }
+        }
+
+        /// Run the filter foward over some data, carrying on from the end of
+        /// the previous block.
+        void onepass (vector <float> & data)
+        {
+            onepass (data.data(), data.size());
+        }
+
+        /// Run the filter forward then backward over a whole signal.
+        /// The state is reset before each pass.
+        void twopass (vector <float> & data)
+        {
+            reset();
+            onepass (data);
+            reset();
+            backpass (data.data(), data.size());
+        }
 
         void setParams
-        (   double b0
-        ,   double b1
-        ,   double b2
-        ,   double a1
-        ,   double a2
-        );
+        (   double _b0
+        ,   double _b1
+        ,   double _b2
+        ,   double _a1
+        ,   double _a2
+        )
+        {
+            b0 = _b0;
+            b1 = _b1;
+            b2 = _b2;
+            a1 = _a1;
+            a2 = _a2;
+        }
     private:
-        double b0, b1, b2, a1, a2;
+        T b0, b1, b2, a1, a2;
+        T z1 = 0;
+        T z2 = 0;
     };
 
     /// Simple biquad bandpass filter.
-    class OnepassBandpassBiquad: public Bandpass, public Biquad
+    class OnepassBandpassBiquad: public Bandpass, public Biquad <double>
     {
     public:
         void setParams (float l, float h, float s);
@@ -183,13 +374,275 @@ namespace RayverbFiltering
 
     /// A linkwitz-riley filter is just a linear-phase lopass and hipass
     /// coupled together.
+    /// The lopass and hipass sections are run together, one sample at a
+    /// time, so the data is only traversed once forward and once backward.
     class LinkwitzRiley: public Bandpass
     {
     public:
         void setParams (float l, float h, float s);
         void filter (vector <float> & data);
     private:
-        Biquad lopass, hipass;
+        Biquad <double> lopass, hipass;
+    };
+
+    /// Base for classes with over-aligned (SIMD vector) members.
+    /// Before C++17, new only guarantees the alignment of the fundamental
+    /// types, so these classes allocate themselves with posix_memalign.
+    template <size_t ALIGNMENT>
+    class AlignedNew
+    {
+    public:
+        static void * operator new (size_t size)
+        {
+            void * ret = nullptr;
+            if (posix_memalign (&ret, max (ALIGNMENT, sizeof (void *)), size))
+                throw bad_alloc();
+            return ret;
+        }
+
+        static void operator delete (void * p)
+        {
+            free (p);
+        }
+    };
+
+    /// A bank of LANES biquads in transposed direct form II, which are
+    /// advanced together over interleaved data, laid out as [sample][lane].
+    /// Lanes might be the bands of one signal, or the channels of a
+    /// multichannel signal.
+    /// Each operation on the coefficient and state vectors updates every lane
+    /// at once, so the compiler can map a whole sample onto wide SIMD
+    /// registers.
+    /// Like Biquad, the state is kept between calls, so signals can be
+    /// filtered a block at a time.
+    template <typename T, unsigned long LANES>
+    class BiquadLanes: public AlignedNew <LANES * sizeof (T)>
+    {
+    public:
+        typedef T Lanes __attribute__ ((vector_size (LANES * sizeof (T))));
+
+        /// Clear the filter state, ready for an unrelated signal.
+        void reset()
+        {
+            z1 = z2 = Lanes {0};
+        }
+
+        /// Set the coefficients of the biquad for a single lane.
+        void setParams
+        (   unsigned long lane
+        ,   double _b0
+        ,   double _b1
+        ,   double _b2
+        ,   double _a1
+        ,   double _a2
+        )
+        {
+            b0 [lane] = _b0;
+            b1 [lane] = _b1;
+            b2 [lane] = _b2;
+            a1 [lane] = _a1;
+            a2 [lane] = _a2;
+        }
+
+        /// Set the same coefficients for every lane.
+        void setParams
+        (   double _b0
+        ,   double _b1
+        ,   double _b2
+        ,   double _a1
+        ,   double _a2
+        )
+        {
+            for (auto i = 0u; i != LANES; ++i)
+                setParams (i, _b0, _b1, _b2, _a1, _a2);
+        }
+
+        /// The same recurrence as Biquad::step, with every lane in its own
+        /// vector element.
+        /// Lanes are updated in place, as wide vectors may not be passed
+        /// by value in registers.
+        void step (Lanes & x)
+        {
+            const Lanes y = x * b0 + z1;
+            z1 = x * b1 + z2 - a1 * y;
+            z2 = x * b2 - a2 * y;
+            x = y;
+        }
+
+        /// Run the filters forward over interleaved data, in place.
+        void forward (float * data, unsigned long samples)
+        {
+            run <false, false> (data, data, samples, *this);
+        }
+
+        /// Run the filters backward over interleaved data, in place.
+        void backward (float * data, unsigned long samples)
+        {
+            run <true, false> (data, data, samples, *this);
+        }
+
+        /// Run the filters forward, writing the sum of all lanes of each
+        /// sample to out instead of writing back to data.
+        void forwardAndMix
+        (   const float * data
+        ,   float * out
+        ,   unsigned long samples
+        )
+        {
+            run <false, true> (data, out, samples, *this);
+        }
+
+        /// Run the filters backward, writing the sum of all lanes of each
+        /// sample to out instead of writing back to data.
+        void backwardAndMix
+        (   const float * data
+        ,   float * out
+        ,   unsigned long samples
+        )
+        {
+            run <true, true> (data, out, samples, *this);
+        }
+
+        /// Run a cascade of filter banks over interleaved data in a single
+        /// traversal, feeding each sample through every filter in turn.
+        /// When REVERSE is set, the data is traversed from the last sample to
+        /// the first.
+        /// When MIX is set, the lanes of each output sample are summed and
+        /// written to a single float of out, rather than written back in
+        /// interleaved form.
+        template <bool REVERSE, bool MIX, typename... Ts>
+        static void run
+        (   const float * in
+        ,   float * out
+        ,   unsigned long samples
+        ,   Ts & ... filters
+        )
+        {
+            for (unsigned long s = 0; s != samples; ++s)
+            {
+                const auto index = REVERSE ? samples - 1 - s : s;
+                const float * i = in + index * LANES;
+
+                Lanes x;
+                for (auto j = 0u; j != LANES; ++j)
+                    x [j] = i [j];
+
+                cascade (x, filters...);
+
+                if (MIX)
+                {
+                    T sum = 0;
+                    for (auto j = 0u; j != LANES; ++j)
+                        sum += x [j];
+                    out [index] = sum;
+                }
+                else
+                {
+                    float * o = out + index * LANES;
+                    for (auto j = 0u; j != LANES; ++j)
+                        o [j] = x [j];
+                }
+            }
+        }
+    private:
+        static void cascade (Lanes &)
+        {
+
+        }
+
+        template <typename... Ts>
+        static void cascade (Lanes & x, BiquadLanes & first, Ts & ... rest)
+        {
+            first.step (x);
+            cascade (x, rest...);
+        }
+
+        Lanes b0, b1, b2, a1, a2;
+        Lanes z1 = Lanes {0};
+        Lanes z2 = Lanes {0};
+    };
+
+    /// A bank of biquads, one for each band of an interleaved multiband
+    /// signal.
+    typedef BiquadLanes <double, NUM_BANDS> MultibandBiquad;
+
+    /// Interface for a filter which bandpasses every band of an interleaved
+    /// multiband signal together, and mixes the bands down in its final pass.
+    /// Implementations hold MultibandBiquads, so must be allocated with
+    /// their alignment.
+    class MultibandFilter: public AlignedNew <alignof (MultibandBiquad)>
+    {
+    public:
+        virtual ~MultibandFilter() {}
+
+        /// Set the band edges (NUM_BANDS + 1 frequencies) and samplerate.
+        virtual void setParams (const vector <float> & edges, float sr) = 0;
+
+        /// Given interleaved data, write the filtered, mixed-down signal to
+        /// out.
+        /// The contents of data are undefined afterwards.
+        virtual void filterAndMix
+        (   vector <float> & data
+        ,   vector <float> & out
+        ) = 0;
+
+        /// Filter interleaved data in place, keeping the bands separate.
+        virtual void filter (vector <float> & data) = 0;
+    };
+
+    /// Simple biquad bandpass filters for all bands.
+    class OnepassMultibandBiquad: public MultibandFilter
+    {
+    public:
+        void setParams (const vector <float> & edges, float sr);
+        void filterAndMix (vector <float> & data, vector <float> & out);
+        void filter (vector <float> & data);
+    protected:
+        MultibandBiquad biquad;
+    };
+
+    /// Simple two-pass biquad bandpass filters for all bands.
+    class TwopassMultibandBiquad: public OnepassMultibandBiquad
+    {
+    public:
+        void filterAndMix (vector <float> & data, vector <float> & out);
+        void filter (vector <float> & data);
+    };
+
+    /// Linkwitz-riley bandpass filters for all bands.
+    class MultibandLinkwitzRiley: public MultibandFilter
+    {
+    public:
+        void setParams (const vector <float> & edges, float sr);
+        void filterAndMix (vector <float> & data, vector <float> & out);
+        void filter (vector <float> & data);
+    private:
+        MultibandBiquad lopass, hipass;
+    };
+
+    /// Upsamples a signal by an integer factor, using a polyphase
+    /// windowed-sinc interpolator.
+    /// The output is the band-limited signal at the higher rate, so a
+    /// signal filtered at a reduced rate comes out at the amplitude it would
+    /// have had if it had been filtered at the full rate.
+    class PolyphaseUpsampler
+    {
+    public:
+        PolyphaseUpsampler (unsigned long factor);
+
+        unsigned long getFactor() const {return factor;}
+
+        /// Upsample in, and add the result to out, which must hold at least
+        /// in.size() * factor samples.
+        void upsampleAndAdd (const vector <float> & in, float * out) const;
+
+        /// The number of input samples covered by each phase.
+        static const unsigned long TAPS = 16;
+    private:
+        unsigned long factor;
+
+        /// One sub-filter per output phase, each TAPS long.
+        vector <vector <float>> phases;
     };
 
     /// Enum denoting available filter types.
@@ -200,12 +653,86 @@ namespace RayverbFiltering
     ,   FILTER_TYPE_LINKWITZ_RILEY
     };
 
-    /// Given a filter type and a vector of vector of float, return the
-    /// parallel-filtered and summed data, using the specified filtering method.
+    /// Create a bandpass filter of the given type, able to filter input of up
+    /// to the given length.
+    unique_ptr <Bandpass> makeBandpass (FilterType ft, unsigned long length);
+
+    /// Called with each band of each channel once it has been filtered, and
+    /// before it is mixed down.
+    /// The band has length samples, stride floats apart, at the given
+    /// samplerate.
+    /// It may be called from several threads at once, but never twice for the
+    /// same channel and band.
+    typedef function
+    <   void
+        (   unsigned long channel
+        ,   unsigned long band
+        ,   const float * data
+        ,   unsigned long length
+        ,   unsigned long stride
+        ,   float sr
+        )
+    > BandObserver;
+
+    /// Given a filter type and a vector of vector of float, bandpass each band
+    /// of each channel in place, using the specified filtering method.
+    /// Bands are filtered in parallel, each thread using its own filter.
     void filter
     (   FilterType ft
     ,   vector <vector <vector <float>>> & data
     ,   float sr
     ,   float lo_cutoff
     );
+
+    /// Filter every band like filter(), and sum the bands of each channel
+    /// as soon as they are filtered, returning one mixed-down vector per
+    /// channel.
+    /// If an observer is given, it sees every band before it is mixed.
+    vector <vector <float>> filterAndMix
+    (   FilterType ft
+    ,   vector <vector <vector <float>>> & data
+    ,   float sr
+    ,   float lo_cutoff
+    ,   const BandObserver & observer = nullptr
+    );
+
+    /// The NUM_BANDS + 1 edges of the frequency bands.
+    /// With 8 bands these are octaves, fewer bands span several octaves, and
+    /// more bands split octaves evenly on a log scale.
+    vector <float> bandEdges (float lo_cutoff);
+
+    /// The largest power-of-two decimation factor, up to 64, at which each
+    /// band can be filtered while keeping its upper edge below a quarter of
+    /// the reduced samplerate.
+    /// High bands get a factor of 1.
+    vector <unsigned long> bandDecimation (float sr, float lo_cutoff);
+
+    /// Like filterAndMix, but band i of each channel is sampled at
+    /// sr / decimation [i].
+    /// Each band is filtered at its own rate, then upsampled to sr as it is
+    /// mixed down.
+    /// An observer sees each band at its own rate, before upsampling.
+    vector <vector <float>> filterAndMixMultirate
+    (   FilterType ft
+    ,   vector <vector <vector <float>>> & data
+    ,   const vector <unsigned long> & decimation
+    ,   float sr
+    ,   float lo_cutoff
+    ,   const BandObserver & observer = nullptr
+    );
+
+    /// Given a filter type and channels of interleaved multiband data
+    /// ([sample][band]), filter all bands and return one mixed-down vector
+    /// per channel.
+    /// The biquad filter types process every band in a single vectorized
+    /// pass; other filter types fall back to filtering band-by-band.
+    /// If an observer is given, the biquad types filter the bands in place
+    /// and show them to the observer, then mix them in a separate pass.
+    vector <vector <float>> filterAndMixInterleaved
+    (   FilterType ft
+    ,   vector <vector <float>> & data
+    ,   float sr
+    ,   float lo_cutoff
+    ,   const BandObserver & observer = nullptr
+    );
 }
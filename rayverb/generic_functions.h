@@ -2,6 +2,9 @@
 
 #include <vector>
 #include <numeric>
+#include <cmath>
+#include <thread>
+#include <algorithm>
 
 /// You can call max_amp on an arbitrarily nested vector and get back the
 /// magnitude of the value with the greatest magnitude in the vector.
@@ -61,6 +64,32 @@ inline void normalize (std::vector <T> & ret)
     mul (ret, 1.0 / max_amp (ret));
 }
 
+/// The number of threads runOnThreads will use for maxThreads.
+inline unsigned long threadCount (unsigned long maxThreads)
+{
+    return std::min <unsigned long>
+    (   std::max (1u, std::thread::hardware_concurrency())
+    ,   std::max (1ul, maxThreads)
+    );
+}
+
+/// Run worker on up to maxThreads threads (including the calling thread), and
+/// wait for them all to finish.
+/// Workers should pull jobs from a shared atomic counter until there are none
+/// left.
+template <typename T>
+inline void runOnThreads (unsigned long maxThreads, const T & worker)
+{
+    const auto nthreads = threadCount (maxThreads);
+
+    std::vector <std::thread> threads;
+    for (auto i = 1u; i < nthreads; ++i)
+        threads.push_back (std::thread (worker));
+    worker();
+    for (auto && i : threads)
+        i.join();
+}
+
 /// Call binary operation u on pairs of elements from a and b, where a and b are
 /// cl_floatx types.
 template <typename T, typename U>
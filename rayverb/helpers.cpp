@@ -45,9 +45,9 @@ void print_diagnostic
 
             writer.String ("volume");
             float average = 0;
-            for (auto k = 0; k != 8; ++k)
+            for (auto k = 0; k != NUM_BANDS; ++k)
                 average += reflection.volume.s [k];
-            average /= 8;
+            average /= NUM_BANDS;
             writer.Double (average);
 
             writer.EndObject();
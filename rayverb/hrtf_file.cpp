@@ -0,0 +1,247 @@
+#include "hrtf_file.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+/// Edges of the octave bands stored in an HrtfTable.
+static const array <float, 9> BAND_EDGES
+{{0, 175, 350, 700, 1400, 2800, 5600, 11200, 20000}};
+
+const char HrtfFile::MAGIC [8] = {'R', 'V', 'H', 'R', 'T', 'F', 0, 0};
+const char HrtfFile::CACHE_MAGIC [8] = {'R', 'V', 'H', 'C', 'A', 'C', 'H', 0};
+
+HrtfFile::HrtfFile (const string & fname, bool verbose)
+:   table (nullptr)
+{
+    struct stat buffer;
+    if (stat (fname.c_str(), &buffer) == -1)
+        throw runtime_error ("hrtf file " + fname + " does not exist");
+
+    CacheHeader expected;
+    memset (&expected, 0, sizeof (CacheHeader));
+    copy (begin (CACHE_MAGIC), end (CACHE_MAGIC), expected.magic);
+    expected.version = VERSION;
+    expected.sourceSize = buffer.st_size;
+    expected.sourceModified = buffer.st_mtime;
+
+    const auto cacheName = fname + ".cache";
+
+    if (loadCache (cacheName, expected))
+    {
+        if (verbose)
+            cerr << "Loaded cached hrtf table from " << cacheName << endl;
+        return;
+    }
+
+    reduce (MappedFile (fname));
+    writeCache (cacheName, expected);
+
+    if (verbose)
+        cerr << "Loaded hrtf data from " << fname << endl;
+}
+
+const HrtfTable & HrtfFile::getTable() const
+{
+    return *table;
+}
+
+bool HrtfFile::loadCache (const string & cacheName, const CacheHeader & expected)
+{
+    try
+    {
+        unique_ptr <MappedFile> cache (new MappedFile (cacheName));
+
+        if (cache->size() != sizeof (CacheHeader) + sizeof (HrtfTable))
+            return false;
+        if (memcmp (cache->data(), &expected, sizeof (CacheHeader)))
+            return false;
+
+        mapped = move (cache);
+        table = reinterpret_cast <const HrtfTable *>
+            (mapped->data() + sizeof (CacheHeader));
+        return true;
+    }
+    catch (const runtime_error &)
+    {
+        return false;
+    }
+}
+
+/// Resample the file's angular grid to one-degree resolution using
+/// nearest-neighbour lookup, and average its bands down to octave bands,
+/// weighted by bandwidth overlap.
+void HrtfFile::reduce (const MappedFile & source)
+{
+    if (source.size() < sizeof (HrtfFileHeader))
+        throw runtime_error ("hrtf file is too short");
+
+    HrtfFileHeader header;
+    memcpy (&header, source.data(), sizeof (HrtfFileHeader));
+
+    if (memcmp (header.magic, MAGIC, sizeof (MAGIC)))
+        throw runtime_error ("hrtf file has an invalid header");
+    if (header.version != VERSION)
+        throw runtime_error ("unsupported hrtf file version");
+    if (header.channels != 1 && header.channels != 2)
+        throw runtime_error ("hrtf file must contain one or two channels");
+    if (! (header.azimuths && header.elevations && header.bands))
+        throw runtime_error ("hrtf file contains no data");
+
+    const auto NUM_EDGES = header.bands + 1;
+    const auto NUM_VALUES =
+        header.channels * header.azimuths * header.elevations * header.bands;
+
+    if
+    (   source.size()
+    <   sizeof (HrtfFileHeader) + (NUM_EDGES + NUM_VALUES) * sizeof (float)
+    )
+        throw runtime_error ("hrtf file is truncated");
+
+    vector <float> edges (NUM_EDGES);
+    memcpy
+    (   edges.data()
+    ,   source.data() + sizeof (HrtfFileHeader)
+    ,   NUM_EDGES * sizeof (float)
+    );
+
+    //  Work out the contribution of each file band to each output band.
+    const auto NUM_OUT = BAND_EDGES.size() - 1;
+    vector <vector <float>> weights (NUM_OUT, vector <float> (header.bands, 0));
+    for (auto i = 0u; i != NUM_OUT; ++i)
+    {
+        float total = 0;
+        for (auto j = 0u; j != header.bands; ++j)
+        {
+            const auto overlap =
+                min (BAND_EDGES [i + 1], edges [j + 1]) -
+                max (BAND_EDGES [i], edges [j]);
+            if (overlap > 0)
+            {
+                weights [i] [j] = overlap;
+                total += overlap;
+            }
+        }
+
+        if (total > 0)
+        {
+            for (auto && j : weights [i])
+                j /= total;
+        }
+        else
+        {
+            //  The file doesn't cover this band, so use the closest band.
+            const auto centre = (BAND_EDGES [i] + BAND_EDGES [i + 1]) / 2;
+            auto closest = 0u;
+            for (auto j = 1u; j != header.bands; ++j)
+            {
+                auto dist = [&edges, centre] (auto k)
+                {
+                    return fabs ((edges [k] + edges [k + 1]) / 2 - centre);
+                };
+                if (dist (j) < dist (closest))
+                    closest = j;
+            }
+            weights [i] [closest] = 1;
+        }
+    }
+
+    const auto magnitudes = reinterpret_cast <const float *>
+        (source.data() + sizeof (HrtfFileHeader) + NUM_EDGES * sizeof (float));
+
+    reduced = unique_ptr <HrtfTable> (new HrtfTable);
+
+    for (auto c = 0u; c != reduced->size(); ++c)
+    {
+        const auto channel = min <uint32_t> (c, header.channels - 1);
+        for (auto a = 0u; a != (*reduced) [c].size(); ++a)
+        {
+            const auto fa =
+                lround (a * header.azimuths / 360.0) % header.azimuths;
+            for (auto e = 0u; e != (*reduced) [c] [a].size(); ++e)
+            {
+                const auto fe = min <long>
+                (   lround (e * header.elevations / 180.0)
+                ,   header.elevations - 1
+                );
+                const auto in = magnitudes +
+                (   (channel * header.azimuths + fa) * header.elevations + fe
+                ) * header.bands;
+
+                auto & out = (*reduced) [c] [a] [e];
+                for (auto i = 0u; i != NUM_OUT; ++i)
+                {
+                    out.s [i] = 0;
+                    for (auto j = 0u; j != header.bands; ++j)
+                        out.s [i] += weights [i] [j] * in [j];
+                }
+            }
+        }
+    }
+
+    table = reduced.get();
+}
+
+void HrtfFile::writeCache (const string & cacheName, const CacheHeader & header) const
+{
+    //  The cache is an optimisation, so failing to write it isn't an error.
+    ofstream out (cacheName, ios::binary);
+    if (! out.is_open())
+        return;
+    out.write (reinterpret_cast <const char *> (&header), sizeof (CacheHeader));
+    out.write (reinterpret_cast <const char *> (table), sizeof (HrtfTable));
+    if (! out)
+    {
+        out.close();
+        remove (cacheName.c_str());
+    }
+}
+
+void HrtfFile::write
+(   const string & fname
+,   unsigned long azimuths
+,   unsigned long elevations
+,   const vector <float> & edges
+,   const vector <float> & magnitudes
+)
+{
+    if (edges.size() < 2)
+        throw runtime_error ("hrtf data needs at least one band");
+
+    HrtfFileHeader header;
+    memset (&header, 0, sizeof (HrtfFileHeader));
+    copy (begin (MAGIC), end (MAGIC), header.magic);
+    header.version = VERSION;
+    header.azimuths = azimuths;
+    header.elevations = elevations;
+    header.bands = edges.size() - 1;
+    header.channels =
+        magnitudes.size() / (azimuths * elevations * header.bands);
+
+    if
+    (   magnitudes.size()
+    !=  header.channels * azimuths * elevations * header.bands
+    )
+        throw runtime_error ("hrtf data has an inconsistent size");
+
+    ofstream out (fname, ios::binary);
+    out.write (reinterpret_cast <const char *> (&header), sizeof (HrtfFileHeader));
+    out.write
+    (   reinterpret_cast <const char *> (edges.data())
+    ,   edges.size() * sizeof (float)
+    );
+    out.write
+    (   reinterpret_cast <const char *> (magnitudes.data())
+    ,   magnitudes.size() * sizeof (float)
+    );
+
+    if (! out)
+        throw runtime_error ("failed to write hrtf file " + fname);
+}
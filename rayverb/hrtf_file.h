@@ -0,0 +1,78 @@
+#pragma once
+
+#include "clstructs.h"
+#include "mapped_file.h"
+
+#include <array>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+/// The HRTF table format of the built-in data, in octave bands.
+/// Indexed as [channel][azimuth][elevation], with one-degree resolution.
+typedef std::array <std::array <std::array <cl_float8, 180>, 360>, 2> HrtfTable;
+
+/// Header of an external HRTF file.
+///
+/// The header is followed by (bands + 1) float band edges in Hz, then by
+/// channels * azimuths * elevations * bands float magnitudes, stored as
+/// [channel][azimuth][elevation][band].
+/// Azimuths are evenly spaced over [0, 360) degrees and elevations are evenly
+/// spaced over [0, 180) degrees from the zenith, matching the layout of
+/// HrtfTable.
+struct HrtfFileHeader
+{
+    char magic [8];
+    uint32_t version;
+    uint32_t channels;
+    uint32_t azimuths;
+    uint32_t elevations;
+    uint32_t bands;
+    uint32_t reserved;
+};
+
+/// Loads an HRTF dataset from an external binary file.
+/// The band-reduced table is cached next to the source file, and subsequent
+/// loads map the cache straight into memory without parsing or copying.
+class HrtfFile
+{
+public:
+    HrtfFile (const std::string & fname, bool verbose = false);
+
+    const HrtfTable & getTable() const;
+
+    static const char MAGIC [8];
+    static const char CACHE_MAGIC [8];
+    static const uint32_t VERSION = 1;
+
+    /// Write an HRTF file in the external format.
+    /// Mainly useful for converters and tests.
+    static void write
+    (   const std::string & fname
+    ,   unsigned long azimuths
+    ,   unsigned long elevations
+    ,   const std::vector <float> & edges
+    ,   const std::vector <float> & magnitudes
+    );
+
+private:
+    /// Header of the on-disk cache, recording which source file it came from.
+    struct CacheHeader
+    {
+        char magic [8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t sourceSize;
+        int64_t sourceModified;
+        char padding [32];
+    };
+
+    bool loadCache (const std::string & cacheName, const CacheHeader & expected);
+    void reduce (const MappedFile & source);
+    void writeCache (const std::string & cacheName, const CacheHeader & header) const;
+
+    std::unique_ptr <MappedFile> mapped;
+    std::unique_ptr <HrtfTable> reduced;
+    const HrtfTable * table;
+};
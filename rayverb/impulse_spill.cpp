@@ -0,0 +1,89 @@
+#include "impulse_spill.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+#include <sys/mman.h>
+
+using namespace std;
+
+static_assert
+(   sizeof (ImpulseSpillHeader) == 64
+,   "impulse spill header must keep the impulses aligned"
+);
+static_assert
+(   offsetof (ImpulseSpillHeader, mic) % 16 == 0
+,   "impulse spill header's mic must be aligned in the mapping"
+);
+
+const char ImpulseSpillWriter::MAGIC [8] =
+{'R', 'V', 'S', 'P', 'I', 'L', 'L', 0};
+
+ImpulseSpillWriter::ImpulseSpillWriter
+(   const string & fname
+,   uint64_t capacity
+,   const cl_float3 & mic
+)
+:   file (fname, sizeof (ImpulseSpillHeader) + capacity * sizeof (Impulse))
+,   count (capacity)
+{
+    //  The magic is only filled in by finish().
+    ImpulseSpillHeader header;
+    memset (&header, 0, sizeof (ImpulseSpillHeader));
+    header.version = VERSION;
+    header.bands = NUM_BANDS;
+    header.impulses = capacity;
+    header.mic = mic;
+    memcpy (file.data(), &header, sizeof (ImpulseSpillHeader));
+
+    //  Impulses are written once, in order.
+    madvise (file.data(), file.size(), MADV_SEQUENTIAL);
+}
+
+Impulse * ImpulseSpillWriter::data() const
+{
+    return reinterpret_cast <Impulse *>
+        (file.data() + sizeof (ImpulseSpillHeader));
+}
+
+void ImpulseSpillWriter::finish()
+{
+    file.sync();
+    copy (begin (MAGIC), end (MAGIC), file.data());
+    file.sync();
+}
+
+ImpulseSpill::ImpulseSpill (const string & fname)
+:   file (fname)
+{
+    if (file.size() < sizeof (ImpulseSpillHeader))
+        throw runtime_error ("impulse spill file " + fname + " is too short");
+
+    memcpy (&header, file.data(), sizeof (ImpulseSpillHeader));
+
+    if (memcmp (header.magic, ImpulseSpillWriter::MAGIC, sizeof (header.magic)))
+        throw runtime_error ("impulse spill file " + fname + " is incomplete or invalid");
+    if (header.version != ImpulseSpillWriter::VERSION)
+        throw runtime_error ("unsupported impulse spill file version");
+    if (header.bands != NUM_BANDS)
+        throw runtime_error ("impulse spill file has the wrong number of bands");
+    if
+    (   file.size()
+    !=  sizeof (ImpulseSpillHeader) + header.impulses * sizeof (Impulse)
+    )
+        throw runtime_error ("impulse spill file " + fname + " is truncated");
+
+    madvise
+    (   const_cast <char *> (file.data())
+    ,   file.size()
+    ,   MADV_SEQUENTIAL
+    );
+}
+
+const Impulse * ImpulseSpill::data() const
+{
+    return reinterpret_cast <const Impulse *>
+        (file.data() + sizeof (ImpulseSpillHeader));
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "clstructs.h"
+#include "mapped_file.h"
+
+#include <string>
+#include <cstdint>
+
+/// Header of an impulse spill file.
+///
+/// The header is followed by `impulses` Impulse, exactly as they were read
+/// back from the device.
+/// It is padded to 64 bytes so that the impulses stay aligned.
+/// mic is 16-byte aligned, so it starts at offset 32.
+struct ImpulseSpillHeader
+{
+    char magic [8];
+    uint32_t version;
+    uint32_t bands;
+    uint64_t impulses;
+    cl_float3 mic;
+    char padding [16];
+};
+
+/// A file-backed arena for raw impulses, so that traces can produce more
+/// impulses than fit in memory.
+/// Impulses are written straight into the mapping, and the OS pages them out
+/// to the file as needed.
+class ImpulseSpillWriter
+{
+public:
+    static const char MAGIC [8];
+    static const uint32_t VERSION = 1;
+
+    /// Create a spill file with room for `capacity` impulses, all zero.
+    ImpulseSpillWriter
+    (   const std::string & fname
+    ,   uint64_t capacity
+    ,   const cl_float3 & mic
+    );
+
+    Impulse * data() const;
+    uint64_t capacity() const {return count;}
+
+    /// Flush the impulses to disk and mark the file as complete.
+    /// Files which are never finished can't be opened by ImpulseSpill.
+    void finish();
+
+private:
+    WritableMappedFile file;
+    uint64_t count;
+};
+
+/// Read-only view of a finished impulse spill file.
+/// The impulses are memory-mapped, so they can be streamed through later
+/// stages without reading the whole file into memory.
+class ImpulseSpill
+{
+public:
+    ImpulseSpill (const std::string & fname);
+
+    const Impulse * data() const;
+    uint64_t size() const {return header.impulses;}
+    const cl_float3 & mic() const {return header.mic;}
+
+private:
+    MappedFile file;
+    ImpulseSpillHeader header;
+};
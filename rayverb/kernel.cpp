@@ -4,15 +4,21 @@ const std::string KernelLoader::KERNEL_STRING (
 #ifdef DIAGNOSTIC
 "#define DIAGNOSTIC\n"
 #endif
+#ifdef RAY_STATISTICS
+"#define RAY_STATISTICS\n"
+#endif
 "#define NUM_IMAGE_SOURCE " + std::to_string (NUM_IMAGE_SOURCE) + "\n"
+"#define MAX_IMAGE_SOURCE_ORDER " + std::to_string (MAX_IMAGE_SOURCE_ORDER) + "\n"
+"#define MAX_AMBISONIC_ORDER " + std::to_string (MAX_AMBISONIC_ORDER) + "\n"
 "#define SPEED_OF_SOUND " + std::to_string (SPEED_OF_SOUND) + "\n"
+"#define NUM_BANDS " + std::to_string (NUM_BANDS) + "\n"
+"typedef float" + std::to_string (NUM_BANDS) + " VolumeType;\n"
 R"(
 
 #define EPSILON (0.0001f)
 #define NULL (0)
 
 constant float SECONDS_PER_METER = 1.0f / SPEED_OF_SOUND;
-typedef float8 VolumeType;
 
 typedef struct {
     float3 position;
@@ -59,6 +65,24 @@ typedef struct {
     float3 v2;
 } TriangleVerts;
 
+typedef struct {
+    unsigned long triangle_tests;
+    unsigned long bounce_rays;
+    unsigned long shadow_rays;
+    unsigned long image_source_casts;
+    unsigned long escaped;
+    unsigned long bounces;
+    unsigned long reused_bounces;
+} RayStatistics;
+
+//  Counts work done by the raytrace kernel in instrumented builds, and
+//  compiles to nothing otherwise.
+#ifdef RAY_STATISTICS
+#define COUNT(name, n) (stats.name += (n))
+#else
+#define COUNT(name, n)
+#endif
+
 float triangle_vert_intersection (TriangleVerts * v, Ray * ray);
 float triangle_vert_intersection (TriangleVerts * v, Ray * ray)
 {
@@ -191,6 +215,23 @@ Intersection ray_triangle_intersection
     return ret;
 }
 
+Intersection cached_triangle_intersection
+(   Ray * ray
+,   global Triangle * triangles
+,   unsigned long primitive
+,   global float3 * vertices
+);
+Intersection cached_triangle_intersection
+(   Ray * ray
+,   global Triangle * triangles
+,   unsigned long primitive
+,   global float3 * vertices
+)
+{
+    float distance = triangle_intersection (triangles + primitive, vertices, ray);
+    return (Intersection) {primitive, distance, distance > EPSILON};
+}
+
 VolumeType air_attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT);
 VolumeType air_attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT)
 {
@@ -314,10 +355,34 @@ kernel void raytrace
 ,   global unsigned long * image_source_index
 ,   unsigned long outputOffset
 ,   VolumeType AIR_COEFFICIENT
+,   global uint * paths
+,   unsigned long revalidate
+,   float max_time
+#ifdef RAY_STATISTICS
+,   global RayStatistics * statistics
+#endif
 )
 {
     size_t i = get_global_id (0);
 
+#ifdef RAY_STATISTICS
+    RayStatistics stats = {0, 0, 0, 0, 0, 0, 0};
+#endif
+
+    //  paths holds the triangle (plus one) hit at each bounce of the previous
+    //  trace of this ray, or zero where it escaped.
+    //  If revalidate is less than outputOffset, that path is reused: the
+    //  first revalidate bounces are traced against the whole scene, and later
+    //  bounces only check the triangle hit last time.
+    //  This is exact when the source hasn't moved (revalidate is zero), as
+    //  the ray is the same as last time.
+    //  Otherwise it is an approximation, because a nearer triangle on a
+    //  reused bounce is never tested.
+    //  Once a bounce misses its cached triangle, the rest of the ray is
+    //  traced from scratch.
+    //  Either way, the path taken this time is written back.
+    bool pathValid = revalidate < outputOffset;
+
     //  This is really a recursive algorithm, but I've implemented it
     //  iteratively.
     //  These variables will be updated as the ray is traced.
@@ -332,6 +397,8 @@ kernel void raytrace
     TriangleVerts prev_primitives [NUM_IMAGE_SOURCE - 1];
     float3 mic_reflection = position;
 
+    COUNT (shadow_rays, 1);
+    COUNT (triangle_tests, numtriangles);
     if
     (   point_intersection
         (   source
@@ -358,23 +425,59 @@ kernel void raytrace
 
     for (unsigned long index = 0; index != outputOffset; ++index)
     {
-        //  Check for an intersection between the current ray and all the
-        //  scene geometry.
-        Intersection closest = ray_triangle_intersection
-        (   &ray
-        ,   triangles
-        ,   numtriangles
-        ,   vertices
-        );
+        const size_t PATH_INDEX = i * outputOffset + index;
+        const uint CACHED = paths [PATH_INDEX];
+
+        Intersection closest = {0, 0, false};
+        bool reused = false;
+        if (pathValid && index >= revalidate)
+        {
+            //  The ray escaped here last time, so assume it still does.
+            if (CACHED == 0)
+            {
+                COUNT (escaped, 1);
+                break;
+            }
+
+            COUNT (triangle_tests, 1);
+            closest = cached_triangle_intersection
+            (   &ray
+            ,   triangles
+            ,   CACHED - 1
+            ,   vertices
+            );
+            reused = closest.intersects;
+            COUNT (reused_bounces, reused);
+        }
+
+        if (! reused)
+        {
+            //  Check for an intersection between the current ray and all the
+            //  scene geometry.
+            COUNT (bounce_rays, 1);
+            COUNT (triangle_tests, numtriangles);
+            closest = ray_triangle_intersection
+            (   &ray
+            ,   triangles
+            ,   numtriangles
+            ,   vertices
+            );
+        }
+
+        const uint HIT = closest.intersects ? closest.primitive + 1 : 0;
+        pathValid = pathValid && HIT == CACHED;
+        paths [PATH_INDEX] = HIT;
 
         //  If there's no intersection, the ray's somehow shot into empty space
         //  and we should stop tracing.
         if (! closest.intersects)
         {
+            COUNT (escaped, 1);
             break;
         }
 
         global Triangle * triangle = triangles + closest.primitive;
+        VolumeType newVol = -volume * surfaces [triangle->surface].specular;
 
         if (index < NUM_IMAGE_SOURCE - 1)
         {
@@ -400,6 +503,7 @@ kernel void raytrace
             float3 prevIntersection = source;
             for (unsigned long k = 0; k != index + 1 && intersects; ++k)
             {
+                COUNT (triangle_tests, 1);
                 const float TO_INTERSECTION = triangle_vert_intersection (prev_primitives + k, &toMic);
 
                 if (TO_INTERSECTION <= EPSILON)
@@ -415,6 +519,8 @@ kernel void raytrace
                 }
 
                 Ray intermediate = {prevIntersection, getDirection (prevIntersection, intersectionPoint)};
+                COUNT (image_source_casts, 1);
+                COUNT (triangle_tests, numtriangles);
                 Intersection inter = ray_triangle_intersection
                 (   &intermediate
                 ,   triangles
@@ -430,6 +536,8 @@ kernel void raytrace
 
             if (intersects)
             {
+                COUNT (image_source_casts, 1);
+                COUNT (triangle_tests, numtriangles);
                 intersects = point_intersection
                 (   prevIntersection
                 ,   position
@@ -449,7 +557,7 @@ kernel void raytrace
                 ,   image_source_index
                 ,   i
                 ,   index + 1
-                ,   volume
+                ,   newVol
                 ,   closest.primitive + 1
                 ,   AIR_COEFFICIENT
                 );
@@ -458,8 +566,9 @@ kernel void raytrace
 
         float3 intersection = ray.position + ray.direction * closest.distance;
         float newDist = distance + closest.distance;
-        VolumeType newVol = -volume * surfaces [triangle->surface].specular;
 
+        COUNT (shadow_rays, 1);
+        COUNT (triangle_tests, numtriangles);
         const bool IS_INTERSECTION = point_intersection
         (   intersection
         ,   position
@@ -499,7 +608,271 @@ kernel void raytrace
         ray = newRay;
         distance = newDist;
         volume = newVol;
+
+        COUNT (bounces, 1);
+
+        //  Every later impulse of this ray arrives after max_time, so once
+        //  the image-source bounces are done it needn't be traced further.
+        //  The rest of its path is cached as escaped, so that a reused path
+        //  stops here too.
+        if
+        (   NUM_IMAGE_SOURCE - 1 <= index + 1
+        &&  max_time < SECONDS_PER_METER * distance
+        )
+        {
+            if (index + 1 != outputOffset)
+                paths [PATH_INDEX + 1] = 0;
+            break;
+        }
+    }
+
+#ifdef RAY_STATISTICS
+    statistics [i] = stats;
+#endif
+}
+
+TriangleVerts triangle_verts (global Triangle * triangle, global float3 * vertices);
+TriangleVerts triangle_verts (global Triangle * triangle, global float3 * vertices)
+{
+    return (TriangleVerts)
+    {   vertices [triangle->v0]
+    ,   vertices [triangle->v1]
+    ,   vertices [triangle->v2]
+    };
+}
+
+//  Is any vertex of t more than offset in front of the plane through point
+//  with the given normal?
+bool any_in_front (float3 normal, float3 point, TriangleVerts * t, float offset);
+bool any_in_front (float3 normal, float3 point, TriangleVerts * t, float offset)
+{
+    return
+    (   dot (normal, t->v0 - point) > offset
+    ||  dot (normal, t->v1 - point) > offset
+    ||  dot (normal, t->v2 - point) > offset
+    );
+}
+
+//  Reflections from the aperture triangle appear to come from the apex, so
+//  they form a beam through the aperture, away from the apex.
+//  Returns false if t lies completely outside that beam, and so can't be the
+//  next reflector.
+//  The test is conservative: triangles which pass it may still miss the beam
+//  (by passing outside one of its corners, for example), in which case their
+//  paths are rejected during validation.
+bool beam_intersects (float3 apex, TriangleVerts * aperture, TriangleVerts * t);
+bool beam_intersects (float3 apex, TriangleVerts * aperture, TriangleVerts * t)
+{
+    //  The beam starts at the aperture, so t must be at least partly beyond
+    //  it.
+    //  This also rejects triangles in the same plane as the aperture.
+    float3 normal = triangle_verts_normal (aperture);
+    if (dot (normal, apex - aperture->v0) > 0)
+        normal = -normal;
+    if (! any_in_front (normal, aperture->v0, t, EPSILON))
+        return false;
+
+    const float3 corners [3] = {aperture->v0, aperture->v1, aperture->v2};
+    for (int i = 0; i != 3; ++i)
+    {
+        //  Each side of the beam is the plane through the apex and an edge of
+        //  the aperture, facing inwards.
+        float3 side = normalize
+        (   cross (corners [i] - apex, corners [(i + 1) % 3] - apex)
+        );
+        if (dot (side, corners [(i + 2) % 3] - apex) < 0)
+            side = -side;
+        if (! any_in_front (side, apex, t, -EPSILON))
+            return false;
+    }
+
+    return true;
+}
+
+//  Unlike point_intersection, ignores triangles touching either end of the
+//  segment, which will usually be the reflectors the segment joins.
+bool segment_visible
+(   float3 begin
+,   float3 end
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+);
+bool segment_visible
+(   float3 begin
+,   float3 end
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+)
+{
+    const float mag = length (end - begin);
+    Ray ray = {begin, (end - begin) / mag};
+
+    for (unsigned long i = 0; i != numtriangles; ++i)
+    {
+        const float distance = triangle_intersection (triangles + i, vertices, &ray);
+        if (EPSILON < distance && distance < mag - EPSILON)
+            return false;
+    }
+
+    return true;
+}
+
+//  Extends image sources by one reflection.
+//  Coplanar triangles mirror an image to the same place, so images are
+//  extended by planes rather than by triangles, and each plane lists the
+//  triangles lying in it.
+//  There is one work-item for every pair of an image source (the source
+//  mirrored in a sequence of planes) and a plane.
+//  previous holds the last plane (plus one) of each image's sequence, or
+//  zero for the source itself.
+//  The image is mirrored in the plane, unless none of its triangles can be
+//  the next reflector in the sequence, or the new image is too far from the
+//  mic for any path through it to arrive in time.
+kernel void image_source_extend
+(   global float3 * images
+,   global uint * previous
+,   global Triangle * triangles
+,   global uint * plane_offsets
+,   global uint * plane_triangles
+,   unsigned long numplanes
+,   global float3 * vertices
+,   float3 mic
+,   float max_distance
+,   global float3 * extended
+,   global uchar * valid
+)
+{
+    size_t i = get_global_id (0);
+    const size_t IMAGE = i / numplanes;
+    const unsigned long PLANE = i % numplanes;
+    const uint PREVIOUS = previous [IMAGE];
+
+    valid [i] = 0;
+
+    //  A plane can't reflect the same sound twice in a row.
+    if (PREVIOUS == PLANE + 1)
+        return;
+
+    global uint * members = plane_triangles + plane_offsets [PLANE];
+    const uint NUM_MEMBERS = plane_offsets [PLANE + 1] - plane_offsets [PLANE];
+    TriangleVerts current = triangle_verts (triangles + members [0], vertices);
+
+    //  Images in the plane can't be reflected in it.
+    const float3 NORMAL = triangle_verts_normal (&current);
+    if (fabs (dot (NORMAL, images [IMAGE] - current.v0)) < EPSILON)
+        return;
+
+    if (PREVIOUS != 0)
+    {
+        //  The previous plane reflects a beam through each of its triangles.
+        global uint * apertures = plane_triangles + plane_offsets [PREVIOUS - 1];
+        const uint NUM_APERTURES =
+            plane_offsets [PREVIOUS] - plane_offsets [PREVIOUS - 1];
+
+        bool in_beam = false;
+        for (uint a = 0; a != NUM_APERTURES && ! in_beam; ++a)
+        {
+            TriangleVerts aperture = triangle_verts (triangles + apertures [a], vertices);
+            for (uint m = 0; m != NUM_MEMBERS && ! in_beam; ++m)
+            {
+                TriangleVerts target = triangle_verts (triangles + members [m], vertices);
+                in_beam = beam_intersects (images [IMAGE], &aperture, &target);
+            }
+        }
+
+        if (! in_beam)
+            return;
     }
+
+    //  Every path through the new image, including longer ones, is at least
+    //  as long as the straight line from the image to the mic.
+    float3 image = images [IMAGE];
+    mirror_point (&image, &current);
+    if (length (image - mic) > max_distance)
+        return;
+
+    extended [i] = image;
+    valid [i] = 1;
+}
+
+//  Checks whether there is a specular path from the source to the mic through
+//  each sequence of order planes, and finds its contribution if so.
+//  The path is traced back from the mic through the image of the source in
+//  each plane in turn, and reflects from whichever of the plane's triangles
+//  it crosses, so a path reflecting from the edge between two of them is
+//  only found once.
+//  Invalid paths produce impulses with zero volume.
+kernel void image_source_validate
+(   global uint * sequences
+,   unsigned long order
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global uint * plane_offsets
+,   global uint * plane_triangles
+,   global float3 * vertices
+,   global Surface * surfaces
+,   float3 source
+,   float3 mic
+,   VolumeType AIR_COEFFICIENT
+,   global Impulse * impulses
+)
+{
+    size_t i = get_global_id (0);
+    global uint * sequence = sequences + i * order;
+
+    float3 images [MAX_IMAGE_SOURCE_ORDER + 1];
+    images [0] = source;
+    for (unsigned long k = 0; k != order; ++k)
+    {
+        global uint * members = plane_triangles + plane_offsets [sequence [k]];
+        TriangleVerts reflector = triangle_verts (triangles + members [0], vertices);
+        images [k + 1] = images [k];
+        mirror_point (images + k + 1, &reflector);
+    }
+
+    bool valid = true;
+    VolumeType volume = 1;
+    float3 point = mic;
+    for (unsigned long k = order; k != 0 && valid; --k)
+    {
+        //  The path must cross the plane on the way to its image.
+        const uint PLANE = sequence [k - 1];
+        global uint * members = plane_triangles + plane_offsets [PLANE];
+        const uint NUM_MEMBERS = plane_offsets [PLANE + 1] - plane_offsets [PLANE];
+        const float3 TO_IMAGE = images [k] - point;
+        Ray ray = {point, normalize (TO_IMAGE)};
+
+        global Triangle * triangle = NULL;
+        float distance = 0;
+        for (uint m = 0; m != NUM_MEMBERS && triangle == NULL; ++m)
+        {
+            TriangleVerts reflector = triangle_verts (triangles + members [m], vertices);
+            distance = triangle_vert_intersection (&reflector, &ray);
+            if (EPSILON < distance && distance < length (TO_IMAGE))
+                triangle = triangles + members [m];
+        }
+        if (triangle == NULL)
+        {
+            valid = false;
+            break;
+        }
+
+        const float3 REFLECTION = point + ray.direction * distance;
+        valid = segment_visible (point, REFLECTION, triangles, numtriangles, vertices);
+        volume *= -surfaces [triangle->surface].specular;
+        point = REFLECTION;
+    }
+
+    valid = valid && segment_visible (point, source, triangles, numtriangles, vertices);
+
+    const float DIST = length (images [order] - mic);
+    impulses [i] = (Impulse)
+    {   valid ? volume * attenuation_for_distance (DIST, AIR_COEFFICIENT) : 0
+    ,   images [order]
+    ,   SECONDS_PER_METER * DIST
+    };
 }
 
 float speaker_attenuation (Speaker * speaker, float3 direction);
@@ -624,4 +997,118 @@ kernel void hrtf
     }
 }
 
+#define MAX_AMBISONIC_CHANNELS ((MAX_AMBISONIC_ORDER + 1) * (MAX_AMBISONIC_ORDER + 1))
+
+//  Real spherical harmonics up to 'order', in ACN channel order with SN3D
+//  normalisation (AmbiX).
+//  The associated Legendre functions and the azimuthal terms are both built
+//  with recurrences, so every channel is produced from a single sin/cos pair.
+void spherical_harmonics
+(   float azimuth
+,   float elevation
+,   unsigned long order
+,   float * out
+);
+void spherical_harmonics
+(   float azimuth
+,   float elevation
+,   unsigned long order
+,   float * out
+)
+{
+    const float x = sin (elevation);
+    const float y = cos (elevation);
+
+    //  legendre [l * (MAX_AMBISONIC_ORDER + 1) + m], without the
+    //  Condon-Shortley phase
+    float legendre [MAX_AMBISONIC_CHANNELS];
+    float pmm = 1;
+    for (unsigned long m = 0; m <= order; ++m)
+    {
+        legendre [m * (MAX_AMBISONIC_ORDER + 1) + m] = pmm;
+        if (m < order)
+        {
+            legendre [(m + 1) * (MAX_AMBISONIC_ORDER + 1) + m] =
+                x * (2 * m + 1) * pmm;
+        }
+        for (unsigned long l = m + 2; l <= order; ++l)
+        {
+            legendre [l * (MAX_AMBISONIC_ORDER + 1) + m] =
+            (   (2 * l - 1) * x * legendre [(l - 1) * (MAX_AMBISONIC_ORDER + 1) + m]
+            -   (l + m - 1) * legendre [(l - 2) * (MAX_AMBISONIC_ORDER + 1) + m]
+            ) / (l - m);
+        }
+        pmm *= (2 * m + 1) * y;
+    }
+
+    //  cos (m * azimuth) and sin (m * azimuth) by angle addition
+    float cosm [MAX_AMBISONIC_ORDER + 1];
+    float sinm [MAX_AMBISONIC_ORDER + 1];
+    const float c1 = cos (azimuth);
+    const float s1 = sin (azimuth);
+    cosm [0] = 1;
+    sinm [0] = 0;
+    for (unsigned long m = 1; m <= order; ++m)
+    {
+        cosm [m] = cosm [m - 1] * c1 - sinm [m - 1] * s1;
+        sinm [m] = sinm [m - 1] * c1 + cosm [m - 1] * s1;
+    }
+
+    for (unsigned long l = 0; l <= order; ++l)
+    {
+        //  SN3D: sqrt ((2 - delta (m)) * (l - m)! / (l + m)!)
+        float ratio = 1;
+        out [l * l + l] = legendre [l * (MAX_AMBISONIC_ORDER + 1)];
+        for (unsigned long m = 1; m <= l; ++m)
+        {
+            ratio /= (l + m) * (l - m + 1);
+            const float n = sqrt (2 * ratio) * legendre [l * (MAX_AMBISONIC_ORDER + 1) + m];
+            out [l * l + l + m] = n * cosm [m];
+            out [l * l + l - m] = n * sinm [m];
+        }
+    }
+}
+
+kernel void ambisonic
+(   float3 mic_pos
+,   global Impulse * impulsesIn
+,   global AttenuatedImpulse * impulsesOut
+,   float3 pointing
+,   float3 up
+,   unsigned long order
+,   unsigned long numImpulses
+)
+{
+    size_t i = get_global_id (0);
+    global Impulse * thisImpulse = impulsesIn + i;
+
+    //  Rotate into the listener's frame, where x is right, y is up, and z is
+    //  forward, then find ambisonic azimuth (anticlockwise from the front) and
+    //  elevation.
+    const float3 d = transform
+    (   pointing
+    ,   up
+    ,   getDirection (mic_pos, thisImpulse->position)
+    );
+
+    float harmonics [MAX_AMBISONIC_CHANNELS];
+    spherical_harmonics
+    (   atan2 (-d.x, d.z)
+    ,   atan2 (d.y, length (d.xz))
+    ,   order
+    ,   harmonics
+    );
+
+    //  Output is channel-major, so neighbouring work-items write neighbouring
+    //  memory.
+    const unsigned long CHANNELS = (order + 1) * (order + 1);
+    for (unsigned long c = 0; c != CHANNELS; ++c)
+    {
+        impulsesOut [c * numImpulses + i] = (AttenuatedImpulse)
+        {   thisImpulse->volume * harmonics [c]
+        ,   thisImpulse->time
+        };
+    }
+}
+
 )");
@@ -0,0 +1,283 @@
+#include "late_tail.h"
+#include "clstructs.h"
+
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+/// The length of the windows over which the energy envelope is measured.
+static const float BIN_SECONDS = 0.01;
+
+/// How far the tail decays before it stops.
+static const float TAIL_RANGE_DB = 90;
+
+/// The longest tail that will be synthesized, for bands that barely decay.
+static const float MAX_TAIL_SECONDS = 30;
+
+/// One band of one channel of flattened data, which may be interleaved with
+/// other bands.
+template <typename T>
+struct Strided
+{
+    T & operator[] (size_t i) const {return data [i * stride];}
+
+    T * data;
+    size_t length;
+    size_t stride;
+};
+
+/// Fit a decay to one band of every channel.
+/// The energy of each window is summed over channels, and a line is fitted
+/// to it in dB, from the window after the loudest one up to `end`.
+static BandDecay fitDecay
+(   const vector <Strided <const float>> & channels
+,   float samplerate
+,   float end
+)
+{
+    BandDecay ret {0, vector <float> (channels.size(), 0)};
+
+    const auto BIN = max <size_t> (1, lround (BIN_SECONDS * samplerate));
+    size_t bins = 0;
+    for (const auto & i : channels)
+    {
+        const auto length = min <size_t> (i.length, end * samplerate);
+        bins = max (bins, length / BIN);
+    }
+
+    vector <vector <double>> energy (channels.size(), vector <double> (bins, 0));
+    vector <double> total (bins, 0);
+    for (auto i = 0u; i != channels.size(); ++i)
+    {
+        const auto & channel = channels [i];
+        for (auto j = 0u; j != bins && (j + 1) * BIN <= channel.length; ++j)
+        {
+            double sum = 0;
+            for (auto k = j * BIN; k != (j + 1) * BIN; ++k)
+                sum += channel [k] * channel [k];
+            energy [i] [j] = sum / BIN;
+            total [j] += energy [i] [j];
+        }
+    }
+
+    if (bins == 0)
+        return ret;
+
+    //  Least-squares fit of dB against time, skipping empty windows.
+    const size_t start =
+        max_element (total.begin(), total.end()) - total.begin() + 1;
+    auto binTime = [&] (size_t bin) {return (bin + 0.5) * BIN / samplerate;};
+
+    double n = 0, sumT = 0, sumD = 0, sumTT = 0, sumTD = 0;
+    for (auto j = start; j < bins; ++j)
+    {
+        if (total [j] <= 0)
+            continue;
+        const auto t = binTime (j);
+        const auto d = 10 * log10 (total [j]);
+        n += 1;
+        sumT += t;
+        sumD += d;
+        sumTT += t * t;
+        sumTD += t * d;
+    }
+
+    const auto denominator = n * sumTT - sumT * sumT;
+    if (n < 3 || denominator <= 0)
+        return ret;
+
+    const auto slope = (n * sumTD - sumT * sumD) / denominator;
+    if (slope >= 0)
+        return ret;
+
+    ret.slope = slope;
+
+    //  Each channel's level is the average offset of its windows from the
+    //  shared slope.
+    for (auto i = 0u; i != channels.size(); ++i)
+    {
+        double sum = 0;
+        unsigned long count = 0;
+        for (auto j = start; j < bins; ++j)
+        {
+            if (energy [i] [j] <= 0)
+                continue;
+            sum += 10 * log10 (energy [i] [j]) - slope * binTime (j);
+            count += 1;
+        }
+        ret.levels [i] =
+            count ? sum / count : -numeric_limits <float>::infinity();
+    }
+
+    return ret;
+}
+
+/// The number of samples a band needs to hold its tail.
+static size_t tailEnd
+(   const BandDecay & decay
+,   float samplerate
+,   float transition
+)
+{
+    if (decay.slope >= 0)
+        return 0;
+    const auto seconds = min (MAX_TAIL_SECONDS, TAIL_RANGE_DB / -decay.slope);
+    return ceil
+    (   (transition + max (seconds, LATE_TAIL_FADE_SECONDS)) * samplerate
+    );
+}
+
+/// Crossfade one band of one channel from the traced response to decaying
+/// noise, starting at the transition.
+/// Everything traced after the crossfade is discarded.
+static void addTail
+(   const Strided <float> & band
+,   float level
+,   const BandDecay & decay
+,   float samplerate
+,   float transition
+,   unsigned seed
+)
+{
+    if (decay.slope >= 0)
+        return;
+
+    default_random_engine engine (seed);
+    normal_distribution <float> dist;
+
+    const size_t BEGIN = ceil (transition * samplerate);
+    const auto END = tailEnd (decay, samplerate, transition);
+    const auto FADE =
+        max <size_t> (1, lround (LATE_TAIL_FADE_SECONDS * samplerate));
+
+    for (auto i = BEGIN; i < band.length; ++i)
+    {
+        //  The traced response and the noise are uncorrelated, so an
+        //  equal-power fade keeps the energy envelope smooth.
+        auto traced = 0.0f;
+        auto noise = 1.0f;
+        if (i - BEGIN < FADE)
+        {
+            const auto x = M_PI / 2 * (i - BEGIN) / FADE;
+            traced = cos (x);
+            noise = sin (x);
+        }
+
+        const auto t = float (i) / samplerate;
+        const auto amplitude =
+            i < END ? pow (10, (level + decay.slope * t) / 20) : 0;
+        band [i] = traced * band [i] + noise * amplitude * dist (engine);
+    }
+}
+
+vector <BandDecay> estimateDecay
+(   const vector <vector <float>> & flattened
+,   float samplerate
+,   float end
+)
+{
+    vector <BandDecay> ret;
+    for (auto band = 0u; band != NUM_BANDS; ++band)
+    {
+        vector <Strided <const float>> channels;
+        for (const auto & i : flattened)
+            channels.push_back ({i.data() + band, i.size() / NUM_BANDS, NUM_BANDS});
+        ret.push_back (fitDecay (channels, samplerate, end));
+    }
+    return ret;
+}
+
+vector <BandDecay> estimateDecayMultirate
+(   const vector <vector <vector <float>>> & flattened
+,   float samplerate
+,   const vector <unsigned long> & decimation
+,   float end
+)
+{
+    vector <BandDecay> ret;
+    for (auto band = 0u; band != decimation.size(); ++band)
+    {
+        vector <Strided <const float>> channels;
+        for (const auto & i : flattened)
+            channels.push_back ({i [band].data(), i [band].size(), 1});
+        ret.push_back
+        (   fitDecay (channels, samplerate / decimation [band], end)
+        );
+    }
+    return ret;
+}
+
+vector <BandDecay> synthesizeLateTail
+(   vector <vector <float>> & flattened
+,   float samplerate
+,   float transition
+)
+{
+    const auto decay = estimateDecay (flattened, samplerate, transition);
+
+    size_t length = 0;
+    for (const auto & i : decay)
+        length = max (length, tailEnd (i, samplerate, transition));
+
+    for (auto i = 0u; i != flattened.size(); ++i)
+    {
+        auto & channel = flattened [i];
+        if (channel.size() < length * NUM_BANDS)
+            channel.resize (length * NUM_BANDS, 0);
+
+        for (auto band = 0u; band != NUM_BANDS; ++band)
+        {
+            addTail
+            (   {channel.data() + band, channel.size() / NUM_BANDS, NUM_BANDS}
+            ,   decay [band].levels [i]
+            ,   decay [band]
+            ,   samplerate
+            ,   transition
+            ,   i * NUM_BANDS + band
+            );
+        }
+    }
+
+    return decay;
+}
+
+vector <BandDecay> synthesizeLateTailMultirate
+(   vector <vector <vector <float>>> & flattened
+,   float samplerate
+,   const vector <unsigned long> & decimation
+,   float transition
+)
+{
+    const auto decay = estimateDecayMultirate
+    (   flattened
+    ,   samplerate
+    ,   decimation
+    ,   transition
+    );
+
+    for (auto i = 0u; i != flattened.size(); ++i)
+    {
+        for (auto band = 0u; band != decimation.size(); ++band)
+        {
+            const auto sr = samplerate / decimation [band];
+            auto & data = flattened [i] [band];
+            const auto length = tailEnd (decay [band], sr, transition);
+            if (data.size() < length)
+                data.resize (length, 0);
+
+            addTail
+            (   {data.data(), data.size(), 1}
+            ,   decay [band].levels [i]
+            ,   decay [band]
+            ,   sr
+            ,   transition
+            ,   i * decimation.size() + band
+            );
+        }
+    }
+
+    return decay;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+/// The decay of one band of a rendered response, fitted to its energy
+/// envelope.
+struct BandDecay
+{
+    /// The decay rate, in dB per second, or zero if the band didn't have
+    /// enough energy to fit.
+    float slope;
+
+    /// For each channel, the fitted energy per sample at time zero, in dB.
+    std::vector <float> levels;
+
+    /// The time taken to decay by 60dB, or zero if there is no fit.
+    float rt60() const {return slope < 0 ? -60 / slope : 0;}
+};
+
+/// The length of the crossfade from the traced response to a synthesized
+/// tail, in seconds.
+/// Nothing traced later than this after the transition is kept.
+const float LATE_TAIL_FADE_SECONDS = 0.01;
+
+/// Fit a decay to each band of some channels of interleaved multiband data
+/// (see flattenImpulsesInterleaved), using the part of the response before
+/// `end` seconds.
+/// The decay rate is shared by every channel, but each has its own level.
+std::vector <BandDecay> estimateDecay
+(   const std::vector <std::vector <float>> & flattened
+,   float samplerate
+,   float end
+);
+
+/// Like estimateDecay, but takes bands sampled at reduced rates, as produced
+/// by flattenImpulsesMultirate.
+std::vector <BandDecay> estimateDecayMultirate
+(   const std::vector <std::vector <std::vector <float>>> & flattened
+,   float samplerate
+,   const std::vector <unsigned long> & decimation
+,   float end
+);
+
+/// Replace the late part of some channels of interleaved multiband data with
+/// a statistical reverb tail.
+///
+/// Each band's decay is estimated from the traced response before
+/// `transition` seconds, and the response after the transition is replaced
+/// by noise decaying at that rate, with a short crossfade.
+/// Once the bands are filtered, this gives band-limited decaying noise, so a
+/// hybrid render only needs to trace enough reflections to reach the
+/// transition.
+/// The tail continues until it is 90dB below its level at the transition.
+/// Bands without enough energy to fit a decay are left as they are.
+/// The noise is seeded, so renders are repeatable, but differs between
+/// channels, so they stay decorrelated.
+/// Returns the decay of each band.
+std::vector <BandDecay> synthesizeLateTail
+(   std::vector <std::vector <float>> & flattened
+,   float samplerate
+,   float transition
+);
+
+/// Like synthesizeLateTail, but takes bands sampled at reduced rates, as
+/// produced by flattenImpulsesMultirate.
+std::vector <BandDecay> synthesizeLateTailMultirate
+(   std::vector <std::vector <std::vector <float>>> & flattened
+,   float samplerate
+,   const std::vector <unsigned long> & decimation
+,   float transition
+);
@@ -0,0 +1,84 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile (const string & fname)
+:   fd (open (fname.c_str(), O_RDONLY))
+,   length (0)
+,   ptr (nullptr)
+{
+    if (fd == -1)
+        throw runtime_error ("failed to open file " + fname);
+
+    struct stat buffer;
+    if (fstat (fd, &buffer) == -1)
+    {
+        close (fd);
+        throw runtime_error ("failed to stat file " + fname);
+    }
+
+    length = buffer.st_size;
+    if (length == 0)
+    {
+        close (fd);
+        throw runtime_error ("file " + fname + " is empty");
+    }
+
+    void * p = mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close (fd);
+        throw runtime_error ("failed to map file " + fname);
+    }
+
+    ptr = static_cast <const char *> (p);
+}
+
+MappedFile::~MappedFile()
+{
+    munmap (const_cast <char *> (ptr), length);
+    close (fd);
+}
+
+WritableMappedFile::WritableMappedFile (const string & fname, size_t length)
+:   fd (open (fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644))
+,   length (length)
+,   ptr (nullptr)
+{
+    if (fd == -1)
+        throw runtime_error ("failed to create file " + fname);
+
+    if (length == 0 || ftruncate (fd, length) == -1)
+    {
+        close (fd);
+        throw runtime_error ("failed to resize file " + fname);
+    }
+
+    void * p = mmap (nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close (fd);
+        throw runtime_error ("failed to map file " + fname);
+    }
+
+    ptr = static_cast <char *> (p);
+}
+
+WritableMappedFile::~WritableMappedFile()
+{
+    munmap (ptr, length);
+    close (fd);
+}
+
+void WritableMappedFile::sync()
+{
+    if (msync (ptr, length, MS_SYNC) == -1)
+        throw runtime_error ("failed to write mapped file");
+}
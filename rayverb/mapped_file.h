@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+/// RAII wrapper around a read-only memory-mapped file.
+class MappedFile
+{
+public:
+    MappedFile (const std::string & fname);
+    virtual ~MappedFile();
+
+    MappedFile (const MappedFile &) = delete;
+    MappedFile & operator= (const MappedFile &) = delete;
+
+    const char * data() const {return ptr;}
+    size_t size() const {return length;}
+
+private:
+    int fd;
+    size_t length;
+    const char * ptr;
+};
+
+/// RAII wrapper around a writable, file-backed memory mapping.
+/// The file is created (or truncated) with a fixed size.
+/// The OS writes changes back to the file as memory fills up, so the mapping
+/// can be much larger than physical memory without swapping.
+class WritableMappedFile
+{
+public:
+    WritableMappedFile (const std::string & fname, size_t length);
+    virtual ~WritableMappedFile();
+
+    WritableMappedFile (const WritableMappedFile &) = delete;
+    WritableMappedFile & operator= (const WritableMappedFile &) = delete;
+
+    char * data() const {return ptr;}
+    size_t size() const {return length;}
+
+    /// Write all changes back to the file.
+    void sync();
+
+private:
+    int fd;
+    size_t length;
+    char * ptr;
+};
@@ -0,0 +1,313 @@
+#include "mesh_optimisation.h"
+
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+/// Triangles whose edge cross product is shorter than this always fail the
+/// determinant test in the kernel.
+/// Must match EPSILON in the kernel.
+static const float KERNEL_EPSILON = 0.0001f;
+
+typedef array <long long, 3> VertexCell;
+typedef array <cl_ulong, 3> TriangleKey;
+
+/// Hash for small fixed-size arrays of integers.
+struct ArrayHash
+{
+    template <typename T>
+    size_t operator() (const T & t) const
+    {
+        size_t ret = 0;
+        for (const auto & i : t)
+            ret = ret * 1000003 ^ hash <typename T::value_type>() (i);
+        return ret;
+    }
+};
+
+static cl_float3 sub (const cl_float3 & a, const cl_float3 & b)
+{
+    return (cl_float3) {{a.s [0] - b.s [0], a.s [1] - b.s [1], a.s [2] - b.s [2], 0}};
+}
+
+static float dot (const cl_float3 & a, const cl_float3 & b)
+{
+    return a.s [0] * b.s [0] + a.s [1] * b.s [1] + a.s [2] * b.s [2];
+}
+
+static cl_float3 cross (const cl_float3 & a, const cl_float3 & b)
+{
+    return (cl_float3) {{
+        a.s [1] * b.s [2] - a.s [2] * b.s [1],
+        a.s [2] * b.s [0] - a.s [0] * b.s [2],
+        a.s [0] * b.s [1] - a.s [1] * b.s [0],
+        0
+    }};
+}
+
+static cl_ulong & corner (Triangle & t, int i)
+{
+    return i == 0 ? t.v0 : (i == 1 ? t.v1 : t.v2);
+}
+
+static cl_ulong corner (const Triangle & t, int i)
+{
+    return i == 0 ? t.v0 : (i == 1 ? t.v1 : t.v2);
+}
+
+/// Weld each vertex to the first earlier vertex closer than `tolerance`, and
+/// point the triangles at the welded vertices.
+/// Vertices are bucketed on a grid with spacing `tolerance`, so only the
+/// vertices in the neighbouring cells need to be checked.
+static void weldVertices
+(   vector <Triangle> & triangles
+,   vector <cl_float3> & vertices
+,   float tolerance
+)
+{
+    unordered_map <VertexCell, vector <cl_ulong>, ArrayHash> cells;
+    vector <cl_ulong> remap (vertices.size());
+    vector <cl_float3> welded;
+
+    for (auto i = 0u; i != vertices.size(); ++i)
+    {
+        VertexCell cell;
+        for (auto j = 0; j != 3; ++j)
+            cell [j] = floor (vertices [i].s [j] / tolerance);
+
+        auto found = false;
+        for (auto n = 0; n != 27 && ! found; ++n)
+        {
+            const VertexCell neighbour
+            {{  cell [0] + n % 3 - 1
+            ,   cell [1] + n / 3 % 3 - 1
+            ,   cell [2] + n / 9 - 1
+            }};
+            const auto j = cells.find (neighbour);
+            if (j == cells.end())
+                continue;
+
+            for (auto k : j->second)
+            {
+                const auto offset = sub (vertices [i], welded [k]);
+                if (dot (offset, offset) < tolerance * tolerance)
+                {
+                    remap [i] = k;
+                    found = true;
+                    break;
+                }
+            }
+        }
+
+        if (! found)
+        {
+            remap [i] = welded.size();
+            cells [cell].push_back (welded.size());
+            welded.push_back (vertices [i]);
+        }
+    }
+
+    for (auto && i : triangles)
+        for (auto j = 0; j != 3; ++j)
+            corner (i, j) = remap [corner (i, j)];
+
+    vertices = move (welded);
+}
+
+static bool degenerate (const Triangle & t, const vector <cl_float3> & vertices)
+{
+    if (t.v0 == t.v1 || t.v1 == t.v2 || t.v2 == t.v0)
+        return true;
+
+    const auto normal = cross
+    (   sub (vertices [t.v1], vertices [t.v0])
+    ,   sub (vertices [t.v2], vertices [t.v0])
+    );
+    return sqrt (dot (normal, normal)) < KERNEL_EPSILON;
+}
+
+/// Does `v` lie on the segment between `a` and `b`, but not at either end?
+static bool between
+(   const cl_float3 & a
+,   const cl_float3 & v
+,   const cl_float3 & b
+,   float tolerance
+)
+{
+    const auto ab = sub (b, a);
+    const auto av = sub (v, a);
+    const auto length2 = dot (ab, ab);
+    if (length2 == 0)
+        return false;
+
+    const auto t = dot (av, ab) / length2;
+    if (t <= 0 || 1 <= t)
+        return false;
+
+    const auto offset = cross (av, ab);
+    return dot (offset, offset) <= tolerance * tolerance * length2;
+}
+
+/// Merge pairs of triangles (a, b, v) and (a, v, d) where v lies between b
+/// and d, into the single triangle (a, b, d).
+/// Returns the number of triangles removed.
+static unsigned long mergeTriangles
+(   vector <Triangle> & triangles
+,   const vector <cl_float3> & vertices
+,   float tolerance
+)
+{
+    unsigned long ret = 0;
+
+    for (auto changed = true; changed;)
+    {
+        changed = false;
+
+        unordered_map <TriangleKey, vector <unsigned long>, ArrayHash> edges;
+        for (auto i = 0u; i != triangles.size(); ++i)
+        {
+            for (auto j = 0; j != 3; ++j)
+            {
+                const auto a = corner (triangles [i], j);
+                const auto b = corner (triangles [i], (j + 1) % 3);
+                edges [TriangleKey {{min (a, b), max (a, b), 0}}].push_back (i);
+            }
+        }
+
+        //  Each triangle takes part in at most one merge per pass, so the edge
+        //  map stays valid for the whole pass.
+        vector <bool> touched (triangles.size(), false);
+        vector <bool> removed (triangles.size(), false);
+
+        for (const auto & edge : edges)
+        {
+            if (edge.second.size() != 2)
+                continue;
+
+            const auto i = edge.second [0];
+            const auto j = edge.second [1];
+            if (touched [i] || touched [j])
+                continue;
+            if (triangles [i].surface != triangles [j].surface)
+                continue;
+
+            auto opposite = [&edge] (const Triangle & t)
+            {
+                for (auto k = 0; k != 3; ++k)
+                    if (corner (t, k) != edge.first [0] && corner (t, k) != edge.first [1])
+                        return corner (t, k);
+                return corner (t, 0);
+            };
+
+            const auto b = opposite (triangles [i]);
+            const auto d = opposite (triangles [j]);
+
+            for (auto k = 0; k != 3; ++k)
+            {
+                auto & v = corner (triangles [i], k);
+                if (v == b)
+                    continue;
+                if (between (vertices [b], vertices [v], vertices [d], tolerance))
+                {
+                    //  Moving v along the line from b keeps the winding.
+                    v = d;
+                    touched [i] = touched [j] = true;
+                    removed [j] = true;
+                    break;
+                }
+            }
+        }
+
+        auto out = 0u;
+        for (auto i = 0u; i != triangles.size(); ++i)
+            if (! removed [i])
+                triangles [out++] = triangles [i];
+
+        if (out != triangles.size())
+        {
+            ret += triangles.size() - out;
+            triangles.resize (out);
+            changed = true;
+        }
+    }
+
+    return ret;
+}
+
+/// Remove vertices which aren't used by any triangle, keeping the order of
+/// the rest.
+static void removeUnusedVertices
+(   vector <Triangle> & triangles
+,   vector <cl_float3> & vertices
+)
+{
+    const cl_ulong UNUSED = -1;
+    vector <cl_ulong> remap (vertices.size(), UNUSED);
+    for (const auto & i : triangles)
+        for (auto j = 0; j != 3; ++j)
+            remap [corner (i, j)] = 0;
+
+    vector <cl_float3> used;
+    for (auto i = 0u; i != vertices.size(); ++i)
+    {
+        if (remap [i] != UNUSED)
+        {
+            remap [i] = used.size();
+            used.push_back (vertices [i]);
+        }
+    }
+
+    for (auto && i : triangles)
+        for (auto j = 0; j != 3; ++j)
+            corner (i, j) = remap [corner (i, j)];
+
+    vertices = move (used);
+}
+
+MeshReduction optimiseMesh
+(   vector <Triangle> & triangles
+,   vector <cl_float3> & vertices
+,   float weldTolerance
+)
+{
+    MeshReduction ret {};
+    ret.verticesBefore = vertices.size();
+    ret.trianglesBefore = triangles.size();
+
+    weldVertices (triangles, vertices, weldTolerance);
+
+    unordered_set <TriangleKey, ArrayHash> seen;
+    auto out = 0u;
+    for (auto i = 0u; i != triangles.size(); ++i)
+    {
+        const auto & t = triangles [i];
+        if (degenerate (t, vertices))
+        {
+            ret.degenerate += 1;
+            continue;
+        }
+
+        TriangleKey key {{t.v0, t.v1, t.v2}};
+        sort (key.begin(), key.end());
+        if (! seen.insert (key).second)
+        {
+            ret.duplicate += 1;
+            continue;
+        }
+
+        triangles [out++] = t;
+    }
+    triangles.resize (out);
+
+    ret.merged = mergeTriangles (triangles, vertices, weldTolerance);
+
+    removeUnusedVertices (triangles, vertices);
+
+    ret.verticesAfter = vertices.size();
+    ret.trianglesAfter = triangles.size();
+    return ret;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "clstructs.h"
+
+#include <vector>
+
+/// Counts of what was removed by optimiseMesh.
+struct MeshReduction
+{
+    unsigned long verticesBefore;
+    unsigned long verticesAfter;
+    unsigned long trianglesBefore;
+    unsigned long trianglesAfter;
+
+    unsigned long degenerate;
+    unsigned long duplicate;
+    unsigned long merged;
+};
+
+/// Clean up a freshly-imported mesh, to save memory and intersection tests.
+///
+/// * Each vertex closer than `weldTolerance` to an earlier one is welded to
+///   it, and vertices which aren't used by any triangle are removed.
+/// * Triangles which the kernel can never hit (because they have no area)
+///   are removed.
+/// * Triangles which share all their vertices with an earlier triangle are
+///   removed.
+///   The kernel keeps the first of several equally-close hits, so this
+///   doesn't change which surface a ray sees.
+/// * Pairs of triangles with the same surface, sharing an edge, whose union
+///   is itself a triangle, are merged.
+///
+/// The surfaces covered by the mesh are unchanged, apart from vertices moving
+/// by up to `weldTolerance`.
+MeshReduction optimiseMesh
+(   std::vector <Triangle> & triangles
+,   std::vector <cl_float3> & vertices
+,   float weldTolerance = 0.00001f
+);
@@ -0,0 +1,205 @@
+#include "partitioned_convolution.h"
+
+using namespace std;
+
+/// One segment of a partitioned convolution: a run of equal-length
+/// partitions of the impulse response, convolved by overlap-save.
+class RayverbFiltering::PartitionedConvolution::Segment
+{
+public:
+    Segment
+    (   const vector <float> & ir
+    ,   unsigned long offset
+    ,   unsigned long partition
+    ,   unsigned long count
+    )
+    :   OFFSET (offset)
+    ,   PARTITION (partition)
+    ,   time (fftwf_alloc_real (2 * PARTITION))
+    ,   result (fftwf_alloc_real (2 * PARTITION))
+    ,   sum (fftwf_alloc_complex (CPLX_LENGTH))
+    ,   head (0)
+    ,   filled (0)
+    {
+        tie (r2c, c2r) = FastConvolution::sharedPlans (2 * PARTITION);
+
+        for (auto i = 0u; i != count; ++i)
+        {
+            const auto begin = min <size_t> (ir.size(), OFFSET + i * PARTITION);
+            const auto end = min <size_t> (ir.size(), begin + PARTITION);
+
+            fill (time, time + 2 * PARTITION, 0);
+            copy (ir.begin() + begin, ir.begin() + end, time);
+
+            filters.push_back (fftwf_alloc_complex (CPLX_LENGTH));
+            fftwf_execute_dft_r2c (r2c, time, filters.back());
+
+            //  Fold the inverse transform's scaling into the filter.
+            for (auto j = 0u; j != CPLX_LENGTH; ++j)
+            {
+                filters.back() [j] [0] /= 2 * PARTITION;
+                filters.back() [j] [1] /= 2 * PARTITION;
+            }
+
+            history.push_back (fftwf_alloc_complex (CPLX_LENGTH));
+            fill
+            (   reinterpret_cast <float *> (history.back())
+            ,   reinterpret_cast <float *> (history.back() + CPLX_LENGTH)
+            ,   0
+            );
+        }
+
+        fill (time, time + 2 * PARTITION, 0);
+    }
+
+    virtual ~Segment()
+    {
+        fftwf_free (time);
+        fftwf_free (result);
+        fftwf_free (sum);
+        for (auto i : filters)
+            fftwf_free (i);
+        for (auto i : history)
+            fftwf_free (i);
+    }
+
+    Segment (const Segment &) = delete;
+    Segment & operator= (const Segment &) = delete;
+
+    /// Add some input, which must not run past the end of the current
+    /// partition.
+    /// Once a whole partition of input has arrived, returns the next
+    /// PARTITION samples of this segment's output, and nullptr otherwise.
+    const float * push (const float * in, unsigned long count)
+    {
+        copy (in, in + count, time + PARTITION + filled);
+        filled += count;
+        if (filled != PARTITION)
+            return nullptr;
+
+        //  The newest input spectrum goes to the front of the delay line, and
+        //  meets the first partition of the filter.
+        fftwf_execute_dft_r2c (r2c, time, history [head]);
+
+        fill
+        (   reinterpret_cast <float *> (sum)
+        ,   reinterpret_cast <float *> (sum + CPLX_LENGTH)
+        ,   0
+        );
+        const auto COUNT = filters.size();
+        for (auto k = 0u; k != COUNT; ++k)
+        {
+            const fftwf_complex * x = history [(head + COUNT - k) % COUNT];
+            const fftwf_complex * h = filters [k];
+            for (auto i = 0u; i != CPLX_LENGTH; ++i)
+            {
+                sum [i] [0] += x [i] [0] * h [i] [0] - x [i] [1] * h [i] [1];
+                sum [i] [1] += x [i] [0] * h [i] [1] + x [i] [1] * h [i] [0];
+            }
+        }
+
+        fftwf_execute_dft_c2r (c2r, sum, result);
+
+        copy (time + PARTITION, time + 2 * PARTITION, time);
+        head = (head + 1) % COUNT;
+        filled = 0;
+
+        //  Only the second half of the transform is free of wrap-around.
+        return result + PARTITION;
+    }
+
+    const unsigned long OFFSET;
+    const unsigned long PARTITION;
+    const unsigned long CPLX_LENGTH = PARTITION + 1;
+
+private:
+    float * time;
+    float * result;
+    fftwf_complex * sum;
+    vector <fftwf_complex *> filters;
+    vector <fftwf_complex *> history;
+
+    fftwf_plan r2c;
+    fftwf_plan c2r;
+
+    unsigned long head;
+    unsigned long filled;
+};
+
+RayverbFiltering::PartitionedConvolution::PartitionedConvolution
+(   const vector <float> & ir
+,   unsigned long blockSize
+,   unsigned long partitionsPerSegment
+,   unsigned long maxPartition
+)
+:   BLOCK_SIZE (blockSize)
+,   LENGTH (ir.size())
+,   now (0)
+{
+    unsigned long offset = 0;
+    unsigned long partition = BLOCK_SIZE;
+    while (offset < ir.size())
+    {
+        //  Longer partitions are only used once they start far enough into
+        //  the impulse response for their output to be ready in time.
+        if (partition * 2 <= maxPartition && partition * 2 <= offset)
+            partition *= 2;
+
+        const auto remaining = (ir.size() - offset + partition - 1) / partition;
+        const auto count =
+            partition * 2 <= maxPartition
+        ?   min (partitionsPerSegment, remaining)
+        :   remaining;
+
+        segments.push_back
+        (   unique_ptr <Segment> (new Segment (ir, offset, partition, count))
+        );
+        offset += count * partition;
+    }
+
+    const auto lastOffset = segments.empty() ? 0 : segments.back()->OFFSET;
+    pending.resize (nextPowerOfTwo (2 * BLOCK_SIZE + lastOffset), 0);
+}
+
+RayverbFiltering::PartitionedConvolution::~PartitionedConvolution()
+{
+}
+
+vector <unsigned long>
+RayverbFiltering::PartitionedConvolution::getPartitionLengths() const
+{
+    vector <unsigned long> ret;
+    for (const auto & i : segments)
+        ret.push_back (i->PARTITION);
+    return ret;
+}
+
+void RayverbFiltering::PartitionedConvolution::process
+(   const float * in
+,   float * out
+)
+{
+    const auto MASK = pending.size() - 1;
+
+    for (const auto & i : segments)
+    {
+        const auto block = i->push (in, BLOCK_SIZE);
+        if (! block)
+            continue;
+
+        //  The segment's input partition ended with this block, and its
+        //  output starts OFFSET samples after the partition began.
+        const auto begin = now + BLOCK_SIZE - i->PARTITION + i->OFFSET;
+        for (auto j = 0u; j != i->PARTITION; ++j)
+            pending [(begin + j) & MASK] += block [j];
+    }
+
+    for (auto i = 0u; i != BLOCK_SIZE; ++i)
+    {
+        auto & sample = pending [(now + i) & MASK];
+        out [i] = sample;
+        sample = 0;
+    }
+
+    now += BLOCK_SIZE;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "filters.h"
+
+#include <vector>
+#include <memory>
+
+namespace RayverbFiltering
+{
+    /// Streaming convolution with a long impulse response, a block at a time,
+    /// with no latency beyond the block size.
+    ///
+    /// The impulse response is split into segments, each of which is
+    /// convolved by uniformly partitioned overlap-save with a frequency-domain
+    /// delay line.
+    /// The first segment uses partitions one block long, and later segments
+    /// use partitions up to twice as long as the segment before, so the long
+    /// tail of a reverb costs a few large transforms rather than many small
+    /// ones.
+    /// A segment with partitions of length L starts at least L samples into
+    /// the impulse response, so its output is always ready before it's due.
+    class PartitionedConvolution
+    {
+    public:
+        PartitionedConvolution
+        (   const vector <float> & ir
+        ,   unsigned long blockSize
+        ,   unsigned long partitionsPerSegment = 4
+        ,   unsigned long maxPartition = 16384
+        );
+        virtual ~PartitionedConvolution();
+
+        PartitionedConvolution (const PartitionedConvolution &) = delete;
+        PartitionedConvolution & operator= (const PartitionedConvolution &) = delete;
+
+        unsigned long getBlockSize() const {return BLOCK_SIZE;}
+
+        /// The length of the impulse response, which is how long the output
+        /// takes to fall silent after the input does.
+        unsigned long getLength() const {return LENGTH;}
+
+        /// The partition length of each segment, in order.
+        vector <unsigned long> getPartitionLengths() const;
+
+        /// Convolve the next block of input, writing one block of output.
+        /// in and out may alias.
+        void process (const float * in, float * out);
+
+    private:
+        class Segment;
+
+        const unsigned long BLOCK_SIZE;
+        const unsigned long LENGTH;
+        vector <unique_ptr <Segment>> segments;
+
+        /// Output accumulated ahead of time by the later segments, indexed by
+        /// absolute sample position modulo its (power of two) size.
+        vector <float> pending;
+        unsigned long now;
+    };
+}
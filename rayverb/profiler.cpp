@@ -0,0 +1,415 @@
+#include "profiler.h"
+
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+using namespace rapidjson;
+
+namespace
+{
+    struct Stage
+    {
+        string name;
+        unsigned long thread;
+        Profiler::Clock::time_point begin;
+        Profiler::Clock::time_point end;
+    };
+
+    struct PendingEvent
+    {
+        string name;
+        string category;
+        cl::Event event;
+        Profiler::Clock::time_point recorded;
+    };
+
+    /// An event with its device timings, in nanoseconds since the profiling
+    /// origin.
+    struct ResolvedEvent
+    {
+        string name;
+        string category;
+        double queued;
+        double start;
+        double end;
+    };
+
+    struct Totals
+    {
+        unsigned long count;
+        double total;
+    };
+
+    struct State
+    {
+        mutex lock;
+        bool enabled = false;
+        Profiler::Clock::time_point origin = Profiler::Clock::now();
+        vector <Stage> stages;
+        vector <PendingEvent> events;
+        map <thread::id, unsigned long> threads;
+    };
+
+    State & state()
+    {
+        static State ret;
+        return ret;
+    }
+
+    double nanoseconds (Profiler::Clock::duration d)
+    {
+        return chrono::duration <double, nano> (d).count();
+    }
+
+    /// Read the device timings of every recorded event.
+    ///
+    /// Device timestamps use their own clock, so they are lined up with host
+    /// time using the smallest gap seen between an event being queued and
+    /// being recorded on the host.
+    /// Events whose queue didn't have profiling enabled are skipped.
+    vector <ResolvedEvent> resolveEvents (State & s)
+    {
+        struct Raw
+        {
+            const PendingEvent * pending;
+            cl_ulong queued, start, end;
+        };
+
+        vector <Raw> raw;
+        for (const auto & i : s.events)
+        {
+            try
+            {
+                raw.push_back
+                (   {   &i
+                    ,   i.event.getProfilingInfo <CL_PROFILING_COMMAND_QUEUED>()
+                    ,   i.event.getProfilingInfo <CL_PROFILING_COMMAND_START>()
+                    ,   i.event.getProfilingInfo <CL_PROFILING_COMMAND_END>()
+                    }
+                );
+            }
+            catch (const cl::Error &)
+            {
+            }
+        }
+
+        auto offset = numeric_limits <double>::max();
+        for (const auto & i : raw)
+        {
+            offset = min
+            (   offset
+            ,   nanoseconds (i.pending->recorded - s.origin) - i.queued
+            );
+        }
+
+        vector <ResolvedEvent> ret;
+        for (const auto & i : raw)
+        {
+            ret.push_back
+            (   {   i.pending->name
+                ,   i.pending->category
+                ,   i.queued + offset
+                ,   i.start + offset
+                ,   i.end + offset
+                }
+            );
+        }
+        return ret;
+    }
+
+    map <string, Totals> stageTotals (const State & s)
+    {
+        map <string, Totals> ret;
+        for (const auto & i : s.stages)
+        {
+            auto & t = ret [i.name];
+            t.count += 1;
+            t.total += nanoseconds (i.end - i.begin);
+        }
+        return ret;
+    }
+
+    map <string, Totals> eventTotals (const vector <ResolvedEvent> & events)
+    {
+        map <string, Totals> ret;
+        for (const auto & i : events)
+        {
+            auto & t = ret [i.category + "/" + i.name];
+            t.count += 1;
+            t.total += i.end - i.start;
+        }
+        return ret;
+    }
+
+    template <typename W>
+    void writeTotals (W & writer, const map <string, Totals> & totals)
+    {
+        writer.StartObject();
+        for (const auto & i : totals)
+        {
+            writer.String (i.first.c_str());
+            writer.StartObject();
+            writer.String ("count");
+            writer.Uint64 (i.second.count);
+            writer.String ("total_ms");
+            writer.Double (i.second.total / 1e6);
+            writer.EndObject();
+        }
+        writer.EndObject();
+    }
+
+    void writeFile (const string & fname, const StringBuffer & buffer)
+    {
+        ofstream out (fname);
+        out << buffer.GetString() << endl;
+        if (! out)
+            throw runtime_error ("failed to write profile " + fname);
+    }
+}
+
+void Profiler::setEnabled (bool enabled)
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+    s.enabled = enabled;
+}
+
+bool Profiler::isEnabled()
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+    return s.enabled;
+}
+
+void Profiler::clear()
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+    s.origin = Clock::now();
+    s.stages.clear();
+    s.events.clear();
+}
+
+void Profiler::recordStage
+(   const string & name
+,   Clock::time_point begin
+,   Clock::time_point end
+)
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+    if (! s.enabled)
+        return;
+
+    auto thread = s.threads.insert
+    (   make_pair (this_thread::get_id(), s.threads.size())
+    ).first->second;
+    s.stages.push_back ({name, thread, begin, end});
+}
+
+void Profiler::recordEvent
+(   const string & name
+,   const string & category
+,   const cl::Event & event
+)
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+    if (! s.enabled)
+        return;
+
+    s.events.push_back ({name, category, event, Clock::now()});
+}
+
+void Profiler::writeJson (const string & fname)
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+
+    const auto events = resolveEvents (s);
+
+    StringBuffer stringBuffer;
+    PrettyWriter <StringBuffer> writer (stringBuffer);
+
+    writer.StartObject();
+
+    writer.String ("stages");
+    writer.StartArray();
+    for (const auto & i : s.stages)
+    {
+        writer.StartObject();
+        writer.String ("name");
+        writer.String (i.name.c_str());
+        writer.String ("thread");
+        writer.Uint64 (i.thread);
+        writer.String ("start_ms");
+        writer.Double (nanoseconds (i.begin - s.origin) / 1e6);
+        writer.String ("duration_ms");
+        writer.Double (nanoseconds (i.end - i.begin) / 1e6);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.String ("events");
+    writer.StartArray();
+    for (const auto & i : events)
+    {
+        writer.StartObject();
+        writer.String ("name");
+        writer.String (i.name.c_str());
+        writer.String ("category");
+        writer.String (i.category.c_str());
+        writer.String ("queued_ms");
+        writer.Double (i.queued / 1e6);
+        writer.String ("start_ms");
+        writer.Double (i.start / 1e6);
+        writer.String ("duration_ms");
+        writer.Double ((i.end - i.start) / 1e6);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.String ("stage_totals");
+    writeTotals (writer, stageTotals (s));
+
+    writer.String ("event_totals");
+    writeTotals (writer, eventTotals (events));
+
+    writer.EndObject();
+
+    writeFile (fname, stringBuffer);
+}
+
+void Profiler::writeChromeTrace (const string & fname)
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+
+    const auto events = resolveEvents (s);
+
+    StringBuffer stringBuffer;
+    Writer <StringBuffer> writer (stringBuffer);
+
+    //  Trace timestamps are in microseconds.
+    //  Host threads get their own lanes in one process, and device commands
+    //  get a lane per category in another.
+    auto writeEvent = [&writer]
+    (   const string & name
+    ,   const string & category
+    ,   unsigned long pid
+    ,   unsigned long tid
+    ,   double start
+    ,   double duration
+    )
+    {
+        writer.StartObject();
+        writer.String ("name");
+        writer.String (name.c_str());
+        writer.String ("cat");
+        writer.String (category.c_str());
+        writer.String ("ph");
+        writer.String ("X");
+        writer.String ("pid");
+        writer.Uint64 (pid);
+        writer.String ("tid");
+        writer.Uint64 (tid);
+        writer.String ("ts");
+        writer.Double (start / 1e3);
+        writer.String ("dur");
+        writer.Double (duration / 1e3);
+        writer.EndObject();
+    };
+
+    writer.StartObject();
+    writer.String ("traceEvents");
+    writer.StartArray();
+
+    for (const auto & i : s.stages)
+    {
+        writeEvent
+        (   i.name
+        ,   "host"
+        ,   0
+        ,   i.thread
+        ,   nanoseconds (i.begin - s.origin)
+        ,   nanoseconds (i.end - i.begin)
+        );
+    }
+
+    map <string, unsigned long> lanes;
+    for (const auto & i : events)
+    {
+        const auto lane = lanes.insert
+        (   make_pair (i.category, lanes.size())
+        ).first->second;
+        writeEvent (i.name, i.category, 1, lane, i.start, i.end - i.start);
+    }
+
+    writer.EndArray();
+    writer.String ("displayTimeUnit");
+    writer.String ("ms");
+    writer.EndObject();
+
+    writeFile (fname, stringBuffer);
+}
+
+void Profiler::printSummary (ostream & os)
+{
+    auto & s = state();
+    lock_guard <mutex> lock (s.lock);
+
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+
+    auto print = [&os] (const map <string, Totals> & totals)
+    {
+        for (const auto & i : totals)
+        {
+            os
+            <<  "    "
+            <<  left << setw (32) << i.first
+            <<  right << setw (12) << fixed << setprecision (3)
+            <<  i.second.total / 1e6 << " ms"
+            <<  " (" << i.second.count << ")"
+            <<  endl;
+        }
+    };
+
+    os << "Host stages:" << endl;
+    print (stageTotals (s));
+
+    const auto events = resolveEvents (s);
+    if (! events.empty())
+    {
+        os << "Device commands:" << endl;
+        print (eventTotals (events));
+    }
+
+    os.flags (flags);
+    os.precision (precision);
+}
+
+ScopedStage::ScopedStage (const string & name)
+:   name (name)
+,   enabled (Profiler::isEnabled())
+{
+    if (enabled)
+        begin = Profiler::Clock::now();
+}
+
+ScopedStage::~ScopedStage()
+{
+    if (enabled)
+        Profiler::recordStage (name, begin, Profiler::Clock::now());
+}
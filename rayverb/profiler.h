@@ -0,0 +1,117 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "cl.hpp"
+
+#include <string>
+#include <chrono>
+#include <ostream>
+
+/// Collects host-side stage timings and OpenCL event timings for a run.
+///
+/// Profiling is off by default, and costs nothing until it is enabled.
+/// It should be enabled before any KernelLoader is constructed, so that
+/// command queues are created with profiling support.
+class Profiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static void setEnabled (bool enabled);
+    static bool isEnabled();
+
+    /// Forget everything recorded so far.
+    static void clear();
+
+    /// Record a host-side span of work.
+    static void recordStage
+    (   const std::string & name
+    ,   Clock::time_point begin
+    ,   Clock::time_point end
+    );
+
+    /// Record an OpenCL command, in a category such as "kernel" or
+    /// "transfer".
+    /// Device timings are only read when a report is written, so this never
+    /// blocks.
+    static void recordEvent
+    (   const std::string & name
+    ,   const std::string & category
+    ,   const cl::Event & event
+    );
+
+    /// Write every recorded stage and event, plus per-name totals, as JSON.
+    static void writeJson (const std::string & fname);
+
+    /// Write everything recorded in the Chrome trace-event format, which can
+    /// be loaded into chrome://tracing or Perfetto.
+    static void writeChromeTrace (const std::string & fname);
+
+    /// Print per-name totals in a human-readable form.
+    static void printSummary (std::ostream & os);
+};
+
+/// Records the lifetime of the enclosing scope as a stage, if profiling is
+/// enabled.
+class ScopedStage
+{
+public:
+    ScopedStage (const std::string & name);
+    virtual ~ScopedStage();
+
+    ScopedStage (const ScopedStage &) = delete;
+    ScopedStage & operator= (const ScopedStage &) = delete;
+
+private:
+    std::string name;
+    bool enabled;
+    Profiler::Clock::time_point begin;
+};
+
+/// Blocking write of `count` objects to the start of a buffer, recorded as a
+/// transfer.
+template <typename T>
+inline void profiledWrite
+(   cl::CommandQueue & queue
+,   const cl::Buffer & buffer
+,   const T * data
+,   size_t count
+,   const std::string & name
+)
+{
+    cl::Event event;
+    queue.enqueueWriteBuffer
+    (   buffer
+    ,   CL_TRUE
+    ,   0
+    ,   count * sizeof (T)
+    ,   data
+    ,   nullptr
+    ,   &event
+    );
+    Profiler::recordEvent (name, "transfer", event);
+}
+
+/// Blocking read of `count` objects from the start of a buffer, recorded as a
+/// transfer.
+template <typename T>
+inline void profiledRead
+(   cl::CommandQueue & queue
+,   const cl::Buffer & buffer
+,   T * data
+,   size_t count
+,   const std::string & name
+)
+{
+    cl::Event event;
+    queue.enqueueReadBuffer
+    (   buffer
+    ,   CL_TRUE
+    ,   0
+    ,   count * sizeof (T)
+    ,   data
+    ,   nullptr
+    ,   &event
+    );
+    Profiler::recordEvent (name, "transfer", event);
+}
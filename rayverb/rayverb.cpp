@@ -1,21 +1,28 @@
 #include "rayverb.h"
 #include "filters.h"
 #include "config.h"
+#include "scene_cache.h"
+#include "mesh_optimisation.h"
+#include "profiler.h"
 
 #include "rapidjson/rapidjson.h"
 #include "rapidjson/error/en.h"
 #include "rapidjson/document.h"
 
 #include "assimp/Importer.hpp"
+#include "assimp/DefaultIOSystem.h"
 #include "assimp/postprocess.h"
 #include "assimp/scene.h"
 
 #include <cmath>
+#include <cstdlib>
 #include <numeric>
 #include <fstream>
 #include <streambuf>
 #include <sstream>
 #include <iomanip>
+#include <mutex>
+#include <atomic>
 
 using namespace std;
 using namespace rapidjson;
@@ -56,11 +63,14 @@ vector <vector <float>> flattenImpulses
         maxtime = max (maxtime, i.time);
     const auto MAX_SAMPLE = round (maxtime * samplerate) + 1;
 
-    //  Create somewhere to store the results.
-    vector <vector <float>> flattened
-    (   sizeof (VolumeType) / sizeof (float)
-    ,   vector <float> (MAX_SAMPLE, 0)
-    );
+    //  Create somewhere to store the results, with room for the filters to
+    //  extend each band without reallocating it.
+    vector <vector <float>> flattened (sizeof (VolumeType) / sizeof (float));
+    for (auto & band : flattened)
+    {
+        band.reserve (MAX_SAMPLE + RayverbFiltering::MAX_FILTER_TAIL);
+        band.resize (MAX_SAMPLE, 0);
+    }
 
     //  For each impulse, calculate its index, then add the impulse's volumes
     //  to the volumes already in the output array.
@@ -76,49 +86,252 @@ vector <vector <float>> flattenImpulses
     return flattened;
 }
 
-/// Sum a collection of vectors of the same length into a single vector
-vector <float> mixdown (const vector <vector <float>> & data)
+vector <vector <float>> flattenImpulsesInterleaved
+(   const vector <vector <AttenuatedImpulse>> & attenuated
+,   float samplerate
+)
 {
-    vector <float> ret (data.front().size(), 0);
-    for (auto && i : data)
-        transform
-        (   ret.begin()
-        ,   ret.end()
-        ,   i.begin()
-        ,   ret.begin()
-        ,   plus <float>()
-        );
-    return ret;
+    vector <vector <float>> flattened (attenuated.size());
+    transform
+    (   begin (attenuated)
+    ,   end (attenuated)
+    ,   begin (flattened)
+    ,   [samplerate] (const auto & i)
+        {
+            return flattenImpulsesInterleaved (i, samplerate);
+        }
+    );
+    return flattened;
 }
 
-/// Find the index of the last sample with an amplitude of minVol or higher,
-/// then resize the vectors down to this length.
-void trimTail (vector <vector <float>> & audioChannels, float minVol)
-{
-    // Find last index of required amplitude or greater.
-    auto len = accumulate
-    (   audioChannels.begin()
-    ,   audioChannels.end()
-    ,   0
-    ,   [minVol] (long current, const auto & i)
-        {
-            return max
-            (   current
-            ,   distance
-                (   i.begin()
-                ,   find_if
-                    (   i.rbegin()
-                    ,   i.rend()
-                    ,   [minVol] (auto j) {return abs (j) >= minVol;}
-                    ).base()
-                ) - 1
-            );
+/// Like flattenImpulses, but all the bands of a sample are stored next to
+/// one another, so each impulse is added with a single contiguous write.
+vector <float> flattenImpulsesInterleaved
+(   const vector <AttenuatedImpulse> & impulse
+,   float samplerate
+)
+{
+    vector <float> flattened;
+    accumulateImpulsesInterleaved (impulse, samplerate, flattened);
+    if (flattened.empty())
+        flattened.resize (sizeof (VolumeType) / sizeof (float), 0);
+    return flattened;
+}
+
+void accumulateImpulsesInterleaved
+(   const vector <AttenuatedImpulse> & impulse
+,   float samplerate
+,   vector <float> & flattened
+)
+{
+    const auto BANDS = sizeof (VolumeType) / sizeof (float);
+
+    if (impulse.empty())
+        return;
+
+    float maxtime = 0;
+    for (const auto & i : impulse)
+        maxtime = max (maxtime, i.time);
+    const auto MAX_SAMPLE = round (maxtime * samplerate) + 1;
+
+    if (flattened.size() < MAX_SAMPLE * BANDS)
+        flattened.resize (MAX_SAMPLE * BANDS, 0);
+
+    for (const auto & i : impulse)
+    {
+        const auto SAMPLE = round (i.time * samplerate);
+        auto out = flattened.begin() + SAMPLE * BANDS;
+        for (auto j = 0; j != BANDS; ++j)
+            out [j] += i.volume.s [j];
+    }
+}
+
+vector <vector <vector <float>>> flattenImpulsesMultirate
+(   const vector <vector <AttenuatedImpulse>> & attenuated
+,   float samplerate
+,   const vector <unsigned long> & decimation
+)
+{
+    vector <vector <vector <float>>> flattened (attenuated.size());
+    transform
+    (   begin (attenuated)
+    ,   end (attenuated)
+    ,   begin (flattened)
+    ,   [samplerate, &decimation] (const auto & i)
+        {
+            return flattenImpulsesMultirate (i, samplerate, decimation);
+        }
+    );
+    return flattened;
+}
+
+vector <vector <float>> flattenImpulsesMultirate
+(   const vector <AttenuatedImpulse> & impulse
+,   float samplerate
+,   const vector <unsigned long> & decimation
+)
+{
+    const auto BANDS = sizeof (VolumeType) / sizeof (float);
+
+    float maxtime = 0;
+    for (const auto & i : impulse)
+        maxtime = max (maxtime, i.time);
+
+    vector <vector <float>> flattened (BANDS);
+    for (auto j = 0; j != BANDS; ++j)
+    {
+        const auto MAX_SAMPLE = round (maxtime * samplerate / decimation [j]) + 1;
+        flattened [j].reserve (MAX_SAMPLE + RayverbFiltering::MAX_FILTER_TAIL);
+        flattened [j].resize (MAX_SAMPLE, 0);
+    }
+
+    //  An impulse at a reduced rate stands in for a whole decimation period,
+    //  so scale it to keep the energy of the filtered band the same.
+    for (const auto & i : impulse)
+    {
+        for (auto j = 0; j != BANDS; ++j)
+        {
+            const auto SAMPLE = round (i.time * samplerate / decimation [j]);
+            flattened [j] [SAMPLE] += i.volume.s [j] / decimation [j];
+        }
+    }
+
+    return flattened;
+}
+
+/// Post-processing works on chunks of this many samples, so each thread's
+/// chunk stays in cache while it is scanned.
+static const unsigned long POSTPROCESS_CHUNK = 1 << 16;
+
+/// Call f (channel, begin, end) for every chunk of every channel, on a pool
+/// of threads.
+template <typename T>
+void forEachChunk (const vector <vector <float>> & data, const T & f)
+{
+    vector <pair <unsigned long, unsigned long>> chunks;
+    for (auto i = 0u; i != data.size(); ++i)
+        for (auto j = 0ul; j < data [i].size(); j += POSTPROCESS_CHUNK)
+            chunks.push_back (make_pair (i, j));
+
+    atomic <unsigned long> next (0);
+    runOnThreads
+    (   chunks.size()
+    ,   [&] ()
+        {
+            for (auto i = next++; i < chunks.size(); i = next++)
+            {
+                const auto channel = chunks [i].first;
+                const auto begin = chunks [i].second;
+                const auto end = min
+                (   data [channel].size()
+                ,   begin + POSTPROCESS_CHUNK
+                );
+                f (channel, begin, end);
+            }
+        }
+    );
+}
+
+float findPeak (const vector <vector <float>> & data)
+{
+    mutex m;
+    float peak = 0;
+    forEachChunk
+    (   data
+    ,   [&] (auto channel, auto begin, auto end)
+        {
+            const float * x = data [channel].data();
+            float chunkPeak = 0;
+            for (auto i = begin; i != end; ++i)
+                chunkPeak = max (chunkPeak, fabs (x [i]));
+
+            lock_guard <mutex> lock (m);
+            peak = max (peak, chunkPeak);
+        }
+    );
+    return peak;
+}
+
+void postprocess
+(   vector <vector <float>> & data
+,   bool do_normalize
+,   bool do_trim_tail
+,   float volume_scale
+,   float peak
+)
+{
+    ScopedStage stage ("postprocess");
+
+    if (do_normalize && peak <= 0)
+        peak = findPeak (data);
+
+    const auto scale = do_normalize && peak > 0
+    ?   volume_scale / peak
+    :   volume_scale;
+
+    if (scale == 1 && ! do_trim_tail)
+        return;
+
+    //  Scale each chunk, then look back from its end for the last sample
+    //  loud enough to keep, while the chunk is still in cache.
+    const auto MIN_VOL = 0.00001f;
+    mutex m;
+    unsigned long length = 0;
+    forEachChunk
+    (   data
+    ,   [&] (auto channel, auto begin, auto end)
+        {
+            float * x = data [channel].data();
+            if (scale != 1)
+            {
+                for (auto i = begin; i != end; ++i)
+                    x [i] *= scale;
+            }
+
+            if (! do_trim_tail)
+                return;
+
+            auto last = end;
+            while (last != begin && fabs (x [last - 1]) < MIN_VOL)
+                --last;
+            if (last == begin)
+                return;
+
+            lock_guard <mutex> lock (m);
+            length = max <unsigned long> (length, last);
         }
     );
 
-    // Resize.
-    for (auto && i : audioChannels)
-        i.resize (len);
+    if (do_trim_tail)
+    {
+        for (auto && i : data)
+            i.resize (min (i.size(), length));
+    }
+}
+
+/// An observer which analyses every band into decay, or none if decay is
+/// null.
+/// Each band has its own slot, so no locking is needed.
+static RayverbFiltering::BandObserver decayObserver
+(   vector <vector <DecayParameters>> * decay
+,   unsigned long channels
+)
+{
+    if (! decay)
+        return nullptr;
+
+    decay->assign (channels, vector <DecayParameters> (NUM_BANDS));
+    return [decay]
+    (   auto channel
+    ,   auto band
+    ,   auto data
+    ,   auto length
+    ,   auto stride
+    ,   auto sr
+    )
+    {
+        (*decay) [channel] [band] = analyseDecay (data, length, stride, sr);
+    };
 }
 
 /// Collects together all the post-processing steps.
@@ -130,21 +343,63 @@ vector <vector <float>> process
 ,   float lo_cutoff
 ,   bool do_trim_tail
 ,   float volume_scale
+,   vector <vector <DecayParameters>> * decay
 )
 {
-    RayverbFiltering::filter (filtertype, data, sr, lo_cutoff);
-    vector <vector <float>> ret (data.size());
-    transform (data.begin(), data.end(), ret.begin(), mixdown);
-
-    if (do_normalize)
-        normalize (ret);
-
-    if (volume_scale != 1)
-        mul (ret, volume_scale);
+    auto ret = RayverbFiltering::filterAndMix
+    (   filtertype
+    ,   data
+    ,   sr
+    ,   lo_cutoff
+    ,   decayObserver (decay, data.size())
+    );
+    postprocess (ret, do_normalize, do_trim_tail, volume_scale);
+    return ret;
+}
 
-    if (do_trim_tail)
-        trimTail (ret, 0.00001);
+vector <vector <float>> processInterleaved
+(   RayverbFiltering::FilterType filtertype
+,   vector <vector <float>> & data
+,   float sr
+,   bool do_normalize
+,   float lo_cutoff
+,   bool do_trim_tail
+,   float volume_scale
+,   vector <vector <DecayParameters>> * decay
+)
+{
+    auto ret = RayverbFiltering::filterAndMixInterleaved
+    (   filtertype
+    ,   data
+    ,   sr
+    ,   lo_cutoff
+    ,   decayObserver (decay, data.size())
+    );
+    postprocess (ret, do_normalize, do_trim_tail, volume_scale);
+    return ret;
+}
 
+vector <vector <float>> processMultirate
+(   RayverbFiltering::FilterType filtertype
+,   vector <vector <vector <float>>> & data
+,   const vector <unsigned long> & decimation
+,   float sr
+,   bool do_normalize
+,   float lo_cutoff
+,   bool do_trim_tail
+,   float volume_scale
+,   vector <vector <DecayParameters>> * decay
+)
+{
+    auto ret = RayverbFiltering::filterAndMixMultirate
+    (   filtertype
+    ,   data
+    ,   decimation
+    ,   sr
+    ,   lo_cutoff
+    ,   decayObserver (decay, data.size())
+    );
+    postprocess (ret, do_normalize, do_trim_tail, volume_scale);
     return ret;
 }
 
@@ -177,7 +432,10 @@ KernelLoader::KernelLoader(bool verbose)
     vector <cl::Device> used_devices (device.end() - 1, device.end());
 
     // Build program for this device.
-    cl_program.build (used_devices);
+    {
+        ScopedStage stage ("build_program");
+        cl_program.build (used_devices);
+    }
     cl::Device used_device = used_devices.front();
 
     if (verbose)
@@ -188,7 +446,11 @@ KernelLoader::KernelLoader(bool verbose)
     }
 
     // Set up a queue on this device.
-    queue = cl::CommandQueue (cl_context, used_device);
+    queue = cl::CommandQueue
+    (   cl_context
+    ,   used_device
+    ,   Profiler::isEnabled() ? CL_QUEUE_PROFILING_ENABLE : 0
+    );
 }
 
 /// Find the minimum and maximum boundaries of a set of vertices.
@@ -226,6 +488,141 @@ pair <cl_float3, cl_float3> getBounds
     );
 }
 
+/// Group triangles which lie in the same plane, and so mirror image sources
+/// to the same place.
+/// The triangles of plane i are members [offsets [i]] up to
+/// members [offsets [i + 1]].
+void getPlanes
+(   const vector <Triangle> & triangles
+,   const vector <cl_float3> & vertices
+,   vector <cl_uint> & offsets
+,   vector <cl_uint> & members
+)
+{
+    //  Planes are matched to within a millimetre.
+    //  They're found by hashing their equations on a grid four times coarser
+    //  than that, so a matching plane is in the same cell or, if the equation
+    //  lies near the edge of a cell, the one next to it.
+    const auto TOLERANCE = 0.001f;
+    const auto CELL = 4 * TOLERANCE;
+
+    struct Plane
+    {
+        array <float, 4> equation;
+        vector <cl_uint> triangles;
+    };
+    vector <Plane> planes;
+    map <array <long, 4>, vector <size_t>> grid;
+
+    const auto dot = [] (const auto & a, const auto & b)
+    {
+        return a [0] * b [0] + a [1] * b [1] + a [2] * b [2];
+    };
+
+    for (auto i = 0u; i != triangles.size(); ++i)
+    {
+        const array <cl_float3, 3> corners
+        {{  vertices [triangles [i].v0]
+        ,   vertices [triangles [i].v1]
+        ,   vertices [triangles [i].v2]
+        }};
+        const auto e0 = elementwise (corners [1], corners [0], minus <float>());
+        const auto e1 = elementwise (corners [2], corners [0], minus <float>());
+        array <float, 4> equation
+        {{  e0.s [1] * e1.s [2] - e0.s [2] * e1.s [1]
+        ,   e0.s [2] * e1.s [0] - e0.s [0] * e1.s [2]
+        ,   e0.s [0] * e1.s [1] - e0.s [1] * e1.s [0]
+        ,   0
+        }};
+        const auto area = sqrt (dot (equation, equation));
+        for (auto k = 0; k != 3; ++k)
+            equation [k] /= area;
+        equation [3] = dot (equation, corners [0].s);
+
+        const auto inPlane = [&] (const auto & plane)
+        {
+            return all_of
+            (   corners.begin()
+            ,   corners.end()
+            ,   [&] (const auto & v)
+                {
+                    return
+                        fabs (dot (plane.equation, v.s) - plane.equation [3])
+                    <   TOLERANCE;
+                }
+            );
+        };
+
+        //  Degenerate triangles are left in planes of their own.
+        auto found = planes.size();
+        const auto valid = area > 0 && isfinite (area);
+        for (auto sign : {1, -1})
+        {
+            if (! valid || found != planes.size())
+                break;
+
+            //  The plane may have been found facing either way.
+            array <vector <long>, 4> cells;
+            for (auto k = 0; k != 4; ++k)
+            {
+                const auto x = sign * equation [k] / CELL;
+                const auto cell = floor (x);
+                cells [k] = {long (cell)};
+                if (x - cell < 0.25f)
+                    cells [k].push_back (long (cell) - 1);
+                else if (0.75f < x - cell)
+                    cells [k].push_back (long (cell) + 1);
+            }
+
+            for (auto mask = 0u; mask != 16 && found == planes.size(); ++mask)
+            {
+                array <long, 4> key;
+                auto exists = true;
+                for (auto k = 0u; k != 4 && exists; ++k)
+                {
+                    const auto choice = (mask >> k) & 1;
+                    exists = choice < cells [k].size();
+                    if (exists)
+                        key [k] = cells [k] [choice];
+                }
+
+                const auto cell = exists ? grid.find (key) : grid.end();
+                if (cell == grid.end())
+                    continue;
+                for (auto j : cell->second)
+                {
+                    if (inPlane (planes [j]))
+                    {
+                        found = j;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (found == planes.size())
+        {
+            planes.push_back (Plane {equation, {}});
+            if (valid)
+            {
+                array <long, 4> key;
+                for (auto k = 0; k != 4; ++k)
+                    key [k] = floor (equation [k] / CELL);
+                grid [key].push_back (found);
+            }
+        }
+        planes [found].triangles.push_back (i);
+    }
+
+    offsets = {0};
+    members.clear();
+    for (const auto & i : planes)
+    {
+        members.insert (members.end(), i.triangles.begin(), i.triangles.end());
+        offsets.push_back (members.size());
+    }
+}
+
 /// Does a point fall within the cuboid defined by the point pair bounds?
 bool inside
 (   const pair <cl_float3, cl_float3> & bounds
@@ -249,6 +646,7 @@ Raytracer::Raytracer
 :   KernelLoader (verbose)
 ,   nreflections (nreflections)
 ,   ntriangles (triangles.size())
+,   nvertices (vertices.size())
 ,   cl_directions
     (   cl_context
     ,   CL_MEM_READ_WRITE
@@ -272,23 +670,28 @@ Raytracer::Raytracer
     ,   CL_MEM_READ_WRITE
     ,   RAY_GROUP_SIZE * NUM_IMAGE_SOURCE * sizeof (cl_ulong)
     )
-,   bounds (getBounds (vertices))
-,   raytrace_kernel
-    (   cl::make_kernel
-        <   cl::Buffer
-        ,   cl_float3
-        ,   cl::Buffer
-        ,   cl_ulong
-        ,   cl::Buffer
-        ,   cl_float3
-        ,   cl::Buffer
-        ,   cl::Buffer
-        ,   cl::Buffer
-        ,   cl::Buffer
-        ,   cl_ulong
-        ,   VolumeType
-        > (cl_program, "raytrace")
+,   cl_paths
+    (   cl_context
+    ,   CL_MEM_READ_WRITE
+    ,   RAY_GROUP_SIZE * nreflections * sizeof (cl_uint)
+    )
+#ifdef RAY_STATISTICS
+,   cl_statistics
+    (   cl_context
+    ,   CL_MEM_READ_WRITE
+    ,   RAY_GROUP_SIZE * sizeof (RayStatistics)
     )
+,   storedStatistics {}
+#endif
+,   bounds (getBounds (vertices))
+,   raytrace_kernel (cl_program, "raytrace")
+,   image_source_extend_kernel (cl_program, "image_source_extend")
+,   image_source_validate_kernel (cl_program, "image_source_validate")
+,   cachePaths (false)
+,   revalidateBounces (0)
+,   rayMaxTime (numeric_limits <float>::infinity())
+,   imageSourceOrder (0)
+,   imageSourceMaxTime (numeric_limits <float>::infinity())
 {
 }
 
@@ -298,16 +701,100 @@ struct Raytracer::SceneData
 public:
     SceneData (const string & objpath, const string & materialFileName, bool verbose)
     {
-        populate (objpath, materialFileName, verbose);
+        ScopedStage stage ("load_scene");
+
+        //  The cache is an optimisation, so if the inputs can't be hashed
+        //  just import normally and let that report any problems.
+        const auto cacheName = SceneCache::path (objpath, materialFileName);
+        auto inputs = cacheName.empty()
+            ?   vector <string>()
+            :   SceneCache::inputs (cacheName);
+        if (! inputs.empty() && loadCache (cacheName, inputs, materialFileName))
+        {
+            if (verbose)
+            {
+                cerr
+                <<  "Loaded cached 3D model with "
+                <<  triangles.size()
+                <<  " triangles from "
+                <<  cacheName
+                <<  endl;
+            }
+            return;
+        }
+
+        triangles.clear();
+        vertices.clear();
+        surfaces.clear();
+
+        populate (objpath, materialFileName, verbose, inputs);
+
+        const auto reduction = optimiseMesh (triangles, vertices);
+        if (verbose)
+        {
+            cerr
+            <<  "Optimised 3D model: "
+            <<  reduction.verticesBefore << " -> "
+            <<  reduction.verticesAfter << " vertices, "
+            <<  reduction.trianglesBefore << " -> "
+            <<  reduction.trianglesAfter << " triangles ("
+            <<  reduction.degenerate << " degenerate, "
+            <<  reduction.duplicate << " duplicate, "
+            <<  reduction.merged << " merged)"
+            <<  endl;
+        }
+
+        if (! cacheName.empty())
+        {
+            try
+            {
+                auto hashed = inputs;
+                hashed.push_back (materialFileName);
+                SceneCache::write
+                (   cacheName
+                ,   SceneCache::hashFiles (hashed)
+                ,   inputs
+                ,   triangles
+                ,   vertices
+                ,   surfaces
+                );
+            }
+            catch (const runtime_error &)
+            {
+                //  An input went missing, so there's nothing to key on.
+            }
+        }
     }
 
-    map <string, Surface> extractSurfaces (const string & materialFileName)
+    /// Load a cache if every file it was imported from, and the material
+    /// file, are unchanged.
+    bool loadCache
+    (   const string & cacheName
+    ,   vector <string> inputs
+    ,   const string & materialFileName
+    )
     {
-        Document document;
-        attemptJsonParse (materialFileName, document);
-        if (! document.IsObject())
-            throw runtime_error ("Materials must be stored in a JSON object");
+        try
+        {
+            inputs.push_back (materialFileName);
+            return
+                SceneCache::load
+                (   cacheName
+                ,   SceneCache::hashFiles (inputs)
+                ,   triangles
+                ,   vertices
+                ,   surfaces
+                )
+            &&  valid();
+        }
+        catch (const runtime_error &)
+        {
+            return false;
+        }
+    }
 
+    map <string, Surface> extractSurfaces (const Document & document)
+    {
         map <string, Surface> ret;
         for
         (   auto i = document.MemberBegin()
@@ -334,8 +821,10 @@ public:
             throw runtime_error ("Failed to load object file.");
 
         Surface defaultSurface = {
-            (VolumeType) {{0.92, 0.92, 0.93, 0.93, 0.94, 0.95, 0.95, 0.95}},
-            (VolumeType) {{0.50, 0.90, 0.95, 0.95, 0.95, 0.95, 0.95, 0.95}}
+            fromOctaveBands
+            ((cl_float8) {{0.92, 0.92, 0.93, 0.93, 0.94, 0.95, 0.95, 0.95}}),
+            fromOctaveBands
+            ((cl_float8) {{0.50, 0.90, 0.95, 0.95, 0.95, 0.95, 0.95, 0.95}})
         };
 
         surfaces.push_back (defaultSurface);
@@ -345,7 +834,7 @@ public:
         if (! document.IsObject())
             throw runtime_error ("Materials must be stored in a JSON object");
 
-        auto surfaceMap = extractSurfaces (materialFileName);
+        auto surfaceMap = extractSurfaces (document);
         map <string, int> materialIndices;
         for (const auto & i : surfaceMap)
         {
@@ -378,26 +867,15 @@ public:
                 cerr << "    Material name: " << matName.C_Str() << endl;
 
                 cerr << "    Material properties: " << endl;
-                cerr << "        specular: ["
-                     << surface.specular.s [0] << ", "
-                     << surface.specular.s [1] << ", "
-                     << surface.specular.s [2] << ", "
-                     << surface.specular.s [3] << ", "
-                     << surface.specular.s [4] << ", "
-                     << surface.specular.s [5] << ", "
-                     << surface.specular.s [6] << ", "
-                     << surface.specular.s [7] << "]"
-                     << endl;
-                cerr << "        diffuse: ["
-                     << surface.diffuse.s [0] << ", "
-                     << surface.diffuse.s [1] << ", "
-                     << surface.diffuse.s [2] << ", "
-                     << surface.diffuse.s [3] << ", "
-                     << surface.diffuse.s [4] << ", "
-                     << surface.diffuse.s [5] << ", "
-                     << surface.diffuse.s [6] << ", "
-                     << surface.diffuse.s [7] << "]"
-                     << endl;
+                const auto print = [] (const auto & name, const auto & volume)
+                {
+                    cerr << "        " << name << ": [";
+                    for (auto i = 0u; i != NUM_BANDS; ++i)
+                        cerr << (i ? ", " : "") << volume.s [i];
+                    cerr << "]" << endl;
+                };
+                print ("specular", surface.specular);
+                print ("diffuse", surface.diffuse);
             }
 
             vector <cl_float3> meshVertices (mesh->mNumVertices);
@@ -444,23 +922,62 @@ public:
         }
     }
 
-    void populate (const string & objpath, const string & materialFileName, bool verbose)
+    /// Passes file access through to Assimp's default IO system, and notes
+    /// the absolute name of every file the importer tries to open, so that
+    /// the scene cache can check all of them.
+    /// Files that couldn't be opened are noted too, so that the scene isn't
+    /// cached without them.
+    class RecordingIOSystem: public Assimp::DefaultIOSystem
     {
-        Assimp::Importer importer;
-        populate
-        (   importer.ReadFile
-            (   objpath
-            ,   (   aiProcess_Triangulate
-                |   aiProcess_GenSmoothNormals
-                |   aiProcess_FlipUVs
-                )
-            )
-        ,   materialFileName
-        ,   verbose
-        );
-    }
+    public:
+        RecordingIOSystem (vector <string> & opened)
+        :   opened (opened)
+        {
+        }
 
-    bool validSurfaces()
+        virtual Assimp::IOStream * Open (const char * fname, const char * mode)
+        {
+            string name (fname);
+            const auto resolved = realpath (fname, nullptr);
+            if (resolved)
+            {
+                name = resolved;
+                free (resolved);
+            }
+            if (find (opened.begin(), opened.end(), name) == opened.end())
+                opened.push_back (name);
+
+            return DefaultIOSystem::Open (fname, mode);
+        }
+
+    private:
+        vector <string> & opened;
+    };
+
+    /// Import a model, filling opened with every file the importer read.
+    void populate
+    (   const string & objpath
+    ,   const string & materialFileName
+    ,   bool verbose
+    ,   vector <string> & opened
+    )
+    {
+        opened.clear();
+
+        Assimp::Importer importer;
+        //  The importer owns its IO system.
+        importer.SetIOHandler (new RecordingIOSystem (opened));
+        populate
+        (   importer.ReadFile
+            (   objpath
+            ,   aiProcess_Triangulate | aiProcess_FlipUVs
+            )
+        ,   materialFileName
+        ,   verbose
+        );
+    }
+
+    bool validSurfaces()
     {
         for (const auto & s : surfaces)
         {
@@ -535,6 +1052,23 @@ Raytracer::Raytracer
 {
 }
 
+/// The air absorption coefficient of each band, per metre.
+static VolumeType airCoefficient()
+{
+    return fromOctaveBands
+    (   (cl_float8)
+        {{  0.001 * -0.1
+        ,   0.001 * -0.2
+        ,   0.001 * -0.5
+        ,   0.001 * -1.1
+        ,   0.001 * -2.7
+        ,   0.001 * -9.4
+        ,   0.001 * -29.0
+        ,   0.001 * -60.0
+        }}
+    );
+}
+
 void Raytracer::raytrace
 (   const cl_float3 & micpos
 ,   const cl_float3 & source
@@ -583,40 +1117,137 @@ void Raytracer::raytrace
     }
 
     imageSourceTally.clear();
-    storedDiffuse.resize (directions.size() * nreflections);
+
+    //  Cached paths can only be reused if the same rays are being traced
+    //  from the same place.
+    //  Rays start at the source, so if only the mic has moved every ray
+    //  takes the same path, and the cached paths are exact.
+    //  If the source has moved, paths are only reused (approximately) if
+    //  that has been asked for.
+    auto samePosition = [] (const cl_float3 & a, const cl_float3 & b)
+    {
+        return a.s [0] == b.s [0] && a.s [1] == b.s [1] && a.s [2] == b.s [2];
+    };
+    const auto havePaths =
+        cachePaths
+    &&  storedPaths.size() == directions.size() * nreflections
+    &&  equal
+        (   directions.begin()
+        ,   directions.end()
+        ,   storedDirections.begin()
+        ,   samePosition
+        );
+
+    //  Passing nreflections as the number of bounces to revalidate traces
+    //  every ray from scratch.
+    const cl_ulong revalidate =
+        ! havePaths
+    ?   nreflections
+    :   samePosition (source, storedSource)
+    ?   0
+    :   min <cl_ulong> (revalidateBounces, nreflections);
+    const auto reusePaths = revalidate < nreflections;
+
+    if (verbose && reusePaths)
+    {
+        cerr
+        <<  "reusing cached ray paths, revalidating "
+        <<  revalidate
+        <<  " bounces"
+        <<  endl;
+    }
+
+    if (cachePaths)
+        storedPaths.resize (directions.size() * nreflections, 0);
+
+    //  Diffuse impulses are read straight into the spill file if there is
+    //  one, so they never all have to be in memory at once.
+    unique_ptr <ImpulseSpillWriter> spill;
+    if (spillFile.empty())
+    {
+        storedDiffuse.resize (directions.size() * nreflections);
+    }
+    else
+    {
+        storedDiffuse = vector <Impulse>();
+        spill = unique_ptr <ImpulseSpillWriter>
+        (   new ImpulseSpillWriter
+            (   spillFile
+            ,   directions.size() * nreflections
+            ,   micpos
+            )
+        );
+    }
+    const auto diffuseOut = spill ? spill->data() : storedDiffuse.data();
+
+#ifdef RAY_STATISTICS
+    storedStatistics = RayStatistics {};
+#endif
     for (auto i = 0; i != ceil (directions.size() / float (RAY_GROUP_SIZE)); ++i)
     {
         auto b = i * RAY_GROUP_SIZE;
         auto e = min (directions.size(), (i + 1) * RAY_GROUP_SIZE);
 
         //  copy input to buffer
-        cl::copy
+        profiledWrite
         (   queue
-        ,   directions.begin() + b
-        ,   directions.begin() + e
         ,   cl_directions
+        ,   directions.data() + b
+        ,   e - b
+        ,   "write_directions"
         );
 
         //  zero out impulse storage memory
         vector <Impulse> diffuse
             (RAY_GROUP_SIZE * nreflections, (Impulse) {{{0}}});
-        cl::copy (queue, begin (diffuse), end (diffuse), cl_impulses);
+        profiledWrite
+        (   queue
+        ,   cl_impulses
+        ,   diffuse.data()
+        ,   diffuse.size()
+        ,   "clear_impulses"
+        );
 
         vector <Impulse> image
             (RAY_GROUP_SIZE * NUM_IMAGE_SOURCE, (Impulse) {{{0}}});
-        cl::copy (queue, begin (image), end (image), cl_image_source);
+        profiledWrite
+        (   queue
+        ,   cl_image_source
+        ,   image.data()
+        ,   image.size()
+        ,   "clear_image_source"
+        );
 
         vector <unsigned long> image_source_index
             (RAY_GROUP_SIZE * NUM_IMAGE_SOURCE, 0);
-        cl::copy
+        profiledWrite
         (   queue
-        ,   begin (image_source_index)
-        ,   end (image_source_index)
         ,   cl_image_source_index
+        ,   image_source_index.data()
+        ,   image_source_index.size()
+        ,   "clear_image_source_index"
         );
 
+        //  Work-items past the end of the directions find empty paths.
+        if (reusePaths)
+        {
+            vector <cl_uint> paths (RAY_GROUP_SIZE * nreflections, 0);
+            copy
+            (   storedPaths.begin() + b * nreflections
+            ,   storedPaths.begin() + e * nreflections
+            ,   paths.begin()
+            );
+            profiledWrite
+            (   queue
+            ,   cl_paths
+            ,   paths.data()
+            ,   paths.size()
+            ,   "write_paths"
+            );
+        }
+
         //  run kernel
-        raytrace_kernel
+        const auto event = raytrace_kernel
         (   cl::EnqueueArgs (queue, cl::NDRange (RAY_GROUP_SIZE))
         ,   cl_directions
         ,   micpos
@@ -629,28 +1260,74 @@ void Raytracer::raytrace
         ,   cl_image_source
         ,   cl_image_source_index
         ,   nreflections
-        ,   (VolumeType)
-            {{  0.001 * -0.1
-            ,   0.001 * -0.2
-            ,   0.001 * -0.5
-            ,   0.001 * -1.1
-            ,   0.001 * -2.7
-            ,   0.001 * -9.4
-            ,   0.001 * -29.0
-            ,   0.001 * -60.0
-            }}
+        ,   airCoefficient()
+        ,   cl_paths
+        ,   revalidate
+        ,   rayMaxTime
+#ifdef RAY_STATISTICS
+        ,   cl_statistics
+#endif
         );
+        Profiler::recordEvent ("raytrace", "kernel", event);
 
         //  copy output to main memory
-        cl::copy
+        profiledRead
         (   queue
         ,   cl_image_source_index
-        ,   begin (image_source_index)
-        ,   end (image_source_index)
+        ,   image_source_index.data()
+        ,   image_source_index.size()
+        ,   "read_image_source_index"
+        );
+        profiledRead
+        (   queue
+        ,   cl_image_source
+        ,   image.data()
+        ,   image.size()
+        ,   "read_image_source"
+        );
+        profiledRead
+        (   queue
+        ,   cl_impulses
+        ,   diffuseOut + b * nreflections
+        ,   (e - b) * nreflections
+        ,   "read_diffuse"
+        );
+
+        if (cachePaths)
+        {
+            profiledRead
+            (   queue
+            ,   cl_paths
+            ,   storedPaths.data() + b * nreflections
+            ,   (e - b) * nreflections
+            ,   "read_paths"
+            );
+        }
+
+#ifdef RAY_STATISTICS
+        //  Only the first (e - b) work-items traced real directions.
+        vector <RayStatistics> statistics (e - b);
+        profiledRead
+        (   queue
+        ,   cl_statistics
+        ,   statistics.data()
+        ,   statistics.size()
+        ,   "read_statistics"
         );
-        cl::copy (queue, cl_image_source, begin (image), end (image));
+        for (const auto & j : statistics)
+        {
+            storedStatistics.triangle_tests += j.triangle_tests;
+            storedStatistics.bounce_rays += j.bounce_rays;
+            storedStatistics.shadow_rays += j.shadow_rays;
+            storedStatistics.image_source_casts += j.image_source_casts;
+            storedStatistics.escaped += j.escaped;
+            storedStatistics.bounces += j.bounces;
+            storedStatistics.reused_bounces += j.reused_bounces;
+        }
+#endif
 
         //  remove duplicate image-source contributions
+        ScopedStage dedup ("dedup");
         for
         (   auto j = 0
         ;   j != RAY_GROUP_SIZE * NUM_IMAGE_SOURCE
@@ -674,18 +1351,403 @@ void Raytracer::raytrace
                 }
             }
         }
+    }
 
-        cl::copy
-        (   queue
-        ,   cl_impulses
-        ,   storedDiffuse.begin() + b * nreflections
-        ,   storedDiffuse.begin() + e * nreflections
+    if (spill)
+    {
+        ScopedStage finishSpill ("finish_spill");
+        spill->finish();
+    }
+
+    if (imageSourceOrder != 0)
+        findImageSources (micpos, source, verbose);
+
+    if (cachePaths)
+    {
+        storedDirections = directions;
+        storedSource = source;
+    }
+
+#ifdef RAY_STATISTICS
+    if (verbose)
+    {
+        const auto & t = storedStatistics;
+        const auto rays = max <size_t> (directions.size(), 1);
+        cerr
+        <<  "Ray statistics:" << endl
+        <<  "    triangle tests:     " << t.triangle_tests
+        <<  " (" << t.triangle_tests / double (rays) << " per ray)" << endl
+        <<  "    bounce rays:        " << t.bounce_rays << endl
+        <<  "    shadow rays:        " << t.shadow_rays << endl
+        <<  "    image-source casts: " << t.image_source_casts << endl
+        <<  "    escaped rays:       " << t.escaped
+        <<  " (" << 100.0 * t.escaped / rays << "%)" << endl
+        <<  "    mean bounce depth:  " << t.bounces / double (rays) << endl
+        <<  "    reused bounces:     " << t.reused_bounces << endl;
+    }
+#endif
+}
+
+#ifdef RAY_STATISTICS
+const RayStatistics & Raytracer::getStatistics() const
+{
+    return storedStatistics;
+}
+#endif
+
+void Raytracer::setPathCaching (bool enabled, unsigned long revalidateBounces)
+{
+    cachePaths = enabled;
+    this->revalidateBounces = revalidateBounces;
+    if (! enabled)
+    {
+        storedPaths = vector <cl_uint>();
+        storedDirections = vector <cl_float3>();
+    }
+}
+
+void Raytracer::setRayMaxTime (float maxTime)
+{
+    //  Cached paths end where the rays were stopped, so they can't be reused
+    //  with a different limit.
+    if (maxTime != rayMaxTime)
+        storedPaths = vector <cl_uint>();
+    rayMaxTime = maxTime;
+}
+
+void Raytracer::setImageSourceOrder (unsigned long order, float maxTime)
+{
+    if (MAX_IMAGE_SOURCE_ORDER < order)
+    {
+        throw runtime_error
+        (   "image-source order must be at most "
+        +   to_string (MAX_IMAGE_SOURCE_ORDER)
         );
     }
+    if
+    (   MAX_UNBOUNDED_IMAGE_SOURCE_ORDER < order
+    &&  ! (0 < maxTime && isfinite (maxTime))
+    )
+    {
+        throw runtime_error
+        (   "image-source orders above "
+        +   to_string (MAX_UNBOUNDED_IMAGE_SOURCE_ORDER)
+        +   " need a finite max time"
+        );
+    }
+    imageSourceOrder = order;
+    imageSourceMaxTime = maxTime;
+}
+
+void Raytracer::findPlanes()
+{
+    if (! planeOffsets.empty())
+        return;
+
+    //  Only the device keeps the model, so it is read back from there.
+    vector <Triangle> triangles (ntriangles);
+    vector <cl_float3> vertices (nvertices);
+    profiledRead
+    (   queue
+    ,   cl_triangles
+    ,   triangles.data()
+    ,   triangles.size()
+    ,   "read_triangles"
+    );
+    profiledRead
+    (   queue
+    ,   cl_vertices
+    ,   vertices.data()
+    ,   vertices.size()
+    ,   "read_vertices"
+    );
+
+    getPlanes (triangles, vertices, planeOffsets, planeTriangles);
+    cl_plane_offsets = cl::Buffer
+        (cl_context, begin (planeOffsets), end (planeOffsets), true);
+    cl_plane_triangles = cl::Buffer
+        (cl_context, begin (planeTriangles), end (planeTriangles), true);
+}
+
+void Raytracer::findImageSources
+(   const cl_float3 & micpos
+,   const cl_float3 & source
+,   bool verbose
+)
+{
+    ScopedStage stage ("image_sources");
+    findPlanes();
+
+    //  Every path up to imageSourceOrder arriving by imageSourceMaxTime is
+    //  about to be found, so the ones found by the rays are dropped.
+    //  The new ones are keyed in the same way: a zero for the direct path,
+    //  followed by each triangle plus one.
+    //  Coplanar triangles are searched together, so each plane is keyed by
+    //  its first triangle.
+    for (auto i = imageSourceTally.begin(); i != imageSourceTally.end();)
+    {
+        if
+        (   i->first.size() <= imageSourceOrder + 1
+        &&  i->second.time <= imageSourceMaxTime
+        )
+            i = imageSourceTally.erase (i);
+        else
+            ++i;
+    }
+
+    //  Each extension work-item pairs an image with a plane.
+    const auto nplanes = planeOffsets.size() - 1;
+    const auto IMAGES_PER_GROUP =
+        max <unsigned long> (1, IMAGE_SOURCE_GROUP_SIZE / nplanes);
+    const auto PAIRS_PER_GROUP = IMAGES_PER_GROUP * nplanes;
+
+    cl::Buffer cl_images
+        (cl_context, CL_MEM_READ_WRITE, IMAGES_PER_GROUP * sizeof (cl_float3));
+    cl::Buffer cl_previous
+        (cl_context, CL_MEM_READ_WRITE, IMAGES_PER_GROUP * sizeof (cl_uint));
+    cl::Buffer cl_extended
+        (cl_context, CL_MEM_READ_WRITE, PAIRS_PER_GROUP * sizeof (cl_float3));
+    cl::Buffer cl_in_beam
+        (cl_context, CL_MEM_READ_WRITE, PAIRS_PER_GROUP * sizeof (cl_uchar));
+    cl::Buffer cl_sequences
+    (   cl_context
+    ,   CL_MEM_READ_WRITE
+    ,   IMAGE_SOURCE_GROUP_SIZE * imageSourceOrder * sizeof (cl_uint)
+    );
+    cl::Buffer cl_found
+        (cl_context, CL_MEM_READ_WRITE, IMAGE_SOURCE_GROUP_SIZE * sizeof (Impulse));
+
+    const cl_float maxDistance = imageSourceMaxTime * SPEED_OF_SOUND;
+
+    //  A path through the edge between two planes is found by both of the
+    //  sequences reflecting from them in turn, and arrives from the same image
+    //  at the same time.
+    //  Unlike coplanar triangles, these sequences aren't merged before
+    //  extending, as they go on to different paths.
+    const auto DUPLICATE_DISTANCE = 0.001f;
+
+    //  The images of the current order, and the planes producing each one.
+    //  There are `order` planes per image.
+    vector <cl_float3> images {source};
+    vector <cl_uint> sequences;
+
+    unsigned long candidates = 0;
+    unsigned long found = 0;
+    for (auto order = 0ul; ! images.empty(); ++order)
+    {
+        const auto count = images.size();
+        candidates += count;
+
+        vector <Impulse> impulses (count);
+        for (auto b = 0ul; b < count; b += IMAGE_SOURCE_GROUP_SIZE)
+        {
+            const auto e = min (count, b + IMAGE_SOURCE_GROUP_SIZE);
+            if (order != 0)
+            {
+                profiledWrite
+                (   queue
+                ,   cl_sequences
+                ,   sequences.data() + b * order
+                ,   (e - b) * order
+                ,   "write_image_sequences"
+                );
+            }
+
+            const auto event = image_source_validate_kernel
+            (   cl::EnqueueArgs (queue, cl::NDRange (e - b))
+            ,   cl_sequences
+            ,   order
+            ,   cl_triangles
+            ,   ntriangles
+            ,   cl_plane_offsets
+            ,   cl_plane_triangles
+            ,   cl_vertices
+            ,   cl_surfaces
+            ,   source
+            ,   micpos
+            ,   airCoefficient()
+            ,   cl_found
+            );
+            Profiler::recordEvent ("image_source_validate", "kernel", event);
+
+            profiledRead
+            (   queue
+            ,   cl_found
+            ,   impulses.data() + b
+            ,   e - b
+            ,   "read_image_sources"
+            );
+        }
+
+        //  Keep the first valid path to each image, in order of arrival.
+        vector <size_t> paths;
+        for (auto i = 0u; i != count; ++i)
+        {
+            const auto & volume = impulses [i].volume.s;
+            if (any_of (begin (volume), end (volume), [] (auto j) {return j != 0;}))
+                paths.push_back (i);
+        }
+        stable_sort
+        (   paths.begin()
+        ,   paths.end()
+        ,   [&impulses] (auto a, auto b)
+            {
+                return impulses [a].time < impulses [b].time;
+            }
+        );
+
+        vector <size_t> kept;
+        for (auto i : paths)
+        {
+            const auto & impulse = impulses [i];
+            auto duplicate = false;
+            for
+            (   auto j = kept.rbegin()
+            ;   j != kept.rend()
+            &&  impulse.time - impulses [*j].time
+                <   DUPLICATE_DISTANCE / SPEED_OF_SOUND
+            &&  ! duplicate
+            ;   ++j
+            )
+            {
+                const auto & other = impulses [*j].position.s;
+                duplicate =
+                    sqrt
+                    (   pow (impulse.position.s [0] - other [0], 2)
+                    +   pow (impulse.position.s [1] - other [1], 2)
+                    +   pow (impulse.position.s [2] - other [2], 2)
+                    )
+                <   DUPLICATE_DISTANCE;
+            }
+            if (duplicate)
+                continue;
+
+            kept.push_back (i);
+            vector <unsigned long> surfaces {0};
+            for (auto k = 0ul; k != order; ++k)
+            {
+                surfaces.push_back
+                (planeTriangles [planeOffsets [sequences [i * order + k]]] + 1);
+            }
+            imageSourceTally [surfaces] = impulse;
+        }
+        found += kept.size();
+
+        if (order == imageSourceOrder)
+            break;
+
+        //  Extend every image by one more reflection.
+        vector <cl_float3> nextImages;
+        vector <cl_uint> nextSequences;
+        vector <cl_float3> extended (PAIRS_PER_GROUP);
+        vector <cl_uchar> inBeam (PAIRS_PER_GROUP);
+        for (auto b = 0ul; b < count; b += IMAGES_PER_GROUP)
+        {
+            const auto e = min (count, b + IMAGES_PER_GROUP);
+            const auto pairs = (e - b) * nplanes;
+
+            vector <cl_uint> previous (e - b, 0);
+            if (order != 0)
+            {
+                for (auto i = b; i != e; ++i)
+                    previous [i - b] = sequences [(i + 1) * order - 1] + 1;
+            }
+
+            profiledWrite
+            (   queue
+            ,   cl_images
+            ,   images.data() + b
+            ,   e - b
+            ,   "write_images"
+            );
+            profiledWrite
+            (   queue
+            ,   cl_previous
+            ,   previous.data()
+            ,   previous.size()
+            ,   "write_previous_triangles"
+            );
+
+            const auto event = image_source_extend_kernel
+            (   cl::EnqueueArgs (queue, cl::NDRange (pairs))
+            ,   cl_images
+            ,   cl_previous
+            ,   cl_triangles
+            ,   cl_plane_offsets
+            ,   cl_plane_triangles
+            ,   nplanes
+            ,   cl_vertices
+            ,   micpos
+            ,   maxDistance
+            ,   cl_extended
+            ,   cl_in_beam
+            );
+            Profiler::recordEvent ("image_source_extend", "kernel", event);
+
+            profiledRead
+            (   queue
+            ,   cl_in_beam
+            ,   inBeam.data()
+            ,   pairs
+            ,   "read_in_beam"
+            );
+            profiledRead
+            (   queue
+            ,   cl_extended
+            ,   extended.data()
+            ,   pairs
+            ,   "read_extended_images"
+            );
+
+            for (auto i = 0ul; i != pairs; ++i)
+            {
+                if (! inBeam [i])
+                    continue;
+
+                const auto image = b + i / nplanes;
+                nextImages.push_back (extended [i]);
+                nextSequences.insert
+                (   nextSequences.end()
+                ,   sequences.begin() + image * order
+                ,   sequences.begin() + (image + 1) * order
+                );
+                nextSequences.push_back (i % nplanes);
+            }
+        }
+
+        images = move (nextImages);
+        sequences = move (nextSequences);
+    }
+
+    if (verbose)
+    {
+        cerr
+        <<  "found "
+        <<  found
+        <<  " image sources of up to "
+        <<  imageSourceOrder
+        <<  " reflections, from "
+        <<  candidates
+        <<  " candidate paths"
+        <<  endl;
+    }
+}
+
+void Raytracer::setSpillFile (const string & fname)
+{
+    spillFile = fname;
 }
 
 RaytracerResults Raytracer::getRawDiffuse()
 {
+    if (! spillFile.empty())
+    {
+        const ImpulseSpill spill (spillFile);
+        return RaytracerResults
+        (   vector <Impulse> (spill.data(), spill.data() + spill.size())
+        ,   storedMicpos
+        );
+    }
     return RaytracerResults (storedDiffuse, storedMicpos);
 }
 
@@ -713,8 +1775,118 @@ RaytracerResults Raytracer::getAllRaw (bool removeDirect)
     return RaytracerResults (diffuse, storedMicpos);
 }
 
+void Raytracer::writeResults (const string & fname)
+{
+    vector <Impulse> direct;
+    vector <Impulse> images;
+    for (const auto & i : imageSourceTally)
+    {
+        if (i.first == vector <unsigned long> {0})
+            direct.push_back (i.second);
+        else
+            images.push_back (i.second);
+    }
+
+    if (spillFile.empty())
+    {
+        RaytracerResultsFile::write
+        (   fname
+        ,   storedMicpos
+        ,   storedDiffuse.data()
+        ,   storedDiffuse.size()
+        ,   direct
+        ,   images
+        );
+    }
+    else
+    {
+        const ImpulseSpill spill (spillFile);
+        RaytracerResultsFile::write
+        (   fname
+        ,   storedMicpos
+        ,   spill.data()
+        ,   spill.size()
+        ,   direct
+        ,   images
+        );
+    }
+}
+
+float attenuateAndFlattenInterleaved
+(   const Impulse * impulses
+,   size_t count
+,   const cl_float3 & mic
+,   const AttenuationFunction & attenuate
+,   float samplerate
+,   vector <vector <float>> & flattened
+)
+{
+    //  Small enough to keep memory use modest, large enough that the
+    //  attenuator's transfers and kernel launches are amortised.
+    const size_t CHUNK_SIZE = 1 << 18;
+
+    float predelay = 0;
+    for (size_t b = 0; b < count; b += CHUNK_SIZE)
+    {
+        const auto e = min (count, b + CHUNK_SIZE);
+        const auto attenuated = attenuate
+        (   RaytracerResults
+            (   vector <Impulse> (impulses + b, impulses + e)
+            ,   mic
+            )
+        );
+
+        if (flattened.size() < attenuated.size())
+            flattened.resize (attenuated.size());
+
+        for (auto i = 0u; i != attenuated.size(); ++i)
+        {
+            accumulateImpulsesInterleaved
+            (   attenuated [i]
+            ,   samplerate
+            ,   flattened [i]
+            );
+        }
+
+        const auto chunkPredelay = findPredelay (attenuated);
+        if (predelay == 0 || (chunkPredelay != 0 && chunkPredelay < predelay))
+            predelay = chunkPredelay;
+    }
+    return predelay;
+}
+
+void removePredelayInterleaved
+(   vector <vector <float>> & flattened
+,   float predelay
+,   float samplerate
+)
+{
+    const auto BANDS = sizeof (VolumeType) / sizeof (float);
+    const size_t SAMPLES = round (predelay * samplerate);
+    for (auto && i : flattened)
+    {
+        if (i.empty())
+            continue;
+
+        //  Keep at least one sample, as fixPredelay would.
+        const auto remove = min (SAMPLES, i.size() / BANDS - 1) * BANDS;
+        i.erase (i.begin(), i.begin() + remove);
+    }
+}
+
 HrtfAttenuator::HrtfAttenuator()
-:   cl_hrtf
+:   HrtfAttenuator ("")
+{
+
+}
+
+HrtfAttenuator::HrtfAttenuator (const string & hrtfFileName, bool verbose)
+:   hrtfFile
+    (   hrtfFileName.empty()
+    ?   nullptr
+    :   new HrtfFile (hrtfFileName, verbose)
+    )
+,   cl_hrtf
     (   cl_context
     ,   CL_MEM_READ_WRITE
     ,   sizeof (VolumeType) * 360 * 180
@@ -770,17 +1942,23 @@ vector <AttenuatedImpulse> HrtfAttenuator::attenuate
 ,   const vector <Impulse> & impulses
 )
 {
-    //  muck around with the table format
-    vector <VolumeType> hrtfChannelData (360 * 180);
-    auto offset = 0;
-    for (const auto & i : getHrtfData() [channel])
-    {
-        copy (begin (i), end (i), hrtfChannelData.begin() + offset);
-        offset += i.size();
-    }
-
-    //  copy hrtf table to buffer
-    cl::copy (queue, begin (hrtfChannelData), end (hrtfChannelData), cl_hrtf);
+    //  the table for each channel is contiguous, so with octave bands it can be
+    //  copied to the buffer directly
+    const auto & hrtfChannelData = getHrtfData() [channel];
+    const cl_float8 * hrtfBegin = hrtfChannelData.front().data();
+#if NUM_BANDS == 8
+    profiledWrite (queue, cl_hrtf, hrtfBegin, 360 * 180, "write_hrtf");
+#else
+    vector <VolumeType> converted (360 * 180);
+    transform (hrtfBegin, hrtfBegin + 360 * 180, converted.begin(), fromOctaveBands);
+    profiledWrite
+    (   queue
+    ,   cl_hrtf
+    ,   converted.data()
+    ,   converted.size()
+    ,   "write_hrtf"
+    );
+#endif
 
     //  set up buffers
     cl_in = cl::Buffer
@@ -795,10 +1973,16 @@ vector <AttenuatedImpulse> HrtfAttenuator::attenuate
     );
 
     //  copy input to buffer
-    cl::copy (queue, impulses.begin(), impulses.end(), cl_in);
+    profiledWrite
+    (   queue
+    ,   cl_in
+    ,   impulses.data()
+    ,   impulses.size()
+    ,   "write_impulses"
+    );
 
     //  run kernel
-    attenuate_kernel
+    const auto event = attenuate_kernel
     (   cl::EnqueueArgs (queue, cl::NDRange (impulses.size()))
     ,   mic_pos
     ,   cl_in
@@ -808,17 +1992,26 @@ vector <AttenuatedImpulse> HrtfAttenuator::attenuate
     ,   up
     ,   channel
     );
+    Profiler::recordEvent ("attenuate", "kernel", event);
 
     //  create output storage
     vector <AttenuatedImpulse> ret (impulses.size());
 
     //  copy to output
-    cl::copy (queue, cl_out, ret.begin(), ret.end());
+    profiledRead
+    (   queue
+    ,   cl_out
+    ,   ret.data()
+    ,   ret.size()
+    ,   "read_attenuated"
+    );
     return ret;
 }
 
-const array <array <array <cl_float8, 180>, 360>, 2> & HrtfAttenuator::getHrtfData() const
+const HrtfTable & HrtfAttenuator::getHrtfData() const
 {
+    if (hrtfFile)
+        return hrtfFile->getTable();
     return HRTF_DATA;
 }
 
@@ -872,22 +2065,129 @@ vector <AttenuatedImpulse> SpeakerAttenuator::attenuate
     );
 
     //  copy input data to buffer
-    cl::copy (queue, impulses.begin(), impulses.end(), cl_in);
+    profiledWrite
+    (   queue
+    ,   cl_in
+    ,   impulses.data()
+    ,   impulses.size()
+    ,   "write_impulses"
+    );
 
     //  run kernel
-    attenuate_kernel
+    const auto event = attenuate_kernel
     (   cl::EnqueueArgs (queue, cl::NDRange (impulses.size()))
     ,   mic_pos
     ,   cl_in
     ,   cl_out
     ,   speaker
     );
+    Profiler::recordEvent ("attenuate", "kernel", event);
 
     //  create output location
     vector <AttenuatedImpulse> ret (impulses.size());
 
     //  copy from buffer to output
-    cl::copy (queue, cl_out, ret.begin(), ret.end());
+    profiledRead
+    (   queue
+    ,   cl_out
+    ,   ret.data()
+    ,   ret.size()
+    ,   "read_attenuated"
+    );
+    return ret;
+}
+
+AmbisonicAttenuator::AmbisonicAttenuator()
+:   attenuate_kernel
+    (   cl::make_kernel
+        <   cl_float3
+        ,   cl::Buffer
+        ,   cl::Buffer
+        ,   cl_float3
+        ,   cl_float3
+        ,   cl_ulong
+        ,   cl_ulong
+        > (cl_program, "ambisonic")
+    )
+{
+
+}
+
+unsigned long AmbisonicAttenuator::numChannels (unsigned long order)
+{
+    return (order + 1) * (order + 1);
+}
+
+vector <vector <AttenuatedImpulse>> AmbisonicAttenuator::attenuate
+(   const RaytracerResults & results
+,   const AmbisonicConfig & config
+)
+{
+    if (config.order < 0 || MAX_AMBISONIC_ORDER < config.order)
+        throw runtime_error
+        (   "ambisonic order must be between 0 and "
+        +   to_string (MAX_AMBISONIC_ORDER)
+        );
+
+    const auto & impulses = results.impulses;
+    const auto CHANNELS = numChannels (config.order);
+
+    //  OpenCL rejects empty buffers and ranges.
+    if (impulses.empty())
+        return vector <vector <AttenuatedImpulse>> (CHANNELS);
+
+    //  init buffers
+    cl_in = cl::Buffer
+    (   cl_context
+    ,   CL_MEM_READ_WRITE
+    ,   impulses.size() * sizeof (Impulse)
+    );
+    cl_out = cl::Buffer
+    (   cl_context
+    ,   CL_MEM_READ_WRITE
+    ,   CHANNELS * impulses.size() * sizeof (AttenuatedImpulse)
+    );
+
+    //  copy input data to buffer
+    profiledWrite
+    (   queue
+    ,   cl_in
+    ,   impulses.data()
+    ,   impulses.size()
+    ,   "write_impulses"
+    );
+
+    //  run kernel once for all channels
+    const auto event = attenuate_kernel
+    (   cl::EnqueueArgs (queue, cl::NDRange (impulses.size()))
+    ,   results.mic
+    ,   cl_in
+    ,   cl_out
+    ,   config.facing
+    ,   config.up
+    ,   config.order
+    ,   impulses.size()
+    );
+    Profiler::recordEvent ("attenuate", "kernel", event);
+
+    //  copy each channel from buffer to output
+    vector <AttenuatedImpulse> encoded (CHANNELS * impulses.size());
+    profiledRead
+    (   queue
+    ,   cl_out
+    ,   encoded.data()
+    ,   encoded.size()
+    ,   "read_attenuated"
+    );
+
+    vector <vector <AttenuatedImpulse>> ret (CHANNELS);
+    for (auto i = 0u; i != CHANNELS; ++i)
+    {
+        ret [i].assign
+        (   encoded.begin() + i * impulses.size()
+        ,   encoded.begin() + (i + 1) * impulses.size()
+        );
+    }
     return ret;
 }
 
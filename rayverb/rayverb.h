@@ -3,6 +3,10 @@
 #include "filters.h"
 #include "clstructs.h"
 #include "generic_functions.h"
+#include "hrtf_file.h"
+#include "impulse_spill.h"
+#include "results_file.h"
+#include "decay_analysis.h"
 
 #include "rapidjson/document.h"
 
@@ -15,9 +19,16 @@
 #include <iostream>
 #include <array>
 #include <map>
+#include <memory>
+#include <functional>
+#include <limits>
 
 //#define DIAGNOSTIC
 
+//  Define RAY_STATISTICS (or configure with RAYVERB_RAY_STATISTICS=ON) to
+//  build a raytrace kernel which counts the work it does.
+//#define RAY_STATISTICS
+
 /// Sum impulses ocurring at the same (sampled) time and return a vector in
 /// which each subsequent item refers to the next sample of an impulse
 /// response.
@@ -32,8 +43,67 @@ std::vector <std::vector <std::vector <float>>> flattenImpulses
 ,   float samplerate
 );
 
+/// Sum impulses ocurring at the same (sampled) time into a single vector in
+/// which the bands of each sample are interleaved ([sample][band]).
+std::vector <float> flattenImpulsesInterleaved
+(   const std::vector <AttenuatedImpulse> & impulse
+,   float samplerate
+);
+
+/// Add impulses to existing interleaved multiband data, growing it if any
+/// impulse falls after its end.
+void accumulateImpulsesInterleaved
+(   const std::vector <AttenuatedImpulse> & impulse
+,   float samplerate
+,   std::vector <float> & flattened
+);
+
+/// Maps flattenImpulsesInterleaved over a vector of input vectors.
+std::vector <std::vector <float>> flattenImpulsesInterleaved
+(   const std::vector <std::vector <AttenuatedImpulse>> & impulse
+,   float samplerate
+);
+
+/// Like flattenImpulses, but band i is sampled at samplerate / decimation [i].
+/// Impulses are scaled down by the decimation factor, so that once the bands
+/// are filtered and upsampled they match bands flattened at the full rate.
+std::vector <std::vector <float>> flattenImpulsesMultirate
+(   const std::vector <AttenuatedImpulse> & impulse
+,   float samplerate
+,   const std::vector <unsigned long> & decimation
+);
+
+/// Maps flattenImpulsesMultirate over a vector of input vectors.
+std::vector <std::vector <std::vector <float>>> flattenImpulsesMultirate
+(   const std::vector <std::vector <AttenuatedImpulse>> & impulse
+,   float samplerate
+,   const std::vector <unsigned long> & decimation
+);
+
+/// Find the largest absolute sample value in any channel, in parallel.
+float findPeak (const std::vector <std::vector <float>> & data);
+
+/// The post-processing steps that follow filtering and mixdown.
+/// Optionally normalize all channels, scale the amplitude, and trim the
+/// quiet tail.
+/// Scaling and tail-finding happen in a single parallel pass over the data.
+/// Normalization needs the peak amplitude, which is found with an extra pass
+/// unless peak is positive, in which case it is used instead.
+/// Passing a precomputed peak allows separately processed sections of output
+/// to be normalized consistently, or written as they are produced.
+void postprocess
+(   std::vector <std::vector <float>> & data
+,   bool do_normalize
+,   bool do_trim_tail
+,   float volume_scale
+,   float peak = 0
+);
+
 /// Filter and mix down each channel of the input data.
 /// Optionally, normalize all channels, trim the tail, and scale the amplitude.
+/// If decay is given, every band of every channel is analysed (see
+/// analyseDecay) after it is filtered and before it is mixed down, in the
+/// same parallel pass, and the results are stored in it ([channel][band]).
 std::vector <std::vector <float>> process
 (   RayverbFiltering::FilterType filtertype
 ,   std::vector <std::vector <std::vector <float>>> & data
@@ -42,6 +112,34 @@ std::vector <std::vector <float>> process
 ,   float lo_cutoff
 ,   bool do_trim_tail
 ,   float volumme_scale
+,   std::vector <std::vector <DecayParameters>> * decay = nullptr
+);
+
+/// Like process, but takes channels of interleaved multiband data, as
+/// produced by flattenImpulsesInterleaved.
+std::vector <std::vector <float>> processInterleaved
+(   RayverbFiltering::FilterType filtertype
+,   std::vector <std::vector <float>> & data
+,   float sr
+,   bool do_normalize
+,   float lo_cutoff
+,   bool do_trim_tail
+,   float volumme_scale
+,   std::vector <std::vector <DecayParameters>> * decay = nullptr
+);
+
+/// Like process, but takes bands sampled at reduced rates, as produced by
+/// flattenImpulsesMultirate.
+std::vector <std::vector <float>> processMultirate
+(   RayverbFiltering::FilterType filtertype
+,   std::vector <std::vector <std::vector <float>>> & data
+,   const std::vector <unsigned long> & decimation
+,   float sr
+,   bool do_normalize
+,   float lo_cutoff
+,   bool do_trim_tail
+,   float volumme_scale
+,   std::vector <std::vector <DecayParameters>> * decay = nullptr
 );
 
 /// Recursively check a collection of Impulses for the earliest non-zero time of
@@ -123,8 +221,8 @@ public:
 struct RaytracerResults
 {
     RaytracerResults() {}
-    RaytracerResults (const std::vector <Impulse> impulses, const cl_float3 & c)
-    :   impulses (impulses)
+    RaytracerResults (std::vector <Impulse> impulses, const cl_float3 & c)
+    :   impulses (std::move (impulses))
     ,   mic (c)
     {}
 
@@ -132,6 +230,36 @@ struct RaytracerResults
     cl_float3 mic;
 };
 
+/// Converts raytrace results into channels of attenuated impulses, for
+/// example by calling one of the attenuators below.
+typedef std::function
+<   std::vector <std::vector <AttenuatedImpulse>> (const RaytracerResults &)
+> AttenuationFunction;
+
+/// Attenuate a block of raw impulses a chunk at a time, and add each chunk
+/// to channels of interleaved multiband data (see flattenImpulsesInterleaved).
+/// The impulses may be memory-mapped (see ImpulseSpill), in which case only
+/// one chunk of them has to be in memory at once.
+/// Channels are created and grown as necessary.
+/// Returns the earliest non-zero time of an attenuated impulse, or zero if
+/// there is no such impulse.
+float attenuateAndFlattenInterleaved
+(   const Impulse * impulses
+,   size_t count
+,   const cl_float3 & mic
+,   const AttenuationFunction & attenuate
+,   float samplerate
+,   std::vector <std::vector <float>> & flattened
+);
+
+/// Remove a predelay from channels of interleaved multiband data, by dropping
+/// the samples before it.
+void removePredelayInterleaved
+(   std::vector <std::vector <float>> & flattened
+,   float predelay
+,   float samplerate
+);
+
 /// An exciting raytracer.
 class Raytracer: public KernelLoader
 {
@@ -163,7 +291,65 @@ public:
     ,   bool verbose
     );
 
+    /// Write the diffuse impulses of subsequent raytraces to a memory-mapped
+    /// spill file (see ImpulseSpill) instead of keeping them in memory.
+    /// This allows traces which produce more impulses than fit in memory.
+    /// Pass an empty string to keep impulses in memory again.
+    void setSpillFile (const std::string & fname);
+
+    /// Keep the bounce path of every ray, so that a following raytrace with
+    /// the same directions can reuse the paths rather than tracing every ray
+    /// from scratch.
+    /// Rays start at the source, so if only the mic moves (such as during
+    /// interactive placement) the paths can't change, and reusing them is
+    /// exact.
+    /// If the source moves, every ray is traced in full by default.
+    /// Passing a smaller revalidateBounces trades accuracy for speed: only
+    /// the first revalidateBounces bounces of each ray are checked against
+    /// the whole scene, and later bounces only check the triangle they hit
+    /// last time, so a nearer triangle can be missed in any non-convex model.
+    /// Rays which no longer hit their cached triangle are traced from that
+    /// bounce on.
+    /// The shadow rays toward the mic, and so the visibility of every bounce,
+    /// are always traced in full.
+    void setPathCaching
+    (   bool enabled
+    ,   unsigned long revalidateBounces = std::numeric_limits <unsigned long>::max()
+    );
+
+    /// Stop tracing each ray of subsequent raytraces once its path is longer
+    /// than sound travels in `maxTime` seconds, as every later impulse of the
+    /// ray would arrive after maxTime.
+    /// The bounces along which rays find image sources are always traced.
+    /// This saves tracing reflections which will be discarded anyway, such
+    /// as those after the transition to a synthesized late tail.
+    /// Pass infinity to trace every reflection again.
+    void setRayMaxTime (float maxTime);
+
+    /// Find the image sources of subsequent raytraces up to `order`
+    /// reflections exhaustively, rather than only along the paths of traced
+    /// rays.
+    /// Every sequence of up to `order` planes is considered, pruned to those
+    /// which lie in the beam reflected by the previous plane and whose paths
+    /// could arrive before `maxTime` (in seconds), and every remaining path
+    /// is checked for occlusion.
+    /// The early reflections are then exact, however few rays are traced.
+    /// Image sources of higher orders, or arriving after maxTime, are still
+    /// found by the rays.
+    /// The work grows quickly with the order, so maxTime must be finite for
+    /// orders above MAX_UNBOUNDED_IMAGE_SOURCE_ORDER.
+    /// Pass an order of zero to only use the rays again.
+    void setImageSourceOrder
+    (   unsigned long order
+    ,   float maxTime = std::numeric_limits <float>::infinity()
+    );
+
+    /// The highest image-source order which may be searched without a time
+    /// limit.
+    static const unsigned long MAX_UNBOUNDED_IMAGE_SOURCE_ORDER = 2;
+
     /// Get raw, unprocessed diffuse results.
+    /// If a spill file is set, the impulses are read back from it.
     RaytracerResults getRawDiffuse();
 
     /// Get raw, unprocessed image-source results.
@@ -172,9 +358,20 @@ public:
     /// Get all raw, unprocessed results.
     RaytracerResults getAllRaw (bool removeDirect);
 
+    /// Save the results of the last raytrace (see RaytracerResultsFile), so
+    /// that they can be rendered again later without re-tracing.
+    void writeResults (const std::string & fname);
+
+#ifdef RAY_STATISTICS
+    /// Get the work done by the kernel during the last raytrace, summed over
+    /// all rays.
+    const RayStatistics & getStatistics() const;
+#endif
+
 private:
     const unsigned long nreflections;
     const unsigned long ntriangles;
+    const unsigned long nvertices;
 
     cl::Buffer cl_directions;
     cl::Buffer cl_triangles;
@@ -183,9 +380,24 @@ private:
     cl::Buffer cl_impulses;
     cl::Buffer cl_image_source;
     cl::Buffer cl_image_source_index;
+    cl::Buffer cl_paths;
+#ifdef RAY_STATISTICS
+    cl::Buffer cl_statistics;
+    RayStatistics storedStatistics;
+#endif
 
     std::pair <cl_float3, cl_float3> bounds;
 
+    /// The triangles lying in each plane of the model, for the image-source
+    /// search.
+    /// These are only found (by findPlanes) once the search is first run.
+    /// Plane i holds planeTriangles [planeOffsets [i]] up to
+    /// planeTriangles [planeOffsets [i + 1]].
+    std::vector <cl_uint> planeOffsets;
+    std::vector <cl_uint> planeTriangles;
+    cl::Buffer cl_plane_offsets;
+    cl::Buffer cl_plane_triangles;
+
     cl_float3 storedMicpos;
 
     struct SceneData;
@@ -198,25 +410,88 @@ private:
 
     static const unsigned long RAY_GROUP_SIZE = 4096;
 
-    decltype
-    (   cl::make_kernel
-        <   cl::Buffer
-        ,   cl_float3
-        ,   cl::Buffer
-        ,   cl_ulong
-        ,   cl::Buffer
-        ,   cl_float3
-        ,   cl::Buffer
-        ,   cl::Buffer
-        ,   cl::Buffer
-        ,   cl::Buffer
-        ,   cl_ulong
-        ,   VolumeType
-        > (cl_program, "raytrace")
-    ) raytrace_kernel;
+    typedef cl::make_kernel
+    <   cl::Buffer
+    ,   cl_float3
+    ,   cl::Buffer
+    ,   cl_ulong
+    ,   cl::Buffer
+    ,   cl_float3
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl_ulong
+    ,   VolumeType
+    ,   cl::Buffer
+    ,   cl_ulong
+    ,   cl_float
+#ifdef RAY_STATISTICS
+    ,   cl::Buffer
+#endif
+    > RaytraceKernel;
+
+    RaytraceKernel raytrace_kernel;
+
+    static const unsigned long IMAGE_SOURCE_GROUP_SIZE = 1 << 16;
+
+    typedef cl::make_kernel
+    <   cl::Buffer
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl_ulong
+    ,   cl::Buffer
+    ,   cl_float3
+    ,   cl_float
+    ,   cl::Buffer
+    ,   cl::Buffer
+    > ImageSourceExtendKernel;
+
+    typedef cl::make_kernel
+    <   cl::Buffer
+    ,   cl_ulong
+    ,   cl::Buffer
+    ,   cl_ulong
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl::Buffer
+    ,   cl_float3
+    ,   cl_float3
+    ,   VolumeType
+    ,   cl::Buffer
+    > ImageSourceValidateKernel;
+
+    ImageSourceExtendKernel image_source_extend_kernel;
+    ImageSourceValidateKernel image_source_validate_kernel;
+
+    /// Group the model's triangles by plane, if that hasn't been done yet.
+    void findPlanes();
+
+    /// Replace the image sources found by the rays, up to imageSourceOrder,
+    /// with an exhaustive search.
+    void findImageSources
+    (   const cl_float3 & micpos
+    ,   const cl_float3 & source
+    ,   bool verbose
+    );
 
     std::vector <Impulse> storedDiffuse;
+    std::string spillFile;
     std::map <std::vector <unsigned long>, Impulse> imageSourceTally;
+
+    bool cachePaths;
+    unsigned long revalidateBounces;
+    std::vector <cl_uint> storedPaths;
+    std::vector <cl_float3> storedDirections;
+    cl_float3 storedSource;
+
+    float rayMaxTime;
+
+    unsigned long imageSourceOrder;
+    float imageSourceMaxTime;
 };
 
 /// HRTF parameters.
@@ -224,6 +499,10 @@ struct HrtfConfig
 {
     cl_float3 facing;
     cl_float3 up;
+
+    /// Optional path to an external HRTF file.
+    /// If empty, the built-in table is used.
+    std::string file;
 };
 
 /// An attenuator is just a KernelLoader with some extra buffers.
@@ -239,6 +518,9 @@ class HrtfAttenuator: public Attenuator
 public:
     HrtfAttenuator();
 
+    /// Use HRTF data from an external file rather than the built-in table.
+    HrtfAttenuator (const std::string & hrtfFile, bool verbose = false);
+
     /// Attenuate some raytrace results.
     /// The outer vector corresponds to separate channels, the inner vector
     /// contains the impulses, each of which has a time and an 8-band volume.
@@ -252,9 +534,10 @@ public:
     ,   const cl_float3 & up
     );
 
-    virtual const std::array <std::array <std::array <cl_float8, 180>, 360>, 2> & getHrtfData() const;
+    /// The HRTF data, in octave bands.
+    virtual const HrtfTable & getHrtfData() const;
 private:
-    static const std::array <std::array <std::array <cl_float8, 180>, 360>, 2> HRTF_DATA;
+    static const HrtfTable HRTF_DATA;
     std::vector <AttenuatedImpulse> attenuate
     (   const cl_float3 & mic_pos
     ,   unsigned long channel
@@ -263,6 +546,8 @@ private:
     ,   const std::vector <Impulse> & impulses
     );
 
+    std::shared_ptr <HrtfFile> hrtfFile;
+
     cl::Buffer cl_hrtf;
 
     decltype
@@ -307,6 +592,44 @@ private:
     ) attenuate_kernel;
 };
 
+/// Ambisonic encoding parameters.
+struct AmbisonicConfig
+{
+    cl_float3 facing;
+    cl_float3 up;
+    int order;
+};
+
+/// Class for parallel ambisonic (B-format) encoding of raytrace results.
+class AmbisonicAttenuator: public Attenuator
+{
+public:
+    AmbisonicAttenuator();
+
+    /// Encode some raytrace results.
+    /// The outer vector contains (order + 1)^2 channels in ACN order with SN3D
+    /// normalisation, which can be decoded to any speaker layout later.
+    std::vector <std::vector <AttenuatedImpulse>> attenuate
+    (   const RaytracerResults & results
+    ,   const AmbisonicConfig & config
+    );
+
+    /// The number of output channels for an encoding of a given order.
+    static unsigned long numChannels (unsigned long order);
+private:
+    decltype
+    (   cl::make_kernel
+        <   cl_float3
+        ,   cl::Buffer
+        ,   cl::Buffer
+        ,   cl_float3
+        ,   cl_float3
+        ,   cl_ulong
+        ,   cl_ulong
+        > (cl_program, "ambisonic")
+    ) attenuate_kernel;
+};
+
 /// Try to open and parse a json file.
 void attemptJsonParse
 (   const std::string & fname
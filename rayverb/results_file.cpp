@@ -0,0 +1,147 @@
+#include "results_file.h"
+#include "rayverb.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+using namespace std;
+
+static_assert
+(   sizeof (RaytracerResultsHeader) == 64
+,   "results header must keep the impulses aligned"
+);
+static_assert
+(   offsetof (RaytracerResultsHeader, mic) % 16 == 0
+,   "results header's mic must be aligned in the mapping"
+);
+
+const char RaytracerResultsFile::MAGIC [8] =
+{'R', 'V', 'R', 'E', 'S', 'U', 'L', 'T'};
+
+RaytracerResultsFile::RaytracerResultsFile (const string & fname)
+:   file (fname)
+{
+    if (file.size() < sizeof (RaytracerResultsHeader))
+        throw runtime_error ("results file " + fname + " is too short");
+
+    memcpy (&header, file.data(), sizeof (RaytracerResultsHeader));
+
+    if (memcmp (header.magic, MAGIC, sizeof (MAGIC)))
+        throw runtime_error ("results file " + fname + " has an invalid header");
+    if (header.version != VERSION)
+        throw runtime_error ("unsupported results file version");
+    if (header.bands != NUM_BANDS)
+        throw runtime_error
+        (   "results file was traced with "
+        +   to_string (header.bands)
+        +   " bands, but this build uses "
+        +   to_string (NUM_BANDS)
+        );
+    if
+    (   file.size()
+    !=  sizeof (RaytracerResultsHeader)
+    +   (header.diffuse + header.direct + header.images) * sizeof (Impulse)
+    )
+        throw runtime_error ("results file " + fname + " is truncated");
+}
+
+void RaytracerResultsFile::write
+(   const string & fname
+,   const cl_float3 & mic
+,   const Impulse * diffuse
+,   size_t diffuseCount
+,   const vector <Impulse> & direct
+,   const vector <Impulse> & images
+)
+{
+    auto audible = [] (const Impulse & i)
+    {
+        for (auto j = 0; j != NUM_BANDS; ++j)
+            if (i.volume.s [j] != 0)
+                return true;
+        return false;
+    };
+
+    RaytracerResultsHeader header;
+    memset (&header, 0, sizeof (RaytracerResultsHeader));
+    copy (begin (MAGIC), end (MAGIC), header.magic);
+    header.version = VERSION;
+    header.bands = NUM_BANDS;
+    header.diffuse = count_if (diffuse, diffuse + diffuseCount, audible);
+    header.direct = direct.size();
+    header.images = images.size();
+    header.mic = mic;
+
+    ofstream out (fname, ios::binary);
+    out.write
+    (   reinterpret_cast <const char *> (&header)
+    ,   sizeof (RaytracerResultsHeader)
+    );
+    for (auto i = diffuse; i != diffuse + diffuseCount; ++i)
+    {
+        if (audible (*i))
+            out.write (reinterpret_cast <const char *> (i), sizeof (Impulse));
+    }
+    out.write
+    (   reinterpret_cast <const char *> (direct.data())
+    ,   direct.size() * sizeof (Impulse)
+    );
+    out.write
+    (   reinterpret_cast <const char *> (images.data())
+    ,   images.size() * sizeof (Impulse)
+    );
+
+    if (! out)
+        throw runtime_error ("failed to write results file " + fname);
+}
+
+const Impulse * RaytracerResultsFile::diffuseData() const
+{
+    return reinterpret_cast <const Impulse *>
+        (file.data() + sizeof (RaytracerResultsHeader));
+}
+
+RaytracerResults RaytracerResultsFile::getRawDiffuse() const
+{
+    return RaytracerResults
+    (   vector <Impulse> (diffuseData(), diffuseData() + diffuseSize())
+    ,   mic()
+    );
+}
+
+RaytracerResults RaytracerResultsFile::getRawImages (bool removeDirect) const
+{
+    const auto direct = diffuseData() + diffuseSize();
+    const auto images = direct + header.direct;
+    return RaytracerResults
+    (   vector <Impulse>
+        (   removeDirect ? images : direct
+        ,   images + header.images
+        )
+    ,   mic()
+    );
+}
+
+RaytracerResults RaytracerResultsFile::getAllRaw (bool removeDirect) const
+{
+    //  Copy every impulse out of the file once, skipping the direct path if
+    //  necessary.
+    const auto direct = diffuseData() + diffuseSize();
+    const auto images = direct + header.direct;
+    vector <Impulse> impulses;
+    impulses.reserve
+    (   diffuseSize()
+    +   (removeDirect ? 0 : header.direct)
+    +   header.images
+    );
+    impulses.insert (impulses.end(), diffuseData(), direct);
+    impulses.insert
+    (   impulses.end()
+    ,   removeDirect ? images : direct
+    ,   images + header.images
+    );
+    return RaytracerResults (move (impulses), mic());
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "clstructs.h"
+#include "mapped_file.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct RaytracerResults;
+
+/// Header of a saved raytrace.
+///
+/// The header is followed by `diffuse` diffuse impulses, then by `direct`
+/// direct-path impulses (zero or one), then by `images` other image-source
+/// impulses.
+/// Impulses are stored in the in-memory Impulse layout so that they can be
+/// mapped straight into memory.
+struct RaytracerResultsHeader
+{
+    char magic [8];
+    uint32_t version;
+    uint32_t bands;
+    uint64_t diffuse;
+    uint64_t direct;
+    uint64_t images;
+    char padding [8];
+    cl_float3 mic;
+};
+
+/// A raytrace saved to disk, so that it can be attenuated, filtered and mixed
+/// again with different settings without tracing the model again.
+/// The file is memory-mapped, so large traces can be streamed from it.
+class RaytracerResultsFile
+{
+public:
+    RaytracerResultsFile (const std::string & fname);
+
+    static const char MAGIC [8];
+    static const uint32_t VERSION = 1;
+
+    /// Write a raytrace in the saved format.
+    /// Silent diffuse impulses (rays that found no path to the mic) are
+    /// dropped, as they don't contribute to the output.
+    static void write
+    (   const std::string & fname
+    ,   const cl_float3 & mic
+    ,   const Impulse * diffuse
+    ,   size_t diffuseCount
+    ,   const std::vector <Impulse> & direct
+    ,   const std::vector <Impulse> & images
+    );
+
+    const cl_float3 & mic() const {return header.mic;}
+
+    /// The diffuse impulses, without copying them out of the file.
+    const Impulse * diffuseData() const;
+    size_t diffuseSize() const {return header.diffuse;}
+
+    /// These mirror the result getters of Raytracer.
+    RaytracerResults getRawDiffuse() const;
+    RaytracerResults getRawImages (bool removeDirect) const;
+    RaytracerResults getAllRaw (bool removeDirect) const;
+
+private:
+    MappedFile file;
+    RaytracerResultsHeader header;
+};
@@ -0,0 +1,252 @@
+#include "scene_cache.h"
+#include "mapped_file.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+const char SceneCache::MAGIC [8] = {'R', 'V', 'S', 'C', 'E', 'N', 'E', 0};
+
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+
+/// 64-bit FNV-1a.
+static uint64_t fnv1a (const char * data, size_t length, uint64_t hash)
+{
+    for (auto i = 0u; i != length; ++i)
+    {
+        hash ^= static_cast <unsigned char> (data [i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/// The directory caches are kept in.
+static string & directory()
+{
+    static string ret = [] ()
+    {
+        const auto xdg = getenv ("XDG_CACHE_HOME");
+        if (xdg && *xdg)
+            return string (xdg) + "/rayverb";
+        const auto home = getenv ("HOME");
+        if (home && *home)
+            return string (home) + "/.cache/rayverb";
+        return string();
+    } ();
+    return ret;
+}
+
+/// The canonical absolute name of an existing file, or an empty string if
+/// the file doesn't exist.
+static string absolutePath (const string & fname)
+{
+    const auto resolved = realpath (fname.c_str(), nullptr);
+    if (! resolved)
+        return string();
+    string ret (resolved);
+    free (resolved);
+    return ret;
+}
+
+/// Create a directory and any missing parents.
+/// Errors are ignored, because they show up when the cache is opened.
+static void makeDirectories (const string & dir)
+{
+    for (auto i = dir.find ('/', 1); ; i = dir.find ('/', i + 1))
+    {
+        mkdir (dir.substr (0, i).c_str(), 0755);
+        if (i == string::npos)
+            return;
+    }
+}
+
+void SceneCache::setDirectory (const string & dir)
+{
+    directory() = dir;
+}
+
+string SceneCache::path
+(   const string & objpath
+,   const string & materialFileName
+)
+{
+    if (directory().empty())
+        return string();
+
+    const auto obj = absolutePath (objpath);
+    const auto material = absolutePath (materialFileName);
+    if (obj.empty() || material.empty())
+        return string();
+
+    //  A model loaded with different materials gets a different cache.
+    const auto key = obj + '\0' + material;
+    ostringstream ret;
+    ret <<  directory()
+        <<  "/"
+        <<  hex << setw (16) << setfill ('0')
+        <<  fnv1a (key.data(), key.size(), FNV_OFFSET)
+        <<  ".scene";
+    return ret.str();
+}
+
+uint64_t SceneCache::hashFiles (const vector <string> & fnames)
+{
+    uint64_t hash = FNV_OFFSET;
+    for (const auto & i : fnames)
+    {
+        MappedFile file (i);
+        const uint64_t length = file.size();
+        hash = fnv1a (reinterpret_cast <const char *> (&length), sizeof (length), hash);
+        hash = fnv1a (file.data(), file.size(), hash);
+    }
+    return hash;
+}
+
+/// Check that a mapped cache has a header for this build, and read it.
+static bool readHeader (const MappedFile & cache, SceneCacheHeader & header)
+{
+    if (cache.size() < sizeof (SceneCacheHeader))
+        return false;
+
+    memcpy (&header, cache.data(), sizeof (SceneCacheHeader));
+
+    return
+        ! memcmp (header.magic, SceneCache::MAGIC, sizeof (SceneCache::MAGIC))
+    &&  header.version == SceneCache::VERSION
+    &&  header.bands == NUM_BANDS
+    &&  header.inputLength <= cache.size() - sizeof (SceneCacheHeader);
+}
+
+vector <string> SceneCache::inputs (const string & fname)
+{
+    try
+    {
+        MappedFile cache (fname);
+
+        SceneCacheHeader header;
+        if (! readHeader (cache, header))
+            return vector <string>();
+
+        vector <string> ret;
+        const auto begin = cache.data() + sizeof (SceneCacheHeader);
+        const auto end = begin + header.inputLength;
+        for (auto i = begin; i != end;)
+        {
+            const auto terminator = find (i, end, 0);
+            if (terminator == end)
+                return vector <string>();
+            ret.push_back (string (i, terminator));
+            i = terminator + 1;
+        }
+        return ret;
+    }
+    catch (const runtime_error &)
+    {
+        return vector <string>();
+    }
+}
+
+/// Copy `count` objects out of a mapped cache and advance the read position.
+template <typename T>
+static void readArray (const char * & ptr, uint64_t count, vector <T> & out)
+{
+    out.resize (count);
+    memcpy (out.data(), ptr, count * sizeof (T));
+    ptr += count * sizeof (T);
+}
+
+bool SceneCache::load
+(   const string & fname
+,   uint64_t hash
+,   vector <Triangle> & triangles
+,   vector <cl_float3> & vertices
+,   vector <Surface> & surfaces
+)
+{
+    try
+    {
+        MappedFile cache (fname);
+
+        SceneCacheHeader header;
+        if (! readHeader (cache, header) || header.hash != hash)
+            return false;
+        if
+        (   cache.size()
+        !=  sizeof (SceneCacheHeader)
+        +   header.inputLength
+        +   header.triangles * sizeof (Triangle)
+        +   header.vertices * sizeof (cl_float3)
+        +   header.surfaces * sizeof (Surface)
+        )
+            return false;
+
+        auto ptr = cache.data() + sizeof (SceneCacheHeader) + header.inputLength;
+        readArray (ptr, header.triangles, triangles);
+        readArray (ptr, header.vertices, vertices);
+        readArray (ptr, header.surfaces, surfaces);
+        return true;
+    }
+    catch (const runtime_error &)
+    {
+        return false;
+    }
+}
+
+void SceneCache::write
+(   const string & fname
+,   uint64_t hash
+,   const vector <string> & inputs
+,   const vector <Triangle> & triangles
+,   const vector <cl_float3> & vertices
+,   const vector <Surface> & surfaces
+)
+{
+    SceneCacheHeader header;
+    memset (&header, 0, sizeof (SceneCacheHeader));
+    copy (begin (MAGIC), end (MAGIC), header.magic);
+    header.version = VERSION;
+    header.bands = NUM_BANDS;
+    header.hash = hash;
+    for (const auto & i : inputs)
+        header.inputLength += i.size() + 1;
+    header.triangles = triangles.size();
+    header.vertices = vertices.size();
+    header.surfaces = surfaces.size();
+
+    const auto slash = fname.rfind ('/');
+    if (slash != string::npos && slash != 0)
+        makeDirectories (fname.substr (0, slash));
+
+    ofstream out (fname, ios::binary);
+    if (! out.is_open())
+        return;
+
+    auto writeArray = [&out] (const auto & v)
+    {
+        out.write
+        (   reinterpret_cast <const char *> (v.data())
+        ,   v.size() * sizeof (v.front())
+        );
+    };
+
+    out.write (reinterpret_cast <const char *> (&header), sizeof (SceneCacheHeader));
+    for (const auto & i : inputs)
+        out.write (i.c_str(), i.size() + 1);
+    writeArray (triangles);
+    writeArray (vertices);
+    writeArray (surfaces);
+
+    if (! out)
+    {
+        out.close();
+        remove (fname.c_str());
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "clstructs.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/// Header of a binary scene cache.
+///
+/// The header is followed by `inputLength` bytes naming the files the scene
+/// was imported from, each terminated by a zero byte, then `triangles`
+/// Triangle, `vertices` cl_float3, and `surfaces` Surface, stored exactly as
+/// they are uploaded to the device.
+struct SceneCacheHeader
+{
+    char magic [8];
+    uint32_t version;
+    uint32_t bands;
+    uint64_t hash;
+    uint64_t inputLength;
+    uint64_t triangles;
+    uint64_t vertices;
+    uint64_t surfaces;
+};
+
+/// Stores imported scenes in a compact binary format, so that repeated runs
+/// against the same model can skip the Assimp import entirely.
+///
+/// Caches live in their own directory, away from the models.
+/// Each cache records every file that was read to build it (the model, and
+/// anything the importer opened alongside it, like .mtl files), and is keyed
+/// on a hash of their contents.
+/// Caches are memory-mapped when they are loaded.
+class SceneCache
+{
+public:
+    static const char MAGIC [8];
+    static const uint32_t VERSION = 3;
+
+    /// Set the directory that caches are kept in, which is created when a
+    /// cache is first written.
+    /// An empty name disables caching.
+    /// Defaults to rayverb in $XDG_CACHE_HOME or ~/.cache.
+    static void setDirectory (const std::string & dir);
+
+    /// The cache for a model imported with a material file, or an empty
+    /// string if caching is disabled or either file doesn't exist.
+    static std::string path
+    (   const std::string & objpath
+    ,   const std::string & materialFileName
+    );
+
+    /// Hash the contents of a set of files.
+    /// Throws if any of the files can't be read.
+    static uint64_t hashFiles (const std::vector <std::string> & fnames);
+
+    /// The files a cached scene was imported from.
+    /// Returns an empty list if the cache is missing or malformed.
+    static std::vector <std::string> inputs (const std::string & fname);
+
+    /// Try to load a cached scene.
+    /// Returns false if the cache is missing, was built from different
+    /// inputs, or is malformed.
+    static bool load
+    (   const std::string & fname
+    ,   uint64_t hash
+    ,   std::vector <Triangle> & triangles
+    ,   std::vector <cl_float3> & vertices
+    ,   std::vector <Surface> & surfaces
+    );
+
+    /// Write a scene, and the names of the files it was imported from, to a
+    /// cache file.
+    /// Failing to write the cache isn't an error, so this never throws.
+    static void write
+    (   const std::string & fname
+    ,   uint64_t hash
+    ,   const std::vector <std::string> & inputs
+    ,   const std::vector <Triangle> & triangles
+    ,   const std::vector <cl_float3> & vertices
+    ,   const std::vector <Surface> & surfaces
+    );
+};
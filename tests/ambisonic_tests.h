@@ -0,0 +1,96 @@
+#include "rayverb.h"
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "cl.hpp"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <cmath>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    class AmbisonicTest: public AmbisonicAttenuator, public ::testing::Test
+    {
+    protected:
+        AmbisonicTest()
+        {
+            in.push_back (constructImpulse (-10, 0, 0));
+            in.push_back (constructImpulse (10, 0, 0));
+
+            in.push_back (constructImpulse (0, -10, 0));
+            in.push_back (constructImpulse (0, 10, 0));
+
+            in.push_back (constructImpulse (0, 0, -10));
+            in.push_back (constructImpulse (0, 0, 10));
+        }
+
+        void run (int order)
+        {
+            out = attenuate
+            (   RaytracerResults (in, mic_pos)
+            ,   {(cl_float3) {{0, 0, 1}}, (cl_float3) {{0, 1, 0}}, order}
+            );
+            ASSERT_EQ(out.size(), numChannels (order));
+            for (const auto & i : out)
+                ASSERT_EQ(i.size(), in.size());
+        }
+
+        static constexpr cl_float3 mic_pos = {{0, 0, 0}};
+
+        Impulse constructImpulse (float x, float y, float z)
+        {
+            return (Impulse) {fromOctaveBands ((cl_float8) {{1, 1, 1, 1, 1, 1, 1, 1}}), (cl_float3) {{x, y, z}}, 1};
+        }
+
+        vector <Impulse> in;
+        vector <vector <AttenuatedImpulse>> out;
+    };
+
+    const cl_float3 AmbisonicTest::mic_pos;
+
+    TEST_F(AmbisonicTest, FirstOrder)
+    {
+        run (1);
+
+        //  ACN order is W, Y (left), Z (up), X (front).
+        //  Impulses are left, right, down, up, back, front (the left ear is
+        //  on the negative x axis, as in the hrtf kernel).
+        const vector <vector <float>> expected
+        {   { 1,  1,  1,  1,  1,  1}
+        ,   { 1, -1,  0,  0,  0,  0}
+        ,   { 0,  0, -1,  1,  0,  0}
+        ,   { 0,  0,  0,  0, -1,  1}
+        };
+
+        for (auto c = 0u; c != expected.size(); ++c)
+            for (auto i = 0u; i != in.size(); ++i)
+                ASSERT_NEAR(expected [c] [i], out [c] [i].volume.s [0], 0.0001)
+                    << c << " " << i;
+    }
+
+    TEST_F(AmbisonicTest, ThirdOrderFront)
+    {
+        run (3);
+
+        //  Straight ahead, all the sine harmonics vanish.
+        const auto front = in.size() - 1;
+        for (auto c : {1, 2, 4, 5, 7, 9, 10, 11, 12, 14})
+            ASSERT_NEAR(out [c] [front].volume.s [0], 0, 0.0001) << c;
+        ASSERT_NEAR(out [0] [front].volume.s [0], 1, 0.0001);
+        ASSERT_NEAR(out [3] [front].volume.s [0], 1, 0.0001);
+        ASSERT_NEAR(out [6] [front].volume.s [0], -0.5, 0.0001);
+        ASSERT_NEAR(out [8] [front].volume.s [0], sqrt (3) / 2, 0.0001);
+        ASSERT_NEAR(out [13] [front].volume.s [0], -sqrt (3.0 / 8), 0.0001);
+        ASSERT_NEAR(out [15] [front].volume.s [0], sqrt (5.0 / 8), 0.0001);
+    }
+
+    TEST_F(AmbisonicTest, Timing)
+    {
+        run (2);
+        for (const auto & channel : out)
+            for (auto i = 0u; i != in.size(); ++i)
+                ASSERT_EQ(in [i].time, channel [i].time);
+    }
+}
@@ -49,7 +49,7 @@ namespace TestsNamespace {
 
         Impulse constructImpulse (float x, float y, float z)
         {
-            return (Impulse) {(VolumeType) {{1, 1, 1, 1, 1, 1, 1, 1}}, (cl_float3) {{x, y, z}}, dist (generator)};
+            return (Impulse) {fromOctaveBands ((cl_float8) {{1, 1, 1, 1, 1, 1, 1, 1}}), (cl_float3) {{x, y, z}}, dist (generator)};
         }
 
         vector <Impulse> in;
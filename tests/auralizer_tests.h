@@ -0,0 +1,110 @@
+#include "auralizer.h"
+#include "test_helpers.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace TestsNamespace {
+    using namespace std;
+    using namespace RayverbFiltering;
+
+    TEST(PartitionedConvolutionTest, MatchesDirect)
+    {
+        const auto BLOCK_SIZE = 16u;
+        const auto ir = noise (1000, 3);
+        const auto input = noise (BLOCK_SIZE * 100, 4);
+
+        PartitionedConvolution convolution (ir, BLOCK_SIZE, 2, 128);
+
+        //  Partitions should grow along the response, up to the limit.
+        const auto lengths = convolution.getPartitionLengths();
+        ASSERT_EQ(lengths.front(), BLOCK_SIZE);
+        ASSERT_EQ(lengths.back(), 128u);
+
+        vector <float> output (input.size());
+        for (auto i = 0u; i < input.size(); i += BLOCK_SIZE)
+            convolution.process (input.data() + i, output.data() + i);
+
+        for (auto i = 0u; i != output.size(); ++i)
+        {
+            float expected = 0;
+            for (auto j = 0u; j != ir.size() && j <= i; ++j)
+                expected += ir [j] * input [i - j];
+            ASSERT_NEAR(output [i], expected, 1e-3);
+        }
+    }
+
+    TEST(AuralizerTest, Crossfade)
+    {
+        const auto BLOCK_SIZE = 8u;
+        const auto CROSSFADE_LENGTH = 16u;
+
+        Auralizer auralizer (2, BLOCK_SIZE, CROSSFADE_LENGTH, 2);
+        vector <float> input (BLOCK_SIZE, 1);
+        vector <vector <float>> output (2, vector <float> (BLOCK_SIZE));
+        vector <float *> outputs {output [0].data(), output [1].data()};
+
+        auralizer.process (input.data(), outputs);
+        for (const auto & i : output)
+            for (auto j : i)
+                ASSERT_EQ(j, 0);
+
+        //  The first responses are used straight away.
+        auralizer.setImpulseResponses ({{1}, {0.5}});
+        auralizer.process (input.data(), outputs);
+        ASSERT_FALSE(auralizer.isCrossfading());
+        for (auto i = 0u; i != BLOCK_SIZE; ++i)
+        {
+            ASSERT_NEAR(output [0] [i], 1, 1e-4);
+            ASSERT_NEAR(output [1] [i], 0.5, 1e-4);
+        }
+
+        //  Later ones fade in, and settle on the new responses.
+        auralizer.setImpulseResponses ({{0.25}, {0.25}});
+        auralizer.process (input.data(), outputs);
+        ASSERT_TRUE(auralizer.isCrossfading());
+        ASSERT_NEAR(output [0] [0], 1, 1e-4);
+        ASSERT_LT(output [0] [BLOCK_SIZE - 1], 1);
+        ASSERT_GT(output [0] [BLOCK_SIZE - 1], 0.25);
+
+        auralizer.process (input.data(), outputs);
+        ASSERT_FALSE(auralizer.isCrossfading());
+
+        auralizer.process (input.data(), outputs);
+        for (const auto & i : output)
+            for (auto j : i)
+                ASSERT_NEAR(j, 0.25, 1e-4);
+    }
+
+    TEST(AuralizerTest, OldResponsesRingOut)
+    {
+        const auto BLOCK_SIZE = 8u;
+
+        Auralizer auralizer (1, BLOCK_SIZE, BLOCK_SIZE, 1);
+        vector <float> delayed (21, 0);
+        delayed.back() = 1;
+        auralizer.setImpulseResponses ({delayed});
+
+        vector <float> input (BLOCK_SIZE, 0);
+        vector <float> output (BLOCK_SIZE);
+        vector <float *> outputs {output.data()};
+        input [0] = 1;
+        auralizer.process (input.data(), outputs);
+        input [0] = 0;
+
+        //  The impulse played before the change should still come out of
+        //  the old response, 20 samples after it was played.
+        auralizer.setImpulseResponses ({{0.5}});
+        vector <float> played;
+        for (auto i = 0u; i != 4; ++i)
+        {
+            auralizer.process (input.data(), outputs);
+            played.insert (played.end(), output.begin(), output.end());
+        }
+        for (auto i = 0u; i != played.size(); ++i)
+            ASSERT_NEAR(played [i], BLOCK_SIZE + i == 20 ? 1 : 0, 1e-4);
+
+        ASSERT_FALSE(auralizer.isRingingOut());
+    }
+}
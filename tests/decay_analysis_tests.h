@@ -0,0 +1,82 @@
+#include "decay_analysis.h"
+#include "filters.h"
+#include "test_helpers.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    TEST(DecayAnalysisTest, ExponentialDecay)
+    {
+        const auto SAMPLE_RATE = 8000.0f;
+        const auto RT60 = 0.5f;
+
+        //  Noise decaying by 60dB every RT60, after 10ms of silence.
+        default_random_engine engine (0);
+        normal_distribution <float> dist;
+        vector <float> data (2 * SAMPLE_RATE, 0);
+        for (auto i = 80u; i != data.size(); ++i)
+            data [i] = pow (10, -3.0 * (i - 80) / (RT60 * SAMPLE_RATE)) * dist (engine);
+
+        const auto decay = analyseDecay (data.data(), data.size(), 1, SAMPLE_RATE);
+        ASSERT_NEAR(decay.onset, 0.01, 0.001);
+        ASSERT_NEAR(decay.edt, RT60, 0.05);
+        ASSERT_NEAR(decay.t20, RT60, 0.02);
+        ASSERT_NEAR(decay.t30, RT60, 0.02);
+
+        const auto late = pow (10, -6 * 0.08 / RT60);
+        ASSERT_NEAR(decay.c80, 10 * log10 ((1 - late) / late), 0.5);
+
+        ASSERT_EQ(decay.edc.front(), 0);
+        ASSERT_NEAR(decay.edc [10], -60 * 0.1 / RT60, 1);
+    }
+
+    TEST(DecayAnalysisTest, Silence)
+    {
+        const vector <float> data (1000, 0);
+        const auto decay = analyseDecay (data.data(), data.size(), 1, 8000);
+        ASSERT_TRUE(std::isnan (decay.t30));
+        ASSERT_TRUE(std::isnan (decay.c80));
+        ASSERT_TRUE(decay.edc.empty());
+    }
+
+    TEST(DecayAnalysisTest, ObservedMixMatches)
+    {
+        //  Observing the bands mixes them in a separate pass, which should
+        //  give the same output.
+        auto data = vector <vector <float>> (2, noise (1000 * NUM_BANDS, 5));
+        auto observed = data;
+
+        const auto mixed = RayverbFiltering::filterAndMixInterleaved
+        (   RayverbFiltering::FILTER_TYPE_BIQUAD_TWOPASS
+        ,   data
+        ,   44100
+        ,   45
+        );
+
+        vector <vector <unsigned long>> seen (2, vector <unsigned long> (NUM_BANDS, 0));
+        const auto observedMixed = RayverbFiltering::filterAndMixInterleaved
+        (   RayverbFiltering::FILTER_TYPE_BIQUAD_TWOPASS
+        ,   observed
+        ,   44100
+        ,   45
+        ,   [&seen] (auto channel, auto band, auto, auto length, auto, auto)
+            {
+                seen [channel] [band] = length;
+            }
+        );
+
+        for (const auto & i : seen)
+            for (auto j : i)
+                ASSERT_EQ(j, 1000u);
+
+        for (auto i = 0u; i != mixed.size(); ++i)
+            for (auto j = 0u; j != mixed [i].size(); ++j)
+                ASSERT_NEAR(mixed [i] [j], observedMixed [i] [j], 1e-5);
+    }
+}
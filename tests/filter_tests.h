@@ -0,0 +1,323 @@
+#include "filters.h"
+#include "rayverb.h"
+#include "test_helpers.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace TestsNamespace {
+    using namespace std;
+    using namespace RayverbFiltering;
+
+    class KernelConvolutionTest: public ::testing::Test
+    {
+    protected:
+        /// Check each convolution method against a naive convolution.
+        static void check
+        (   unsigned long kernelLength
+        ,   unsigned long inputLength
+        ,   KernelConvolution::Method method
+        )
+        {
+            const auto kernel = noise (kernelLength, 1);
+            const auto input = noise (inputLength, 2);
+
+            KernelConvolution convolution (kernelLength, inputLength);
+            ASSERT_EQ(convolution.getMethod(), method);
+            convolution.setKernel (kernel);
+
+            auto output = input;
+            convolution.convolve (output);
+            ASSERT_EQ(output.size(), kernelLength + inputLength - 1);
+
+            for (auto i = 0u; i != output.size(); ++i)
+            {
+                float expected = 0;
+                for (auto j = 0u; j != kernelLength; ++j)
+                    if (j <= i && i - j < inputLength)
+                        expected += kernel [j] * input [i - j];
+                ASSERT_NEAR(output [i], expected, 1e-4);
+            }
+        }
+    };
+
+    TEST_F(KernelConvolutionTest, Direct)
+    {
+        check (29, 5000, KernelConvolution::METHOD_DIRECT);
+    }
+
+    TEST_F(KernelConvolutionTest, OverlapSave)
+    {
+        check (100, 5000, KernelConvolution::METHOD_OVERLAP_SAVE);
+    }
+
+    TEST_F(KernelConvolutionTest, FullFft)
+    {
+        check (100, 500, KernelConvolution::METHOD_FFT);
+    }
+
+    TEST_F(KernelConvolutionTest, NoReallocation)
+    {
+        //  With room reserved for the tail, filtering must happen in the
+        //  caller's buffer.
+        for (auto kernelLength : {29ul, 100ul})
+        {
+            KernelConvolution convolution (kernelLength, 20000);
+            convolution.setKernel (noise (kernelLength, 1));
+
+            for (auto seed = 0u; seed != 4; ++seed)
+            {
+                auto data = noise (20000, seed);
+                data.reserve (data.size() + kernelLength - 1);
+                const auto before = data.data();
+                convolution.convolve (data);
+                ASSERT_EQ(data.data(), before);
+            }
+        }
+
+        BandpassWindowedSinc bandpass (20000);
+        bandpass.setParams (100, 1000, 44100);
+        auto data = noise (20000, 5);
+        data.reserve (data.size() + MAX_FILTER_TAIL);
+        const auto before = data.data();
+        bandpass.filter (data);
+        ASSERT_EQ(data.data(), before);
+    }
+
+    TEST(WindowedSincTest, SineGain)
+    {
+        //  A sine well inside the passband should come out at the same
+        //  level, whether it's filtered directly or through an FFT.
+        const auto SAMPLE_RATE = 44100.0f;
+        const auto FREQ = SAMPLE_RATE / 4;
+        vector <float> sine (4096);
+        for (auto i = 0u; i != sine.size(); ++i)
+            sine [i] = sin (2 * M_PI * FREQ * i / SAMPLE_RATE);
+
+        const auto amplitude = [] (const vector <float> & data)
+        {
+            float peak = 0;
+            for (auto i = 1000u; i != 3000u; ++i)
+                peak = max (peak, abs (data [i]));
+            return peak;
+        };
+
+        HipassWindowedSinc hipass (sine.size());
+        hipass.setParams (SAMPLE_RATE / 40, SAMPLE_RATE);
+        auto filtered = sine;
+        hipass.filter (filtered);
+        ASSERT_NEAR(amplitude (filtered), 1, 0.02);
+
+        FastConvolution fft (sine.size() * 2);
+        auto transformed = sine;
+        fft.convolve (fft.spectrum ({1}), transformed);
+        ASSERT_NEAR(amplitude (transformed), 1, 1e-4);
+        for (auto i = 0u; i != sine.size(); ++i)
+            ASSERT_NEAR(transformed [i], sine [i], 1e-4);
+    }
+
+    template <typename T>
+    void checkBiquadBlocks()
+    {
+        const auto input = noise (10000, 3);
+
+        Biquad <T> whole;
+        whole.setParams (0.2, 0, -0.2, -1.5, 0.6);
+        auto expected = input;
+        whole.onepass (expected);
+
+        //  Filtering in uneven blocks should match filtering all at once.
+        Biquad <T> blocks;
+        blocks.setParams (0.2, 0, -0.2, -1.5, 0.6);
+        auto output = input;
+        for (auto i = 0u; i < output.size(); i += 999)
+        {
+            blocks.onepass
+            (   output.data() + i
+            ,   min <unsigned long> (999, output.size() - i)
+            );
+        }
+
+        for (auto i = 0u; i != output.size(); ++i)
+            ASSERT_EQ(output [i], expected [i]);
+    }
+
+    TEST(BiquadTest, FloatBlocks)
+    {
+        checkBiquadBlocks <float>();
+    }
+
+    TEST(BiquadTest, DoubleBlocks)
+    {
+        checkBiquadBlocks <double>();
+    }
+
+    TEST(BiquadTest, LanesMatchScalar)
+    {
+        const auto left = noise (1000, 4);
+        const auto right = noise (1000, 5);
+
+        vector <float> interleaved;
+        for (auto i = 0u; i != left.size(); ++i)
+        {
+            interleaved.push_back (left [i]);
+            interleaved.push_back (right [i]);
+        }
+
+        BiquadLanes <float, 2> lanes;
+        lanes.setParams (0.2, 0, -0.2, -1.5, 0.6);
+        lanes.forward (interleaved.data(), left.size());
+
+        Biquad <float> biquad;
+        biquad.setParams (0.2, 0, -0.2, -1.5, 0.6);
+        auto l = left;
+        biquad.onepass (l);
+        biquad.reset();
+        auto r = right;
+        biquad.onepass (r);
+
+        for (auto i = 0u; i != left.size(); ++i)
+        {
+            ASSERT_FLOAT_EQ(interleaved [i * 2 + 0], l [i]);
+            ASSERT_FLOAT_EQ(interleaved [i * 2 + 1], r [i]);
+        }
+    }
+
+    TEST(LinkwitzRileyTest, FusedMatchesSequential)
+    {
+        const auto SAMPLE_RATE = 44100.0;
+        const auto LO = 45.0;
+        const auto HI = 175.0;
+        const auto input = noise (44100, 6);
+
+        LinkwitzRiley fused;
+        fused.setParams (LO, HI, SAMPLE_RATE);
+        auto output = input;
+        fused.filter (output);
+
+        //  The sections, each run forward and backward on its own.
+        const auto section = [SAMPLE_RATE] (double cutoff, bool lopass)
+        {
+            const auto c = 1 / tan (M_PI * cutoff / SAMPLE_RATE);
+            const auto a0 = c * c + c * sqrt (2) + 1;
+            const auto b = lopass ? 1 : c * c;
+            Biquad <double> ret;
+            ret.setParams
+            (   b / a0
+            ,   (lopass ? 2 : -2) * b / a0
+            ,   b / a0
+            ,   (-2 * (c * c - 1)) / a0
+            ,   (c * c - c * sqrt (2) + 1) / a0
+            );
+            return ret;
+        };
+        auto expected = input;
+        auto lopass = section (HI, true);
+        lopass.twopass (expected);
+        auto hipass = section (LO, false);
+        hipass.twopass (expected);
+
+        //  Reordering the sections only changes the transients at the ends.
+        float peak = 0;
+        for (auto i : expected)
+            peak = max (peak, abs (i));
+        for (auto i = input.size() / 4; i != input.size() * 3 / 4; ++i)
+            ASSERT_NEAR(output [i], expected [i], peak * 1e-4);
+    }
+
+    TEST(BandTest, Edges)
+    {
+        const auto edges = bandEdges (45);
+        ASSERT_EQ(edges.size(), NUM_BANDS + 1);
+        ASSERT_FLOAT_EQ(edges.front(), 45);
+        ASSERT_FLOAT_EQ(edges.back(), 20000);
+        for (auto i = 1u; i != edges.size(); ++i)
+            ASSERT_TRUE(edges [i - 1] < edges [i]);
+    }
+
+#if NUM_BANDS == 8
+    TEST(MultirateTest, Decimation)
+    {
+        const auto decimation = bandDecimation (44100, 45);
+        const vector <unsigned long> expected {32, 16, 8, 4, 2, 1, 1, 1};
+        ASSERT_EQ(decimation, expected);
+    }
+#endif
+
+    /// Check that filtering and processing interleaved bands matches doing
+    /// so with the bands kept separate.
+    void checkInterleaved (FilterType ft)
+    {
+        const auto SAMPLES = 4000u;
+        const auto SAMPLE_RATE = 44100.0f;
+
+        vector <vector <vector <float>>> split (2);
+        vector <vector <float>> interleaved (split.size());
+        for (auto i = 0u; i != split.size(); ++i)
+        {
+            for (auto band = 0u; band != NUM_BANDS; ++band)
+                split [i].push_back (noise (SAMPLES, i * NUM_BANDS + band));
+
+            for (auto j = 0u; j != SAMPLES; ++j)
+                for (auto band = 0u; band != NUM_BANDS; ++band)
+                    interleaved [i].push_back (split [i] [band] [j]);
+        }
+
+        const auto compare = [] (const auto & output, const auto & expected)
+        {
+            ASSERT_EQ(output.size(), expected.size());
+            for (auto i = 0u; i != output.size(); ++i)
+            {
+                ASSERT_EQ(output [i].size(), expected [i].size());
+                for (auto j = 0u; j != output [i].size(); ++j)
+                    ASSERT_NEAR(output [i] [j], expected [i] [j], 1e-4);
+            }
+        };
+
+        auto splitCopy = split;
+        auto interleavedCopy = interleaved;
+        compare
+        (   filterAndMixInterleaved (ft, interleavedCopy, SAMPLE_RATE, 45)
+        ,   filterAndMix (ft, splitCopy, SAMPLE_RATE, 45)
+        );
+
+        compare
+        (   processInterleaved (ft, interleaved, SAMPLE_RATE, true, 45, true, 0.5)
+        ,   process (ft, split, SAMPLE_RATE, true, 45, true, 0.5)
+        );
+    }
+
+    TEST(InterleavedTest, OnepassBiquad)
+    {
+        checkInterleaved (FILTER_TYPE_BIQUAD_ONEPASS);
+    }
+
+    TEST(InterleavedTest, TwopassBiquad)
+    {
+        checkInterleaved (FILTER_TYPE_BIQUAD_TWOPASS);
+    }
+
+    TEST(InterleavedTest, LinkwitzRiley)
+    {
+        checkInterleaved (FILTER_TYPE_LINKWITZ_RILEY);
+    }
+
+    TEST(MultirateTest, UpsampleSine)
+    {
+        //  A sine well below the input Nyquist should come out as the same
+        //  sine at the higher rate, away from the ends.
+        const auto FACTOR = 8u;
+        const auto FREQ = 0.2;
+        vector <float> input (400);
+        for (auto i = 0u; i != input.size(); ++i)
+            input [i] = sin (2 * M_PI * FREQ * i);
+
+        PolyphaseUpsampler upsampler (FACTOR);
+        vector <float> output (input.size() * FACTOR, 0);
+        upsampler.upsampleAndAdd (input, output.data());
+
+        for (auto i = 100 * FACTOR; i != 300 * FACTOR; ++i)
+            ASSERT_NEAR(output [i], sin (2 * M_PI * FREQ * i / FACTOR), 1e-3);
+    }
+}
@@ -0,0 +1,68 @@
+#include "hrtf_file.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <cstdio>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    class HrtfFileTest: public ::testing::Test
+    {
+    protected:
+        HrtfFileTest()
+        :   fname ("hrtf_file_test.hrtf")
+        {
+            //  4 azimuths, 2 elevations, 2 bands, 2 channels.
+            //  The value encodes the grid position, so lookups can be checked.
+            vector <float> magnitudes;
+            for (auto c = 0; c != 2; ++c)
+                for (auto a = 0; a != 4; ++a)
+                    for (auto e = 0; e != 2; ++e)
+                        for (auto b = 0; b != 2; ++b)
+                            magnitudes.push_back (c * 1000 + a * 100 + e * 10 + b);
+
+            HrtfFile::write (fname, 4, 2, {0, 1400, 20000}, magnitudes);
+        }
+
+        virtual ~HrtfFileTest()
+        {
+            remove (fname.c_str());
+            remove ((fname + ".cache").c_str());
+        }
+
+        static void check (const HrtfTable & table)
+        {
+            //  bands 0-3 lie entirely in the first file band
+            ASSERT_FLOAT_EQ(table [0] [0] [0].s [0], 0);
+            ASSERT_FLOAT_EQ(table [0] [90] [0].s [3], 100);
+            ASSERT_FLOAT_EQ(table [0] [180] [90].s [0], 210);
+            ASSERT_FLOAT_EQ(table [1] [270] [179].s [0], 1310);
+
+            //  bands 4-7 lie entirely in the second file band
+            ASSERT_FLOAT_EQ(table [0] [0] [0].s [4], 1);
+            ASSERT_FLOAT_EQ(table [1] [359] [0].s [7], 1001);
+        }
+
+        const string fname;
+    };
+
+    TEST_F(HrtfFileTest, LoadFile)
+    {
+        HrtfFile file (fname);
+        check (file.getTable());
+    }
+
+    TEST_F(HrtfFileTest, LoadCache)
+    {
+        HrtfFile original (fname);
+        HrtfFile cached (fname);
+        check (cached.getTable());
+    }
+
+    TEST_F(HrtfFileTest, InvalidFile)
+    {
+        ASSERT_THROW(HrtfFile ("hrtf_file_test_missing.hrtf"), runtime_error);
+    }
+}
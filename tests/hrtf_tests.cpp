@@ -24,7 +24,7 @@ namespace TestsNamespace {
     const HrtfConfig HrtfTest::config2 = {(cl_float3) {{0, 0, -1}}, (cl_float3) {{0, 1, 0}}};
     const HrtfConfig HrtfTest::config3 = {(cl_float3) {{-1, 0, 0}}, (cl_float3) {{0, 1, 0}}};
 
-    const std::array <std::array <std::array <cl_float8, 180>, 360>, 2> & HrtfTest::getHrtfData() const
+    const HrtfTable & HrtfTest::getHrtfData() const
     {
         return HRTF_DATA;
     }
@@ -36,7 +36,7 @@ namespace TestsNamespace {
 
     Impulse HrtfTest::constructImpulse (float x, float y, float z)
     {
-        return (Impulse) {(VolumeType) {{1, 1, 1, 1, 1, 1, 1, 1}}, (cl_float3) {{x, y, z}}, dist (generator)};
+        return (Impulse) {fromOctaveBands ((cl_float8) {{1, 1, 1, 1, 1, 1, 1, 1}}), (cl_float3) {{x, y, z}}, dist (generator)};
     }
 
     TEST_F(HrtfTest, HrtfConfig0)
@@ -44,10 +44,10 @@ namespace TestsNamespace {
         run (config0);
         for (auto i = 0; i != sizeof (VolumeType) / sizeof (float); ++i)
         {
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [180] [90].s [i], out [5].volume.s [i]) << i;
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [0] [90].s [i], out [4].volume.s [i]) << i;
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [90] [90].s [i], out [0].volume.s [i]) << i;
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [270] [90].s [i], out [1].volume.s [i]) << i;
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [180] [90]).s [i], out [5].volume.s [i]) << i;
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [0] [90]).s [i], out [4].volume.s [i]) << i;
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [90] [90]).s [i], out [0].volume.s [i]) << i;
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [270] [90]).s [i], out [1].volume.s [i]) << i;
         }
     }
     TEST_F(HrtfTest, HrtfConfig1)
@@ -55,10 +55,10 @@ namespace TestsNamespace {
         run (config1);
         for (auto i = 0; i != sizeof (VolumeType) / sizeof (float); ++i)
         {
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [180] [90].s [i], out [1].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [0] [90].s [i], out [0].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [90] [90].s [i], out [5].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [270] [90].s [i], out [4].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [180] [90]).s [i], out [1].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [0] [90]).s [i], out [0].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [90] [90]).s [i], out [5].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [270] [90]).s [i], out [4].volume.s [i]);
         }
     }
     TEST_F(HrtfTest, HrtfConfig2)
@@ -66,10 +66,10 @@ namespace TestsNamespace {
         run (config2);
         for (auto i = 0; i != sizeof (VolumeType) / sizeof (float); ++i)
         {
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [180] [90].s [i], out [4].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [0] [90].s [i], out [5].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [90] [90].s [i], out [1].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [270] [90].s [i], out [0].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [180] [90]).s [i], out [4].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [0] [90]).s [i], out [5].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [90] [90]).s [i], out [1].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [270] [90]).s [i], out [0].volume.s [i]);
         }
     }
     TEST_F(HrtfTest, HrtfConfig3)
@@ -77,10 +77,10 @@ namespace TestsNamespace {
         run (config3);
         for (auto i = 0; i != sizeof (VolumeType) / sizeof (float); ++i)
         {
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [180] [90].s [i], out [0].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [0] [90].s [i], out [1].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [90] [90].s [i], out [4].volume.s [i]);
-            ASSERT_FLOAT_EQ(HRTF_DATA [0] [270] [90].s [i], out [5].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [180] [90]).s [i], out [0].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [0] [90]).s [i], out [1].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [90] [90]).s [i], out [4].volume.s [i]);
+            ASSERT_FLOAT_EQ(fromOctaveBands (HRTF_DATA [0] [270] [90]).s [i], out [5].volume.s [i]);
         }
     }
 }
@@ -25,7 +25,7 @@ namespace TestsNamespace {
         static const HrtfConfig config2;
         static const HrtfConfig config3;
 
-        virtual const std::array <std::array <std::array <cl_float8, 180>, 360>, 2> & getHrtfData() const;
+        virtual const HrtfTable & getHrtfData() const;
 
         Impulse constructImpulse (float x, float y, float z);
 
@@ -34,7 +34,7 @@ namespace TestsNamespace {
 
         default_random_engine generator;
         uniform_real_distribution <float> dist;
-        static const array <array <array <cl_float8, 180>, 360>, 2> HRTF_DATA;
+        static const HrtfTable HRTF_DATA;
     };
 
 }
@@ -0,0 +1,67 @@
+#include "impulse_spill.h"
+#include "rayverb.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <cstdio>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    class ImpulseSpillTest: public ::testing::Test
+    {
+    protected:
+        ImpulseSpillTest()
+        :   fname ("impulse_spill_test.spill")
+        {
+        }
+
+        virtual ~ImpulseSpillTest()
+        {
+            remove (fname.c_str());
+        }
+
+        const string fname;
+    };
+
+    TEST_F(ImpulseSpillTest, RoundTrip)
+    {
+        {
+            ImpulseSpillWriter writer (fname, 3, {{1, 2, 3}});
+            ASSERT_EQ(writer.capacity(), 3u);
+            writer.data() [1].time = 0.5;
+            writer.data() [2].volume.s [0] = 0.25;
+            writer.finish();
+        }
+
+        const ImpulseSpill spill (fname);
+        ASSERT_EQ(spill.size(), 3u);
+        ASSERT_FLOAT_EQ(spill.mic().s [1], 2);
+        ASSERT_FLOAT_EQ(spill.data() [0].time, 0);
+        ASSERT_FLOAT_EQ(spill.data() [1].time, 0.5);
+        ASSERT_FLOAT_EQ(spill.data() [2].volume.s [0], 0.25);
+    }
+
+    TEST_F(ImpulseSpillTest, UnfinishedFileIsRejected)
+    {
+        {
+            ImpulseSpillWriter writer (fname, 3, {{0, 0, 0}});
+        }
+
+        ASSERT_THROW(ImpulseSpill spill (fname), runtime_error);
+    }
+
+    TEST(AccumulateImpulsesInterleaved, GrowsToFitLaterImpulses)
+    {
+        const auto BANDS = sizeof (VolumeType) / sizeof (float);
+
+        vector <float> flattened;
+        accumulateImpulsesInterleaved ({{{{1}}, 0}}, 10, flattened);
+        accumulateImpulsesInterleaved ({{{{2}}, 0.2}, {{{3}}, 0}}, 10, flattened);
+
+        ASSERT_EQ(flattened.size(), 3 * BANDS);
+        ASSERT_FLOAT_EQ(flattened [0], 4);
+        ASSERT_FLOAT_EQ(flattened [2 * BANDS], 2);
+    }
+}
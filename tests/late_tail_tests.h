@@ -0,0 +1,113 @@
+#include "late_tail.h"
+#include "clstructs.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    class LateTailTest: public ::testing::Test
+    {
+    protected:
+        static constexpr float SAMPLE_RATE = 8000;
+
+        /// The decay rate of each band, in dB per second.
+        static float slope (unsigned long band)
+        {
+            return -60 / (0.4 + 0.1 * band);
+        }
+
+        /// Two channels of interleaved noise, decaying at a different rate in
+        /// each band, and lasting `seconds`.
+        /// The second channel is 6dB quieter.
+        static vector <vector <float>> decayingNoise (float seconds)
+        {
+            default_random_engine engine (0);
+            normal_distribution <float> dist;
+
+            const unsigned long LENGTH = seconds * SAMPLE_RATE;
+            vector <vector <float>> ret (2, vector <float> (LENGTH * NUM_BANDS));
+            for (auto i = 0u; i != ret.size(); ++i)
+                for (auto j = 0u; j != LENGTH; ++j)
+                    for (auto band = 0u; band != NUM_BANDS; ++band)
+                        ret [i] [j * NUM_BANDS + band] =
+                            level (i, band, j / SAMPLE_RATE) * dist (engine);
+            return ret;
+        }
+
+        static float level (unsigned long channel, unsigned long band, float t)
+        {
+            return pow (10, (slope (band) * t - 6 * channel) / 20);
+        }
+
+        /// The mean energy of one band of one channel between two times.
+        static float energy
+        (   const vector <float> & channel
+        ,   unsigned long band
+        ,   float begin
+        ,   float end
+        )
+        {
+            const unsigned long BEGIN = begin * SAMPLE_RATE;
+            const unsigned long END = end * SAMPLE_RATE;
+            double sum = 0;
+            for (auto i = BEGIN; i != END; ++i)
+                sum += pow (channel [i * NUM_BANDS + band], 2);
+            return sum / (END - BEGIN);
+        }
+    };
+
+    TEST_F(LateTailTest, EstimateDecay)
+    {
+        const auto decay = estimateDecay (decayingNoise (1), SAMPLE_RATE, 0.8);
+        ASSERT_EQ(decay.size(), NUM_BANDS);
+        for (auto band = 0u; band != NUM_BANDS; ++band)
+        {
+            ASSERT_NEAR(decay [band].slope, slope (band), 0.05 * -slope (band));
+            ASSERT_NEAR(decay [band].levels [0], 0, 1);
+            ASSERT_NEAR(decay [band].levels [1], -6, 1);
+        }
+    }
+
+    TEST_F(LateTailTest, Synthesize)
+    {
+        //  Only the first 100ms are traced, but the tail carries on at the
+        //  fitted decay rate.
+        auto flattened = decayingNoise (0.1);
+        const auto decay = synthesizeLateTail (flattened, SAMPLE_RATE, 0.08);
+        ASSERT_GT(flattened.front().size(), 0.5 * SAMPLE_RATE * NUM_BANDS);
+
+        for (auto band = 0u; band != NUM_BANDS; ++band)
+        {
+            ASSERT_NEAR(decay [band].slope, slope (band), 0.2 * -slope (band));
+            for (auto channel = 0u; channel != flattened.size(); ++channel)
+            {
+                double expected = 0;
+                for (auto i = 0.3 * SAMPLE_RATE; i < 0.4 * SAMPLE_RATE; ++i)
+                {
+                    const auto t = i / SAMPLE_RATE;
+                    expected += pow
+                    (   10
+                    ,   (decay [band].levels [channel] + decay [band].slope * t) / 10
+                    ) / (0.1 * SAMPLE_RATE);
+                }
+                const auto actual =
+                    energy (flattened [channel], band, 0.3, 0.4);
+                ASSERT_NEAR(10 * log10 (actual / expected), 0, 1);
+            }
+        }
+    }
+
+    TEST_F(LateTailTest, Silence)
+    {
+        vector <vector <float>> flattened (1, vector <float> (1000 * NUM_BANDS, 0));
+        const auto decay = synthesizeLateTail (flattened, SAMPLE_RATE, 0.05);
+        for (const auto & i : decay)
+            ASSERT_EQ(i.slope, 0);
+        ASSERT_EQ(flattened.front().size(), 1000 * NUM_BANDS);
+    }
+}
@@ -1,7 +1,19 @@
 #include "gtest/gtest.h"
 #include "rayverb_tests.h"
 #include "attenuation_tests.h"
+#include "ambisonic_tests.h"
 #include "hrtf_tests.h"
+#include "hrtf_file_tests.h"
+#include "filter_tests.h"
+#include "postprocess_tests.h"
+#include "scene_cache_tests.h"
+#include "mesh_optimisation_tests.h"
+#include "profiler_tests.h"
+#include "impulse_spill_tests.h"
+#include "results_file_tests.h"
+#include "auralizer_tests.h"
+#include "late_tail_tests.h"
+#include "decay_analysis_tests.h"
 
 int main (int argc, char * argv[]) {
     ::testing::InitGoogleTest (&argc, argv);
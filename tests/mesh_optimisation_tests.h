@@ -0,0 +1,98 @@
+#include "mesh_optimisation.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    TEST(MeshOptimisationTest, WeldSharedVertices)
+    {
+        //  Two meshes making up a unit square, each with its own vertices.
+        vector <cl_float3> vertices {
+            {{0, 0, 0}}, {{1, 0, 0}}, {{1, 1, 0}},
+            {{0, 0, 0}}, {{1, 1, 0}}, {{0, 1, 0}},
+        };
+        vector <Triangle> triangles {{0, 0, 1, 2}, {1, 3, 4, 5}};
+
+        const auto reduction = optimiseMesh (triangles, vertices);
+
+        ASSERT_EQ(reduction.verticesBefore, 6u);
+        ASSERT_EQ(reduction.verticesAfter, 4u);
+        ASSERT_EQ(vertices.size(), 4u);
+        ASSERT_EQ(triangles.size(), 2u);
+        ASSERT_EQ(triangles [1].v0, triangles [0].v0);
+        ASSERT_EQ(triangles [1].v1, triangles [0].v2);
+    }
+
+    TEST(MeshOptimisationTest, WeldAcrossCells)
+    {
+        //  Vertices a tiny distance apart should be welded wherever they lie
+        //  on the grid used to find them.
+        const auto TOLERANCE = 0.001f;
+        vector <cl_float3> vertices {
+            {{0, 0, 0}}, {{1, 0, 0}}, {{0.00149999f, 1, 0}},
+            {{0, 0, 0}}, {{0.00150001f, 1, 0}}, {{0, 2, 0}},
+        };
+        vector <Triangle> triangles {{0, 0, 1, 2}, {0, 3, 4, 5}};
+
+        optimiseMesh (triangles, vertices, TOLERANCE);
+
+        ASSERT_EQ(vertices.size(), 4u);
+        ASSERT_EQ(triangles [1].v1, triangles [0].v2);
+    }
+
+    TEST(MeshOptimisationTest, DegenerateAndDuplicate)
+    {
+        vector <cl_float3> vertices {
+            {{0, 0, 0}}, {{1, 0, 0}}, {{0, 1, 0}}, {{2, 0, 0}},
+        };
+        vector <Triangle> triangles {
+            {0, 0, 1, 2},
+            {0, 0, 1, 3},   //  collinear
+            {0, 0, 0, 2},   //  repeated vertex
+            {1, 2, 0, 1},   //  same vertices as the first
+        };
+
+        const auto reduction = optimiseMesh (triangles, vertices);
+
+        ASSERT_EQ(reduction.degenerate, 2u);
+        ASSERT_EQ(reduction.duplicate, 1u);
+        ASSERT_EQ(triangles.size(), 1u);
+        ASSERT_EQ(triangles [0].surface, 0u);
+        ASSERT_EQ(vertices.size(), 3u);
+    }
+
+    TEST(MeshOptimisationTest, MergeSplitTriangle)
+    {
+        //  A triangle split in two through the midpoint of one edge.
+        vector <cl_float3> vertices {
+            {{0, 0, 0}}, {{1, 0, 0}}, {{2, 0, 0}}, {{1, 1, 0}},
+        };
+        vector <Triangle> triangles {{0, 0, 1, 3}, {0, 1, 2, 3}};
+
+        auto reduction = optimiseMesh (triangles, vertices);
+
+        ASSERT_EQ(reduction.merged, 1u);
+        ASSERT_EQ(triangles.size(), 1u);
+        ASSERT_EQ(vertices.size(), 3u);
+
+        //  The merged triangle keeps the original winding.
+        const auto & t = triangles [0];
+        const auto & a = vertices [t.v0];
+        const auto & b = vertices [t.v1];
+        const auto & c = vertices [t.v2];
+        const auto z =
+            (b.s [0] - a.s [0]) * (c.s [1] - a.s [1]) -
+            (b.s [1] - a.s [1]) * (c.s [0] - a.s [0]);
+        ASSERT_FLOAT_EQ(z, 2);
+
+        //  Different surfaces are never merged.
+        vertices = {{{0, 0, 0}}, {{1, 0, 0}}, {{2, 0, 0}}, {{1, 1, 0}}};
+        triangles = {{0, 0, 1, 3}, {1, 1, 2, 3}};
+        reduction = optimiseMesh (triangles, vertices);
+        ASSERT_EQ(reduction.merged, 0u);
+        ASSERT_EQ(triangles.size(), 2u);
+    }
+}
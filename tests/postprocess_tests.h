@@ -0,0 +1,75 @@
+#include "rayverb.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <cmath>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    TEST(PostprocessTest, Silence)
+    {
+        //  With nothing to normalize against, silence should stay silent
+        //  rather than being divided by zero.
+        vector <vector <float>> data (2, vector <float> (1000, 0));
+        postprocess (data, true, false, 1);
+        for (const auto & channel : data)
+        {
+            ASSERT_EQ(channel.size(), 1000u);
+            for (auto i : channel)
+                ASSERT_EQ(i, 0);
+        }
+
+        postprocess (data, true, true, 1);
+        for (const auto & channel : data)
+            ASSERT_TRUE(channel.empty());
+    }
+
+    TEST(PostprocessTest, TrimKeepsLastLoudSample)
+    {
+        //  The loudest tail sample of each channel lies in a different chunk,
+        //  and every channel is trimmed to the longest.
+        vector <vector <float>> data (2, vector <float> (200000, 0));
+        data [0] [0] = 1;
+        data [0] [1000] = 0.1;
+        data [1] [70000] = 0.1;
+        data [1] [70001] = 1e-7;
+
+        postprocess (data, false, true, 1);
+        for (const auto & channel : data)
+            ASSERT_EQ(channel.size(), 70001u);
+        ASSERT_EQ(data [1] [70000], 0.1f);
+        ASSERT_EQ(data [0] [1000], 0.1f);
+    }
+
+    TEST(PostprocessTest, PrecomputedPeak)
+    {
+        //  Sections normalized against the peak of the whole signal should
+        //  join up to match the whole signal normalized at once.
+        vector <vector <float>> whole (2, vector <float> (100000));
+        for (auto i = 0u; i != whole.size(); ++i)
+            for (auto j = 0u; j != whole [i].size(); ++j)
+                whole [i] [j] = sin (j * (i + 1) * 0.001) * exp (j * -0.0001);
+
+        vector <vector <float>> first, second;
+        for (const auto & channel : whole)
+        {
+            const auto middle = channel.begin() + channel.size() / 3;
+            first.push_back (vector <float> (channel.begin(), middle));
+            second.push_back (vector <float> (middle, channel.end()));
+        }
+
+        const auto peak = findPeak (whole);
+        postprocess (whole, true, false, 0.5);
+        postprocess (first, true, false, 0.5, peak);
+        postprocess (second, true, false, 0.5, peak);
+
+        for (auto i = 0u; i != whole.size(); ++i)
+        {
+            auto joined = first [i];
+            joined.insert (joined.end(), second [i].begin(), second [i].end());
+            ASSERT_EQ(joined, whole [i]);
+        }
+    }
+}
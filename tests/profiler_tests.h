@@ -0,0 +1,51 @@
+#include "profiler.h"
+#include "rayverb.h"
+
+#include "rapidjson/document.h"
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    TEST(ProfilerTest, RecordsStagesWhenEnabled)
+    {
+        const string fname ("profiler_test.json");
+
+        Profiler::setEnabled (false);
+        Profiler::clear();
+        {
+            ScopedStage stage ("disabled");
+        }
+
+        Profiler::setEnabled (true);
+        {
+            ScopedStage outer ("outer");
+            for (auto i = 0; i != 3; ++i)
+                ScopedStage inner ("inner");
+        }
+        Profiler::setEnabled (false);
+
+        Profiler::writeJson (fname);
+
+        rapidjson::Document document;
+        attemptJsonParse (fname, document);
+        remove (fname.c_str());
+
+        ASSERT_TRUE(document.IsObject());
+        ASSERT_EQ(document ["stages"].Size(), 4u);
+
+        const auto & totals = document ["stage_totals"];
+        ASSERT_FALSE(totals.HasMember ("disabled"));
+        ASSERT_EQ(totals ["outer"] ["count"].GetUint(), 1u);
+        ASSERT_EQ(totals ["inner"] ["count"].GetUint(), 3u);
+        ASSERT_LE
+        (   totals ["inner"] ["total_ms"].GetDouble()
+        ,   totals ["outer"] ["total_ms"].GetDouble()
+        );
+
+        Profiler::clear();
+    }
+}
@@ -23,3 +23,39 @@ void TestsNamespace::RaytracerTest::test_eq (const cl_float3 & a, const cl_float
         ASSERT_FLOAT_EQ(a.s [i], b.s [i]);
     }
 }
+
+const cl_float3 TestsNamespace::NonConvexRaytracerTest::mic_pos;
+const cl_float3 TestsNamespace::NonConvexRaytracerTest::src_pos;
+
+TestsNamespace::NonConvexRaytracerTest::NonConvexRaytracerTest()
+:   Raytracer (NUM_REFLECTIONS, TEST_NONCONVEX_OBJ, TEST_MAT, true)
+,   directions (getRandomDirections (64 * 100))
+{
+}
+
+void TestsNamespace::NonConvexRaytracerTest::checkCachedTrace
+(   const cl_float3 & first_mic
+,   const cl_float3 & first_src
+,   const cl_float3 & mic
+,   const cl_float3 & src
+)
+{
+    setPathCaching (true);
+    raytrace (first_mic, first_src, directions, false);
+    raytrace (mic, src, directions, false);
+    const auto cached = getRawDiffuse().impulses;
+
+    setPathCaching (false);
+    raytrace (mic, src, directions, false);
+    const auto fresh = getRawDiffuse().impulses;
+
+    ASSERT_EQ(cached.size(), fresh.size());
+    for (auto i = 0u; i != cached.size(); ++i)
+    {
+        ASSERT_FLOAT_EQ(cached [i].time, fresh [i].time);
+        for (auto j = 0; j != 3; ++j)
+        {
+            ASSERT_FLOAT_EQ(cached [i].position.s [j], fresh [i].position.s [j]);
+        }
+    }
+}
@@ -1,4 +1,5 @@
 #include "rayverb.h"
+#include "helpers.h"
 
 #define __CL_ENABLE_EXCEPTIONS
 #include "cl.hpp"
@@ -7,6 +8,8 @@
 
 #include <vector>
 #include <random>
+#include <algorithm>
+#include <cmath>
 
 namespace TestsNamespace {
     using namespace std;
@@ -27,6 +30,29 @@ namespace TestsNamespace {
         static void test_eq (const cl_float3 & a, const cl_float3 & b);
     };
 
+    /// A room full of pillars, where moving the source changes which surface
+    /// many rays hit next.
+    class NonConvexRaytracerTest: public Raytracer, public ::testing::Test
+    {
+    protected:
+        NonConvexRaytracerTest();
+
+        /// Trace with and without path caching, after tracing from
+        /// (first_mic, first_src) with caching, and check that the diffuse
+        /// results are identical.
+        void checkCachedTrace
+        (   const cl_float3 & first_mic
+        ,   const cl_float3 & first_src
+        ,   const cl_float3 & mic
+        ,   const cl_float3 & src
+        );
+
+        vector <cl_float3> directions;
+        static constexpr cl_float3 mic_pos = {{0, 0, 0}};
+        static constexpr cl_float3 src_pos = {{1, 0, -1}};
+        static const auto NUM_REFLECTIONS = 32;
+    };
+
     TEST_F(RaytracerTest, ImpulseDirections)
     {
         raytrace (mic_pos, src_pos, directions, true);
@@ -46,5 +72,130 @@ namespace TestsNamespace {
         test_eq (diffuse [4 * NUM_REFLECTIONS + 1].position, {{-25, 2, -2}});
         test_eq (diffuse [5 * NUM_REFLECTIONS + 1].position, {{25, 2, -2}});
     }
-}
 
+    TEST_F(RaytracerTest, CachedPathsMatchFreshTrace)
+    {
+        const cl_float3 moved_mic = {{0, 2, 1}};
+        const cl_float3 moved_src = {{0.1, 2, 2}};
+
+        setPathCaching (true);
+        raytrace (mic_pos, src_pos, directions, false);
+        raytrace (moved_mic, src_pos, directions, false);
+        const auto micMoved = getRawDiffuse().impulses;
+        raytrace (moved_mic, moved_src, directions, false);
+        const auto srcMoved = getRawDiffuse().impulses;
+
+        setPathCaching (false);
+        raytrace (moved_mic, src_pos, directions, false);
+        const auto micMovedFresh = getRawDiffuse().impulses;
+        raytrace (moved_mic, moved_src, directions, false);
+        const auto srcMovedFresh = getRawDiffuse().impulses;
+
+        ASSERT_EQ(micMoved.size(), micMovedFresh.size());
+        ASSERT_EQ(srcMoved.size(), srcMovedFresh.size());
+        for (auto i = 0u; i != micMoved.size(); ++i)
+        {
+            ASSERT_FLOAT_EQ(micMoved [i].time, micMovedFresh [i].time);
+            test_eq (micMoved [i].position, micMovedFresh [i].position);
+            ASSERT_FLOAT_EQ(srcMoved [i].time, srcMovedFresh [i].time);
+            test_eq (srcMoved [i].position, srcMovedFresh [i].position);
+        }
+    }
+
+    TEST_F(RaytracerTest, ExhaustiveImageSources)
+    {
+        //  The floor reflection lands on the diagonal between the floor's two
+        //  triangles, which share a plane, so it should only be found once.
+        const cl_float3 source = {{2, 2, 0}};
+        setImageSourceOrder (1);
+        raytrace (mic_pos, source, {}, false);
+
+        //  The room has six flat sides, and every one reflects the source.
+        const auto images = getRawImages (false).impulses;
+        ASSERT_EQ(images.size(), 7u);
+        ASSERT_EQ(getRawImages (true).impulses.size(), 6u);
+
+        const auto floor = find_if
+        (   images.begin()
+        ,   images.end()
+        ,   [] (const auto & i) {return i.position.s [1] < 0;}
+        );
+        ASSERT_NE(floor, images.end());
+        ASSERT_NEAR(floor->position.s [0], 2, 1e-4);
+        ASSERT_NEAR(floor->position.s [1], -2, 1e-4);
+        ASSERT_NEAR(floor->position.s [2], 0, 1e-4);
+        ASSERT_NEAR(floor->time, sqrt (20) / SPEED_OF_SOUND, 1e-6);
+    }
+
+    TEST_F(RaytracerTest, TracedImageSourceVolume)
+    {
+        //  The rays and the exhaustive search find the floor reflection along
+        //  the same path, so they should give it the same energy.
+        auto isFloor = [] (const auto & i)
+        {
+            return fabs (i.time - sqrt (20) / SPEED_OF_SOUND) < 1e-6;
+        };
+
+        raytrace (mic_pos, src_pos, getRandomDirections (64 * 1000), false);
+        const auto tracedImages = getRawImages (true).impulses;
+        setImageSourceOrder (1);
+        raytrace (mic_pos, src_pos, {}, false);
+        const auto searchedImages = getRawImages (true).impulses;
+
+        const auto traced =
+            find_if (tracedImages.begin(), tracedImages.end(), isFloor);
+        const auto searched =
+            find_if (searchedImages.begin(), searchedImages.end(), isFloor);
+        ASSERT_NE(traced, tracedImages.end());
+        ASSERT_NE(searched, searchedImages.end());
+
+        for (auto i = 0u; i != NUM_BANDS; ++i)
+        {
+            ASSERT_NE(searched->volume.s [i], 0);
+            ASSERT_NEAR(traced->volume.s [i], searched->volume.s [i], 1e-6);
+        }
+    }
+
+    TEST_F(RaytracerTest, UnboundedImageSourceOrder)
+    {
+        setImageSourceOrder (MAX_UNBOUNDED_IMAGE_SOURCE_ORDER);
+        ASSERT_THROW(setImageSourceOrder (MAX_UNBOUNDED_IMAGE_SOURCE_ORDER + 1), runtime_error);
+        setImageSourceOrder (MAX_UNBOUNDED_IMAGE_SOURCE_ORDER + 1, 0.1);
+    }
+
+    TEST_F(RaytracerTest, RayMaxTime)
+    {
+        const auto MAX_TIME = 0.5f;
+
+        raytrace (mic_pos, src_pos, directions, false);
+        const auto full = getRawDiffuse().impulses;
+        setRayMaxTime (MAX_TIME);
+        raytrace (mic_pos, src_pos, directions, false);
+        const auto limited = getRawDiffuse().impulses;
+
+        //  Rays stop once every later impulse would arrive after MAX_TIME,
+        //  and are otherwise unchanged.
+        ASSERT_EQ(limited.size(), full.size());
+        auto dropped = 0u;
+        for (auto i = 0u; i != full.size(); ++i)
+        {
+            if (limited [i].time != full [i].time)
+            {
+                ASSERT_EQ(limited [i].time, 0);
+                ASSERT_GT(full [i].time, MAX_TIME);
+                ++dropped;
+            }
+        }
+        ASSERT_GT(dropped, 0u);
+    }
+
+    TEST_F(NonConvexRaytracerTest, CachedPathsAfterMicMove)
+    {
+        checkCachedTrace (mic_pos, src_pos, {{0, 0.5, 1}}, src_pos);
+    }
+
+    TEST_F(NonConvexRaytracerTest, CachedPathsAfterSourceMove)
+    {
+        checkCachedTrace (mic_pos, src_pos, mic_pos, {{1.5, 0, -1}});
+    }
+}
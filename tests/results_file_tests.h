@@ -0,0 +1,63 @@
+#include "rayverb.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <cstdio>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    class ResultsFileTest: public ::testing::Test
+    {
+    protected:
+        ResultsFileTest()
+        :   fname ("results_file_test.rvr")
+        {
+            diffuse [0].volume.s [0] = 0.5;
+            diffuse [0].time = 0.25;
+            direct [0].time = 0.01;
+            images [0].time = 0.02;
+            images [1].time = 0.03;
+
+            RaytracerResultsFile::write
+            (   fname
+            ,   {{0, 1, 2}}
+            ,   diffuse.data()
+            ,   diffuse.size()
+            ,   direct
+            ,   images
+            );
+        }
+
+        virtual ~ResultsFileTest()
+        {
+            remove (fname.c_str());
+        }
+
+        const string fname;
+        vector <Impulse> diffuse {3, (Impulse) {{{0}}}};
+        vector <Impulse> direct {1, (Impulse) {{{0}}}};
+        vector <Impulse> images {2, (Impulse) {{{0}}}};
+    };
+
+    TEST_F(ResultsFileTest, SilentDiffuseImpulsesAreDropped)
+    {
+        const RaytracerResultsFile saved (fname);
+        ASSERT_FLOAT_EQ(saved.mic().s [2], 2);
+
+        const auto results = saved.getRawDiffuse();
+        ASSERT_EQ(results.impulses.size(), 1u);
+        ASSERT_FLOAT_EQ(results.impulses [0].time, 0.25);
+    }
+
+    TEST_F(ResultsFileTest, RemoveDirect)
+    {
+        const RaytracerResultsFile saved (fname);
+        ASSERT_EQ(saved.getRawImages (false).impulses.size(), 3u);
+        ASSERT_FLOAT_EQ(saved.getRawImages (false).impulses [0].time, 0.01);
+        ASSERT_EQ(saved.getRawImages (true).impulses.size(), 2u);
+        ASSERT_FLOAT_EQ(saved.getRawImages (true).impulses [0].time, 0.02);
+        ASSERT_EQ(saved.getAllRaw (true).impulses.size(), 3u);
+    }
+}
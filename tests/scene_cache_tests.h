@@ -0,0 +1,110 @@
+#include "scene_cache.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    class SceneCacheTest: public ::testing::Test
+    {
+    protected:
+        SceneCacheTest()
+        :   fname ("scene_cache_test.scene")
+        ,   source ("scene_cache_test.obj")
+        ,   triangles ({{1, 0, 1, 2}, {0, 2, 1, 0}})
+        ,   vertices ({{{0, 0, 0}}, {{1, 0, 0}}, {{0, 1, 0}}})
+        ,   surfaces (2, {fromOctaveBands ({{0.5}}), fromOctaveBands ({{0.25}})})
+        {
+            ofstream (source) << "v 0 0 0" << endl;
+        }
+
+        virtual ~SceneCacheTest()
+        {
+            remove (fname.c_str());
+            remove (source.c_str());
+        }
+
+        const string fname;
+        const string source;
+        const vector <Triangle> triangles;
+        const vector <cl_float3> vertices;
+        const vector <Surface> surfaces;
+    };
+
+    TEST_F(SceneCacheTest, RoundTrip)
+    {
+        SceneCache::write (fname, 1234, {source}, triangles, vertices, surfaces);
+
+        vector <Triangle> t;
+        vector <cl_float3> v;
+        vector <Surface> s;
+        ASSERT_TRUE(SceneCache::load (fname, 1234, t, v, s));
+
+        ASSERT_EQ(t.size(), triangles.size());
+        ASSERT_EQ(v.size(), vertices.size());
+        ASSERT_EQ(s.size(), surfaces.size());
+        ASSERT_EQ(t [1].v1, 1u);
+        ASSERT_FLOAT_EQ(v [2].s [1], 1);
+        ASSERT_FLOAT_EQ(s [1].diffuse.s [0], surfaces [1].diffuse.s [0]);
+    }
+
+    TEST_F(SceneCacheTest, StaleHash)
+    {
+        SceneCache::write (fname, 1234, {source}, triangles, vertices, surfaces);
+
+        vector <Triangle> t;
+        vector <cl_float3> v;
+        vector <Surface> s;
+        ASSERT_FALSE(SceneCache::load (fname, 4321, t, v, s));
+        ASSERT_FALSE(SceneCache::load ("scene_cache_test_missing.scene", 1234, t, v, s));
+    }
+
+    TEST_F(SceneCacheTest, Inputs)
+    {
+        SceneCache::write
+        (   fname
+        ,   1234
+        ,   {source, "materials.mtl"}
+        ,   triangles
+        ,   vertices
+        ,   surfaces
+        );
+        ASSERT_EQ(SceneCache::inputs (fname), (vector <string> {source, "materials.mtl"}));
+        ASSERT_TRUE(SceneCache::inputs ("scene_cache_test_missing.scene").empty());
+
+        vector <Triangle> t;
+        vector <cl_float3> v;
+        vector <Surface> s;
+        ASSERT_TRUE(SceneCache::load (fname, 1234, t, v, s));
+        ASSERT_EQ(t [1].v1, 1u);
+    }
+
+    TEST_F(SceneCacheTest, Path)
+    {
+        ofstream (fname) << "{}" << endl;
+
+        SceneCache::setDirectory ("scene_cache_test_dir");
+        const auto path = SceneCache::path (source, fname);
+        ASSERT_EQ(path.find ("scene_cache_test_dir/"), 0u);
+        ASSERT_NE(path, SceneCache::path (fname, source));
+        ASSERT_TRUE(SceneCache::path ("scene_cache_test_missing.obj", fname).empty());
+
+        SceneCache::setDirectory ("");
+        ASSERT_TRUE(SceneCache::path (source, fname).empty());
+    }
+
+    TEST_F(SceneCacheTest, HashFollowsContents)
+    {
+        const auto original = SceneCache::hashFiles ({source});
+        ASSERT_EQ(original, SceneCache::hashFiles ({source}));
+
+        ofstream (source) << "v 0 0 1" << endl;
+        ASSERT_NE(original, SceneCache::hashFiles ({source}));
+
+        ASSERT_THROW(SceneCache::hashFiles ({"scene_cache_test_missing.obj"}), runtime_error);
+    }
+}
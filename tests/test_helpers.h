@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+#include <random>
+
+namespace TestsNamespace {
+    using namespace std;
+
+    /// Uniform white noise in [-1, 1), the same for the same seed.
+    inline vector <float> noise (unsigned long length, unsigned seed)
+    {
+        default_random_engine engine (seed);
+        uniform_real_distribution <float> dist (-1, 1);
+        vector <float> ret (length);
+        for (auto && i : ret)
+            i = dist (engine);
+        return ret;
+    }
+}